@@ -93,25 +93,8 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 	    case EX_MOD:
 	    sig = 0;
 #if OPT_A3
-	 	  
-	 	  struct addrspace *as;
-  		  struct proc *p = curproc;
-
-	 	  KASSERT(curproc->p_addrspace != NULL);
-		  as_deactivate();
-		  as = curproc_setas(NULL);
-		  as_destroy(as);
-		  p->exitcode = _MKWAIT_SIG(sig);
-
-		  proc_remthread(curthread);
-		  // locking
-		  lock_acquire(murderlk);
-		  proc_destroy(p);
-		  lock_release(murderlk);
-		  thread_exit();
-		  /* thread_exit() does not return, so we should never get here */
-		  panic("return from thread_exit in sys_exit\n");
-
+		/* The parent sees the process as killed */
+		proc_exit(_MKWAIT_SIG(sig));
 #endif // OPT_A3
 
 	    break;
@@ -224,6 +207,19 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+#if OPT_A2
+		/*
+		 * If another thread has called _exit, leave rather than
+		 * going back to user mode. This is what stops threads
+		 * that never make system calls.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			proc_checkexit();
+		}
+#endif
 		goto done2;
 	}
 
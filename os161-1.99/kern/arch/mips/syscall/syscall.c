@@ -31,11 +31,16 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <copyinout.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 #include <syscall.h>
+#include <kmemcache.h>
+#include <sysstats.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 /*
  * System call dispatcher.
@@ -81,12 +86,25 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+	time_t ssecs;		/* for the statistics */
+	uint32_t snsecs;
+#if OPT_A2
+	off_t retval64;		/* for calls that return 64-bit values */
+	bool is64;
+	off_t pos;
+	int whence;
+#endif
+#if OPT_A3
+	int mapfd;
+	off_t mapoffset;
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	sysstats_enter(callno, &ssecs, &snsecs);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -98,6 +116,10 @@ syscall(struct trapframe *tf)
 	 */
 
 	retval = 0;
+#if OPT_A2
+	retval64 = 0;
+	is64 = false;
+#endif
 
 	switch (callno) {
 	    case SYS_reboot:
@@ -139,10 +161,118 @@ syscall(struct trapframe *tf)
      break;
 
      case SYS_execv:
-       err = sys_execv((char *)tf->tf_a0, (char **)tf->tf_a1);
+       err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+     break;
+
+     case SYS_spawn:
+       err = sys_spawn((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+		       (pid_t *)&retval);
+     break;
+
+     case SYS_open:
+       err = sys_open((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+		      (mode_t)tf->tf_a2, (int *)&retval);
+     break;
+
+     case SYS_read:
+       err = sys_read((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+		      (unsigned)tf->tf_a2, (int *)&retval);
+     break;
+
+     case SYS_close:
+       err = sys_close((int)tf->tf_a0);
+     break;
+
+     case SYS_lseek:
+       /* 64-bit offset in the aligned pair a2/a3; whence on the stack */
+       pos = ((off_t)tf->tf_a2 << 32) | (uint32_t)tf->tf_a3;
+       err = copyin((const_userptr_t)(tf->tf_sp + 16), &whence,
+		    sizeof(whence));
+       if (err) {
+	 break;
+       }
+       err = sys_lseek((int)tf->tf_a0, pos, whence, &retval64);
+       is64 = true;
+     break;
+
+     case SYS_pipe:
+       err = sys_pipe((userptr_t)tf->tf_a0, (int *)&retval);
+     break;
+
+     case SYS_futex_wait:
+       err = sys_futex_wait((userptr_t)tf->tf_a0, (int)tf->tf_a1);
+     break;
+
+     case SYS_futex_wake:
+       err = sys_futex_wake((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+			    (int *)&retval);
+     break;
+
+     case SYS_ring_setup:
+       err = sys_ring_setup((userptr_t)tf->tf_a0, (unsigned)tf->tf_a1);
+     break;
+
+     case SYS_ring_submit:
+       err = sys_ring_submit((unsigned)tf->tf_a0, (int *)&retval);
+     break;
+
+     case SYS_sysstats:
+       err = sys_sysstats((userptr_t)tf->tf_a0, (unsigned)tf->tf_a1,
+			  (int *)&retval);
+     break;
+
+     case SYS_dup2:
+       err = sys_dup2((int)tf->tf_a0, (int)tf->tf_a1, (int *)&retval);
      break;
 
 #endif /* OPT_A2  */
+#if OPT_A3
+     case SYS_sbrk:
+       err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+     break;
+
+     case SYS_mmap:
+       /* fd and the 64-bit offset are the 5th and 6th-7th words */
+       err = copyin((const_userptr_t)(tf->tf_sp + 16), &mapfd,
+		    sizeof(mapfd));
+       if (err) {
+	 break;
+       }
+       err = copyin((const_userptr_t)(tf->tf_sp + 24), &mapoffset,
+		    sizeof(mapoffset));
+       if (err) {
+	 break;
+       }
+       err = sys_mmap((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1,
+		      (int)tf->tf_a2, (int)tf->tf_a3, mapfd, mapoffset,
+		      &retval);
+     break;
+
+     case SYS_munmap:
+       err = sys_munmap((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1);
+     break;
+
+     case SYS_msync:
+       err = sys_msync((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1,
+		       (int)tf->tf_a2);
+     break;
+
+     case SYS___thread_create:
+       err = sys___thread_create(tf, (userptr_t)tf->tf_a0,
+				 (userptr_t)tf->tf_a1,
+				 (userptr_t)tf->tf_a2, (int *)&retval);
+     break;
+
+     case SYS_thread_exit:
+       sys_thread_exit((int)tf->tf_a0);
+       /* sys_thread_exit does not return */
+       panic("unexpected return from sys_thread_exit");
+     break;
+
+     case SYS_thread_join:
+       err = sys_thread_join((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+     break;
+#endif /* OPT_A3 */
 
 	default:
 	  kprintf("Unknown syscall %d\n", callno);
@@ -150,6 +280,7 @@ syscall(struct trapframe *tf)
 	  break;
 	}
 
+	sysstats_exit(callno, ssecs, snsecs);
 
 	if (err) {
 		/*
@@ -160,6 +291,14 @@ syscall(struct trapframe *tf)
 		tf->tf_v0 = err;
 		tf->tf_a3 = 1;      /* signal an error */
 	}
+#if OPT_A2
+	else if (is64) {
+		/* Success, with the 64-bit result split across v0/v1. */
+		tf->tf_v0 = (uint32_t)(retval64 >> 32);
+		tf->tf_v1 = (uint32_t)retval64;
+		tf->tf_a3 = 0;      /* signal no error */
+	}
+#endif
 	else {
 		/* Success. */
 		tf->tf_v0 = retval;
@@ -177,8 +316,49 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_curspl == 0);
 	/* ...or leak any spinlocks */
 	KASSERT(curthread->t_iplhigh_count == 0);
+
+#if OPT_A2
+	/* Another thread may have called _exit meanwhile */
+	proc_checkexit();
+#endif
 }
 
+#if OPT_A2
+
+/* Trapframe copies passed from sys_fork to the child's first thread */
+static struct kmem_cache *forktf_cache;
+
+void
+syscall_bootstrap(void)
+{
+	forktf_cache = kmem_cache_create("trapframe",
+					 sizeof(struct trapframe), NULL);
+	if (forktf_cache == NULL) {
+		panic("syscall_bootstrap: Out of memory\n");
+	}
+	futex_bootstrap();
+}
+
+struct trapframe *
+trapframe_dup(const struct trapframe *tf)
+{
+	struct trapframe *copy;
+
+	copy = kmem_cache_alloc(forktf_cache);
+	if (copy != NULL) {
+		*copy = *tf;
+	}
+	return copy;
+}
+
+void
+trapframe_free(struct trapframe *tf)
+{
+	kmem_cache_free(forktf_cache, tf);
+}
+
+#endif /* OPT_A2 */
+
 /*
  * Enter user mode for a newly forked process.
  *
@@ -193,11 +373,12 @@ enter_forked_process(void *tf, unsigned long ul)
 #if OPT_A2
     (void)ul;
     struct trapframe tflocal = *(struct trapframe *)tf;
+    /* mips_usermode doesn't return, so let go of the copy first */
+    kmem_cache_free(forktf_cache, tf);
     tflocal.tf_a3= 0;
     tflocal.tf_v0= 0;
     tflocal.tf_epc += 4;
     mips_usermode(&tflocal);
-    kfree(tf);
 #else
     (void)tf;
 #endif
@@ -32,11 +32,15 @@
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <cpu.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <mmap.h>
 #include "opt-A3.h"
 
 /*
@@ -47,6 +51,28 @@
 /* under dumbvm, always have 48k of user stack */
 #define DUMBVM_STACKPAGES    12
 
+#if OPT_A3
+/*
+ * ...or rather, the stack grows a page at a time as it is touched,
+ * up to this many pages. Below that is an unmapped gap down to
+ * MMAP_TOP, so a runaway recursion faults instead of running into
+ * the mappings or the heap.
+ */
+#define DUMBVM_STACKMAXPAGES 256
+
+/*
+ * Below the main stack are slots for the stacks of threads made by
+ * thread_create, each DUMBVM_TSTACKPAGES long. They grow on demand
+ * like the main stack; the lowest page of each slot is never mapped,
+ * so running off the bottom faults.
+ */
+#define DUMBVM_TSTACKPAGES   64
+#define DUMBVM_MAXTSTACKS    32	/* bits in as_tstacks */
+#define DUMBVM_TSTACKTOP(slot) \
+	(USERSTACK - (DUMBVM_STACKMAXPAGES + (slot) * DUMBVM_TSTACKPAGES) \
+	 * PAGE_SIZE)
+#endif
+
 /*
  * Wrap rma_stealmem in a spinlock.
  */
@@ -63,6 +89,21 @@ paddr_t zeroframe;
 /* global boolean indicating if coremap is made */
 bool have_map = false;
 
+/*
+ * Frames known to be all zeros. For a free frame the flag is
+ * protected by stealmem_lock; once a frame is allocated it belongs to
+ * whoever allocated it, and getppages clears it without the lock.
+ * Idle CPUs zero free frames (see vm_idle) until there are
+ * zerotarget of them, so zero-filled allocations can usually skip
+ * the bzero.
+ */
+static bool *cm_zeroed;
+static int nzeroed;		/* free frames with cm_zeroed set */
+static int zerotarget;
+
+/* Most frames to keep zeroed; at most an eighth of memory is used */
+#define ZEROPOOL_MAX 64
+
 #endif //OPT_A3
 void
 vm_bootstrap(void)
@@ -77,6 +118,8 @@ vm_bootstrap(void)
 	int num_frames = (hi - lo) / PAGE_SIZE;
 	coremap = (int *)PADDR_TO_KVADDR(lo);
 	lo += num_frames*sizeof(int);
+	cm_zeroed = (bool *)PADDR_TO_KVADDR(lo);
+	lo += num_frames*sizeof(bool);
 	lo = ROUNDUP(lo, PAGE_SIZE);
 	num_frames = (hi - lo) / PAGE_SIZE;
 	nframes = num_frames;
@@ -84,7 +127,11 @@ vm_bootstrap(void)
 	// initialize the coremap with all frames available
 	for (int i = 0; i < num_frames; i++) {
 		coremap[i] = 0;
+		cm_zeroed[i] = false;
 	}
+	nzeroed = 0;
+	zerotarget = num_frames / 8 < ZEROPOOL_MAX ?
+		num_frames / 8 : ZEROPOOL_MAX;
 	have_map = true;
 
 #else
@@ -92,9 +139,64 @@ vm_bootstrap(void)
 #endif //OPT_A3
 }
 
+#if OPT_A3
+
+/*
+ * Find a free frame, preferring one that is (if ZERO) or isn't (if
+ * not) already zeroed, so that dirty allocations like kmalloc's don't
+ * use up the zeroed ones. Returns -1 if memory is full.
+ */
+static
+int
+coremap_findframe(bool zero)
+{
+	int fno, any = -1;
+
+	for (fno = 0; fno < nframes; fno++) {
+		if (coremap[fno] != 0) {
+			continue;
+		}
+		if (cm_zeroed[fno] == zero || (zero && nzeroed == 0)) {
+			return fno;
+		}
+		if (any < 0) {
+			any = fno;
+		}
+	}
+	return any;
+}
+
+/*
+ * Find the first run of NP free frames. Returns -1 if there is none.
+ */
+static
+int
+coremap_findrun(int np)
+{
+	int fno;
+	int chunk = 0;
+
+	for (fno = 0; fno < nframes; fno++) {
+		if (coremap[fno] != 0) {
+			chunk = 0;
+			continue;
+		}
+		chunk++;
+		if (chunk == np) {
+			return fno - np + 1;
+		}
+	}
+	return -1;
+}
+
+#endif // OPT_A3
+
+/*
+ * Get NPAGES contiguous frames, zero-filled if ZERO.
+ */
 static
 paddr_t
-getppages(unsigned long npages)
+getppages(unsigned long npages, bool zero)
 {
 #if OPT_A3
 	if (!have_map) {
@@ -106,41 +208,42 @@ getppages(unsigned long npages)
 		addr = ram_stealmem(npages);
 		
 		spinlock_release(&stealmem_lock);
+		if (addr != 0 && zero) {
+			bzero((void *)PADDR_TO_KVADDR(addr), npages * PAGE_SIZE);
+		}
 		return addr;
 
 	} else {
-		spinlock_acquire(&stealmem_lock);
 		int np = (int)npages;
-		int fno = 0;
-		int chunk = 0;
-		bool found = false;
-		for (; fno < nframes; fno++) {
-			/* return 0 when out of memory */
-			if (np - chunk > nframes - fno) {
-				return 0;
-			}
-			if (coremap[fno] != 0) {
-				chunk = 0;
-			} else if (coremap[fno] == 0) {
-				chunk ++;
-			}
-			if (chunk == np) {
-				found = true;
-				break;
-			}
-		}
-		if (!found) {
+		int fno, i;
+
+		spinlock_acquire(&stealmem_lock);
+		/* return 0 when out of memory */
+		fno = (np == 1) ? coremap_findframe(zero) : coremap_findrun(np);
+		if (fno < 0) {
+			spinlock_release(&stealmem_lock);
 			return 0;
-		} 
-		fno -= chunk; 
-		fno++; // fno now is a valid starting point for the requested memory
+		}
 		coremap[fno] = 1;
-		for (int i = 1; i < np; i++) {
+		for (i = 1; i < np; i++) {
 			coremap[fno+i] = coremap[fno+i-1]+1;
 		}
-		paddr_t pa = zeroframe + fno*PAGE_SIZE;
+		for (i = 0; i < np; i++) {
+			if (cm_zeroed[fno+i]) {
+				nzeroed--;
+			}
+		}
 		spinlock_release(&stealmem_lock);
-		return pa;
+
+		/* The frames are ours now; no lock needed for cm_zeroed */
+		for (i = 0; i < np; i++) {
+			if (zero && !cm_zeroed[fno+i]) {
+				bzero((void *)PADDR_TO_KVADDR(zeroframe +
+					(fno+i)*PAGE_SIZE), PAGE_SIZE);
+			}
+			cm_zeroed[fno+i] = false;
+		}
+		return zeroframe + fno*PAGE_SIZE;
 
 	}
 #else
@@ -151,6 +254,9 @@ getppages(unsigned long npages)
 	addr = ram_stealmem(npages);
 		
 	spinlock_release(&stealmem_lock);
+	if (addr != 0 && zero) {
+		bzero((void *)PADDR_TO_KVADDR(addr), npages * PAGE_SIZE);
+	}
 	return addr;
 #endif // OPT_A3
 }
@@ -160,7 +266,18 @@ vaddr_t
 alloc_kpages(int npages)
 {
 	paddr_t pa;
-	pa = getppages(npages);
+	pa = getppages(npages, false);
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+vaddr_t
+alloc_zeroed_kpages(int npages)
+{
+	paddr_t pa;
+	pa = getppages(npages, true);
 	if (pa==0) {
 		return 0;
 	}
@@ -179,6 +296,7 @@ free_kpages(vaddr_t addr)
 	int frame_no = (pa - zeroframe)/PAGE_SIZE;
 	if (coremap[frame_no] != 1) { /* addr has to be the start of a chunk */
 		kprintf("INVALID FREE ADDR");
+		spinlock_release(&stealmem_lock);
 		return;
 	}
 	int tracker = coremap[frame_no];
@@ -200,35 +318,434 @@ free_kpages(vaddr_t addr)
 #endif // OPT_A3
 }
 
+/*
+ * Zero one free frame for the zeroed pool, if it is short. Called
+ * from the idle loop with interrupts off, so it does one frame per
+ * call and the caller checks for runnable threads in between.
+ */
+bool
+vm_idle(void)
+{
+#if OPT_A3
+	int fno;
+
+	if (!have_map) {
+		return false;
+	}
+
+	spinlock_acquire(&stealmem_lock);
+	if (nzeroed >= zerotarget) {
+		spinlock_release(&stealmem_lock);
+		return false;
+	}
+	/* From the top, away from where first-fit runs get carved out */
+	for (fno = nframes - 1; fno >= 0; fno--) {
+		if (coremap[fno] == 0 && !cm_zeroed[fno]) {
+			break;
+		}
+	}
+	if (fno < 0) {
+		spinlock_release(&stealmem_lock);
+		return false;
+	}
+	/* Claim it so nobody allocates it while we zero it */
+	coremap[fno] = 1;
+	spinlock_release(&stealmem_lock);
+
+	bzero((void *)PADDR_TO_KVADDR(zeroframe + fno*PAGE_SIZE), PAGE_SIZE);
+
+	spinlock_acquire(&stealmem_lock);
+	coremap[fno] = 0;
+	cm_zeroed[fno] = true;
+	nzeroed++;
+	spinlock_release(&stealmem_lock);
+	return true;
+#else
+	return false;
+#endif // OPT_A3
+}
+
+#if OPT_A3
+
+////////////////////////////////////////////////////////////
+//
+// Page arrays
+//
+// The heap and the stack are each a run of pages whose frames are
+// allocated one at a time, zero-filled, when first touched. Each has
+// an array with one frame per page (0 if not touched yet) that grows
+// as the region does.
+
+/*
+ * Make sure *PAGES, an array of AS, has at least N entries. The new
+ * array is swapped in under as_iolock, since as_translate reads the
+ * arrays without as_lock.
+ */
+static
+int
+pages_grow(struct addrspace *as, paddr_t **pages, unsigned *max, unsigned n)
+{
+	paddr_t *newpages, *oldpages;
+	unsigned newmax, i;
+
+	if (n <= *max) {
+		return 0;
+	}
+	newmax = *max ? *max * 2 : 16;
+	while (newmax < n) {
+		newmax *= 2;
+	}
+	newpages = kmalloc(newmax * sizeof(paddr_t));
+	if (newpages == NULL) {
+		return ENOMEM;
+	}
+	spinlock_acquire(&as->as_iolock);
+	for (i=0; i<newmax; i++) {
+		newpages[i] = i < *max ? (*pages)[i] : 0;
+	}
+	oldpages = *pages;
+	*pages = newpages;
+	*max = newmax;
+	spinlock_release(&as->as_iolock);
+	kfree(oldpages);
+	return 0;
+}
+
+/*
+ * Hand back the frame for entry IDX, allocating a zeroed one if the
+ * page hasn't been touched.
+ */
+static
+int
+pages_fault(paddr_t *pages, unsigned idx, paddr_t *paddr)
+{
+	vaddr_t kva;
+
+	if (pages[idx] == 0) {
+		kva = alloc_zeroed_kpages(1);
+		if (kva == 0) {
+			return ENOMEM;
+		}
+		pages[idx] = KVADDR_TO_PADDR(kva);
+	}
+	*paddr = pages[idx];
+	return 0;
+}
+
+/*
+ * Free the frames of entries FIRST and up.
+ */
+static
+void
+pages_free(paddr_t *pages, unsigned max, unsigned first)
+{
+	unsigned i;
+
+	for (i=first; i<max; i++) {
+		if (pages[i] != 0) {
+			free_kpages(PADDR_TO_KVADDR(pages[i]));
+			pages[i] = 0;
+		}
+	}
+}
+
+/*
+ * Copy entries FIRST up to END of an array, with the contents of the
+ * touched pages. On failure what has been copied is left in
+ * *NEWPAGES for the caller to free.
+ */
+static
+int
+pages_copy(paddr_t *old, unsigned first, unsigned end,
+	   struct addrspace *new, paddr_t **newpages, unsigned *newmax)
+{
+	vaddr_t kva;
+	unsigned i;
+	int result;
+
+	result = pages_grow(new, newpages, newmax, end);
+	if (result) {
+		return result;
+	}
+	for (i=first; i<end; i++) {
+		if (old[i] == 0) {
+			continue;
+		}
+		kva = alloc_kpages(1);
+		if (kva == 0) {
+			return ENOMEM;
+		}
+		memmove((void *)kva, (const void *)PADDR_TO_KVADDR(old[i]),
+			PAGE_SIZE);
+		(*newpages)[i] = KVADDR_TO_PADDR(kva);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Direct I/O
+//
+// A driver doing I/O straight to a user page (see as_translate)
+// holds neither as_lock nor anything that keeps another thread of
+// the process from freeing the page meanwhile. So as_translate counts
+// each transfer in as_iopins until as_iodone (both further down),
+// and frames of a live address space are only freed once as_iodrain
+// has seen the count at zero.
+
+/*
+ * Wait until no direct I/O is in progress. Returns with as_iolock
+ * held, so no new transfer can start until the caller has taken the
+ * pages out of the arrays and lets go of it.
+ */
+static
+void
+as_iodrain(struct addrspace *as)
+{
+	spinlock_acquire(&as->as_iolock);
+	while (as->as_iopins > 0) {
+		wchan_lock(as->as_iowchan);
+		spinlock_release(&as->as_iolock);
+		wchan_sleep(as->as_iowchan);
+		spinlock_acquire(&as->as_iolock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Heap
+
+/*
+ * Moving the break only changes as_heaptop (and, now and then, the
+ * size of the page array); frames are found by vm_fault when the
+ * pages are first used.
+ */
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct vm_map *m;
+	vaddr_t newtop, limit;
+	unsigned npages;
+	int result;
+
+	KASSERT(as->as_heapbase != 0);
+
+	if (amount < 0 &&
+	    (vaddr_t)-amount > as->as_heaptop - as->as_heapbase) {
+		return EINVAL;
+	}
+
+	/* Up to the lowest mapping; the stack is above all of those */
+	limit = MMAP_TOP;
+	for (m = as->as_maps; m != NULL; m = m->vm_next) {
+		if (m->vm_base < limit) {
+			limit = m->vm_base;
+		}
+	}
+	if (amount > 0 && (vaddr_t)amount > limit - as->as_heaptop) {
+		return ENOMEM;
+	}
+
+	newtop = as->as_heaptop + amount;
+	npages = (ROUNDUP(newtop, PAGE_SIZE) - as->as_heapbase) / PAGE_SIZE;
+
+	if (amount > 0) {
+		result = pages_grow(as, &as->as_heappages, &as->as_heapmax,
+				    npages);
+		if (result) {
+			return result;
+		}
+	}
+
+	*oldbreak = as->as_heaptop;
+	if (amount < 0) {
+		as_iodrain(as);
+		as->as_heaptop = newtop;
+		pages_free(as->as_heappages, as->as_heapmax, npages);
+		spinlock_release(&as->as_iolock);
+		/* Drop TLB entries for the frames just freed */
+		vm_tlbflush();
+	}
+	else {
+		spinlock_acquire(&as->as_iolock);
+		as->as_heaptop = newtop;
+		spinlock_release(&as->as_iolock);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Thread stacks
+//
+// Thread stack pages live in as_stackpages with the main stack's,
+// indexed the same way by distance below USERSTACK.
+
+/*
+ * Find the thread stack slot in use that VADDR is in, if any.
+ */
+static
+bool
+as_tstackslot(struct addrspace *as, vaddr_t vaddr, unsigned *ret)
+{
+	unsigned slot;
+
+	if (vaddr >= DUMBVM_TSTACKTOP(0) ||
+	    vaddr < DUMBVM_TSTACKTOP(DUMBVM_MAXTSTACKS)) {
+		return false;
+	}
+	slot = (DUMBVM_TSTACKTOP(0) - 1 - vaddr) /
+		(DUMBVM_TSTACKPAGES * PAGE_SIZE);
+	if ((as->as_tstacks & (1U << slot)) == 0) {
+		return false;
+	}
+	*ret = slot;
+	return true;
+}
+
+/*
+ * Is VADDR in the usable part of a thread stack slot in use?
+ */
+static
+bool
+as_intstack(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned slot;
+
+	if (!as_tstackslot(as, vaddr, &slot)) {
+		return false;
+	}
+	/* Not the guard page */
+	return vaddr >= DUMBVM_TSTACKTOP(slot + 1) + PAGE_SIZE;
+}
+
+int
+as_stack_alloc(struct addrspace *as, vaddr_t *stacktop)
+{
+	unsigned slot;
+
+	for (slot = 0; slot < DUMBVM_MAXTSTACKS; slot++) {
+		if ((as->as_tstacks & (1U << slot)) == 0) {
+			as->as_tstacks |= 1U << slot;
+			*stacktop = DUMBVM_TSTACKTOP(slot);
+			return 0;
+		}
+	}
+	return EAGAIN;
+}
+
+int
+as_stack_copy(struct addrspace *old, struct addrspace *new, vaddr_t sp)
+{
+	unsigned slot, first, end;
+	int result;
+
+	lock_acquire(old->as_lock);
+	if (!as_tstackslot(old, sp, &slot)) {
+		/* On the main stack, which as_copy has done already */
+		lock_release(old->as_lock);
+		return 0;
+	}
+	first = (USERSTACK - DUMBVM_TSTACKTOP(slot)) / PAGE_SIZE;
+	end = first + DUMBVM_TSTACKPAGES;
+	if (end > old->as_stackmax) {
+		end = old->as_stackmax;
+	}
+	new->as_tstacks |= 1U << slot;
+	result = 0;
+	if (first < end) {
+		result = pages_copy(old->as_stackpages, first, end, new,
+				    &new->as_stackpages, &new->as_stackmax);
+	}
+	lock_release(old->as_lock);
+	return result;
+}
+
+void
+as_stack_free(struct addrspace *as, vaddr_t stacktop)
+{
+	unsigned slot, first, end;
+
+	slot = (DUMBVM_TSTACKTOP(0) - stacktop) /
+		(DUMBVM_TSTACKPAGES * PAGE_SIZE);
+	KASSERT(slot < DUMBVM_MAXTSTACKS);
+	KASSERT(stacktop == DUMBVM_TSTACKTOP(slot));
+	KASSERT(as->as_tstacks & (1U << slot));
+	as->as_tstacks &= ~(1U << slot);
+
+	first = (USERSTACK - stacktop) / PAGE_SIZE;
+	end = first + DUMBVM_TSTACKPAGES;
+	if (end > as->as_stackmax) {
+		end = as->as_stackmax;
+	}
+	if (first < end) {
+		as_iodrain(as);
+		pages_free(as->as_stackpages + first, end - first, 0);
+		spinlock_release(&as->as_iolock);
+		vm_tlbflush();
+	}
+}
+
+#endif /* OPT_A3 */
+
+/*
+ * Invalidate the whole TLB of this CPU.
+ */
+static
+void
+tlb_flush(void)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+
+	splx(spl);
+}
+
+/*
+ * dumbvm doesn't tag TLB entries with an address space, and only
+ * ever needs to drop a process's mappings wholesale, so every
+ * shootdown flushes the whole TLB.
+ */
 void
 vm_tlbshootdown_all(void)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	tlb_flush();
 }
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
 	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	tlb_flush();
+}
+
+void
+vm_tlbflush(void)
+{
+	struct tlbshootdown ts;
+
+	tlb_flush();
+	ts.ts_addrspace = NULL;
+	ts.ts_vaddr = 0;
+	ipi_tlbshootdown_broadcast(&ts);
 }
 
+static int vm_fault_as(struct addrspace *as, int faulttype,
+		       vaddr_t faultaddress);
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
-	paddr_t paddr;
-	int i;
-	uint32_t ehi, elo;
 	struct addrspace *as;
-	int spl;
-
 #if OPT_A3
-
-	// if faultaddr is in code segment of memory
-    bool isCodeSeg = false;
-
-#endif // OPT_A3
+	int result;
+#endif
 
 	faultaddress &= PAGE_FRAME;
 
@@ -239,7 +756,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		/* We always create pages read-write, so we can't get this */
 
 #if OPT_A3
-	    return EROFS;
+		/*
+		 * ...except for the text segment, which is an error,
+		 * and clean pages of shared mmaps, which aren't. Sort
+		 * it out once we know which region this is.
+		 */
+		break;
 #else
 		panic("dumbvm: got VM_FAULT_READONLY\n");
 #endif // OPT_A3 supress the panic on ROnly
@@ -269,6 +791,46 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 
+#if OPT_A3
+	/*
+	 * Other threads of the process may be faulting too. EAGAIN
+	 * means mmap_fault let go of the lock to read a page in, so
+	 * the layout may have changed; look the address up again.
+	 */
+	lock_acquire(as->as_lock);
+	do {
+		result = vm_fault_as(as, faulttype, faultaddress);
+	} while (result == EAGAIN);
+	lock_release(as->as_lock);
+	return result;
+#else
+	return vm_fault_as(as, faulttype, faultaddress);
+#endif
+}
+
+/*
+ * Find the page for FAULTADDRESS in AS and load it into the TLB.
+ */
+static
+int
+vm_fault_as(struct addrspace *as, int faulttype, vaddr_t faultaddress)
+{
+	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+	paddr_t paddr;
+	int i;
+	uint32_t ehi, elo;
+	int spl;
+
+#if OPT_A3
+
+	// if faultaddr is in code segment of memory
+    bool isCodeSeg = false;
+	// whether the page may be written; only mmap pages may not be
+	bool writable = true;
+	int result;
+
+#endif // OPT_A3
+
 	/* Assert that the address space has been set up properly. */
 	KASSERT(as->as_vbase1 != 0);
 	KASSERT(as->as_pbase1 != 0);
@@ -276,7 +838,9 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	KASSERT(as->as_vbase2 != 0);
 	KASSERT(as->as_pbase2 != 0);
 	KASSERT(as->as_npages2 != 0);
+#if !OPT_A3
 	KASSERT(as->as_stackpbase != 0);
+#endif
 	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
 	KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
 	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
@@ -287,7 +851,11 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
 	vbase2 = as->as_vbase2;
 	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
+#if OPT_A3
+	stackbase = USERSTACK - DUMBVM_STACKMAXPAGES * PAGE_SIZE;
+#else
 	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+#endif
 	stacktop = USERSTACK;
 
 	if (faultaddress >= vbase1 && faultaddress < vtop1) {
@@ -300,12 +868,60 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
 		paddr = (faultaddress - vbase2) + as->as_pbase2;
 	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
+	else if ((faultaddress >= stackbase && faultaddress < stacktop)
+#if OPT_A3
+		 || as_intstack(as, faultaddress)
+#endif
+		) {
+#if OPT_A3
+		/* Grow the stack (or a thread's stack) down to here */
+		i = (stacktop - faultaddress) / PAGE_SIZE;
+		result = pages_grow(as, &as->as_stackpages, &as->as_stackmax,
+				    i);
+		if (result) {
+			return result;
+		}
+		result = pages_fault(as->as_stackpages, i - 1, &paddr);
+		if (result) {
+			return result;
+		}
+#else
 		paddr = (faultaddress - stackbase) + as->as_stackpbase;
+#endif
+	}
+#if OPT_A3
+	else if (faultaddress >= as->as_heapbase &&
+		 faultaddress < as->as_heaptop) {
+		result = pages_fault(as->as_heappages,
+				     (faultaddress - as->as_heapbase) / PAGE_SIZE,
+				     &paddr);
+		if (result) {
+			return result;
+		}
 	}
+#endif
 	else {
+#if OPT_A3
+		result = mmap_fault(as, faulttype, faultaddress,
+				    &paddr, &writable);
+		if (result) {
+			return result;
+		}
+		goto gotpage;
+#else
 		return EFAULT;
+#endif
+	}
+
+#if OPT_A3
+	if (faulttype == VM_FAULT_READONLY) {
+		return EROFS;
+	}
+	if (isCodeSeg && as->isLoaded) {
+		writable = false;
 	}
+ gotpage:
+#endif
 
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
@@ -313,19 +929,34 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
+	ehi = faultaddress;
+	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+#if OPT_A3
+	if (!writable) {
+		elo &= ~TLBLO_DIRTY;
+	}
+
+	/*
+	 * Replace the entry already there if this is a write to a page
+	 * that was mapped read-only; two entries for the same page
+	 * would be a machine check.
+	 */
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+		tlb_write(ehi, elo, i);
+		splx(spl);
+		return 0;
+	}
+#endif
+
 	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
-		}
-		ehi = faultaddress;
+		uint32_t oehi, oelo;
 
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-#if OPT_A3
-		if (isCodeSeg && as->isLoaded) {
-			elo &= ~TLBLO_DIRTY;
+		tlb_read(&oehi, &oelo, i);
+		if (oelo & TLBLO_VALID) {
+			continue;
 		}
-#endif // turn off TLBLO_DIRTY bits for ROnly segments
 
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
 		tlb_write(ehi, elo, i);
@@ -339,11 +970,6 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	return EFAULT; //fail */
 
 	// evict a random victim from the already full TLB
-	ehi = faultaddress;
-	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-	if (isCodeSeg && as->isLoaded) {
-			elo &= ~TLBLO_DIRTY;
-	}
 	tlb_random(ehi, elo);
 	splx(spl);
 	return 0;
@@ -369,6 +995,28 @@ as_create(void)
 
 #if OPT_A3
 	as->isLoaded = false;
+	as->as_maps = NULL;
+	as->as_heapbase = 0;
+	as->as_heaptop = 0;
+	as->as_heappages = NULL;
+	as->as_heapmax = 0;
+	as->as_stackpages = NULL;
+	as->as_stackmax = 0;
+	as->as_tstacks = 0;
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	spinlock_init(&as->as_iolock);
+	as->as_iopins = 0;
+	as->as_iowchan = wchan_create("addrspace io");
+	if (as->as_iowchan == NULL) {
+		spinlock_cleanup(&as->as_iolock);
+		lock_destroy(as->as_lock);
+		kfree(as);
+		return NULL;
+	}
 #endif
 
 	return as;
@@ -379,9 +1027,22 @@ as_destroy(struct addrspace *as)
 {
 #if OPT_A3
 
-    free_kpages(PADDR_TO_KVADDR(as->as_pbase1));
-    free_kpages(PADDR_TO_KVADDR(as->as_pbase2));
-    free_kpages(PADDR_TO_KVADDR(as->as_stackpbase));
+    mmap_destroy(as);
+    pages_free(as->as_heappages, as->as_heapmax, 0);
+    kfree(as->as_heappages);
+    pages_free(as->as_stackpages, as->as_stackmax, 0);
+    kfree(as->as_stackpages);
+    lock_destroy(as->as_lock);
+    KASSERT(as->as_iopins == 0);
+    wchan_destroy(as->as_iowchan);
+    spinlock_cleanup(&as->as_iolock);
+    /* as_prepare_load may not have got as far as allocating these */
+    if (as->as_pbase1 != 0) {
+        free_kpages(PADDR_TO_KVADDR(as->as_pbase1));
+    }
+    if (as->as_pbase2 != 0) {
+        free_kpages(PADDR_TO_KVADDR(as->as_pbase2));
+    }
 
 #endif
 	kfree(as);
@@ -390,7 +1051,6 @@ as_destroy(struct addrspace *as)
 void
 as_activate(void)
 {
-	int i, spl;
 	struct addrspace *as;
 
 	as = curproc_getas();
@@ -401,14 +1061,7 @@ as_activate(void)
 		return;
 	}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
-
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-	}
-
-	splx(spl);
+	tlb_flush();
 }
 
 void
@@ -456,13 +1109,6 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	return EUNIMP;
 }
 
-static
-void
-as_zero_region(paddr_t paddr, unsigned npages)
-{
-	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
-}
-
 int
 as_prepare_load(struct addrspace *as)
 {
@@ -470,24 +1116,23 @@ as_prepare_load(struct addrspace *as)
 	KASSERT(as->as_pbase2 == 0);
 	KASSERT(as->as_stackpbase == 0);
 
-	as->as_pbase1 = getppages(as->as_npages1);
+	as->as_pbase1 = getppages(as->as_npages1, true);
 	if (as->as_pbase1 == 0) {
 		return ENOMEM;
 	}
 
-	as->as_pbase2 = getppages(as->as_npages2);
+	as->as_pbase2 = getppages(as->as_npages2, true);
 	if (as->as_pbase2 == 0) {
 		return ENOMEM;
 	}
 
-	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
+#if !OPT_A3
+	/* (With OPT_A3 the stack gets its pages as it grows.) */
+	as->as_stackpbase = getppages(DUMBVM_STACKPAGES, true);
 	if (as->as_stackpbase == 0) {
 		return ENOMEM;
 	}
-	
-	as_zero_region(as->as_pbase1, as->as_npages1);
-	as_zero_region(as->as_pbase2, as->as_npages2);
-	as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
+#endif
 
 	return 0;
 }
@@ -495,23 +1140,149 @@ as_prepare_load(struct addrspace *as)
 int
 as_complete_load(struct addrspace *as)
 {
+#if OPT_A3
+	/* The heap starts out empty, right after the data segment. */
+	as->as_heapbase = as->as_vbase2 + as->as_npages2 * PAGE_SIZE;
+	as->as_heaptop = as->as_heapbase;
+#else
 	(void)as;
+#endif
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
+#if OPT_A3
+	(void)as;
+#else
 	KASSERT(as->as_stackpbase != 0);
+#endif
 
 	*stackptr = USERSTACK;
 	return 0;
 }
 
+/*
+ * Each dumbvm region is one physically contiguous run of pages, so
+ * the contiguous span is simply the rest of the region.
+ */
+static
+int
+as_lookup(struct addrspace *as, vaddr_t vaddr, bool writing,
+	  vaddr_t *kvaddr, size_t *contig)
+{
+	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+	paddr_t paddr;
+
+	vbase1 = as->as_vbase1;
+	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
+	vbase2 = as->as_vbase2;
+	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
+#if OPT_A3
+	stackbase = USERSTACK - as->as_stackmax * PAGE_SIZE;
+#else
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+#endif
+	stacktop = USERSTACK;
+
+	if (vaddr >= vbase1 && vaddr < vtop1) {
+#if OPT_A3
+		if (writing && as->isLoaded) {
+			/* text is read-only once loaded */
+			return EFAULT;
+		}
+#else
+		(void)writing;	/* everything is writable */
+#endif
+		paddr = (vaddr - vbase1) + as->as_pbase1;
+		*contig = vtop1 - vaddr;
+	}
+	else if (vaddr >= vbase2 && vaddr < vtop2) {
+		paddr = (vaddr - vbase2) + as->as_pbase2;
+		*contig = vtop2 - vaddr;
+	}
+	else if (vaddr >= stackbase && vaddr < stacktop) {
+#if OPT_A3
+		/* Only pages already touched, as for the heap below */
+		paddr = as->as_stackpages[(stacktop - 1 - vaddr) / PAGE_SIZE];
+		if (paddr == 0) {
+			return EFAULT;
+		}
+		paddr += vaddr & ~PAGE_FRAME;
+		*contig = PAGE_SIZE - (vaddr & ~PAGE_FRAME);
+#else
+		paddr = (vaddr - stackbase) + as->as_stackpbase;
+		*contig = stacktop - vaddr;
+#endif
+	}
+#if OPT_A3
+	else if (vaddr >= as->as_heapbase && vaddr < as->as_heaptop) {
+		/* Only pages already touched; vm_fault does the rest */
+		paddr = as->as_heappages[(vaddr - as->as_heapbase) / PAGE_SIZE];
+		if (paddr == 0) {
+			return EFAULT;
+		}
+		paddr += vaddr & ~PAGE_FRAME;
+		*contig = PAGE_SIZE - (vaddr & ~PAGE_FRAME);
+	}
+#endif
+	else {
+		return EFAULT;
+	}
+
+	*kvaddr = PADDR_TO_KVADDR(paddr);
+	return 0;
+}
+
+int
+as_translate(struct addrspace *as, vaddr_t vaddr, bool writing,
+	     vaddr_t *kvaddr, size_t *contig)
+{
+	int result;
+
+#if OPT_A3
+	/* as_lock may be held by a fault waiting for our caller */
+	spinlock_acquire(&as->as_iolock);
+	result = as_lookup(as, vaddr, writing, kvaddr, contig);
+	if (result == 0) {
+		as->as_iopins++;
+	}
+	spinlock_release(&as->as_iolock);
+#else
+	result = as_lookup(as, vaddr, writing, kvaddr, contig);
+#endif
+	return result;
+}
+
+void
+as_iodone(struct addrspace *as)
+{
+#if OPT_A3
+	bool wake;
+
+	spinlock_acquire(&as->as_iolock);
+	KASSERT(as->as_iopins > 0);
+	as->as_iopins--;
+	wake = (as->as_iopins == 0);
+	spinlock_release(&as->as_iolock);
+
+	/* A drainer got on the channel before letting go of the lock */
+	if (wake) {
+		wchan_wakeall(as->as_iowchan);
+	}
+#else
+	(void)as;
+#endif
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *new;
+#if OPT_A3
+	unsigned stackend;
+#endif
 
 	new = as_create();
 	if (new==NULL) {
@@ -523,15 +1294,27 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	new->as_vbase2 = old->as_vbase2;
 	new->as_npages2 = old->as_npages2;
 
+#if OPT_A3
+	/* Everything gets copied over, so don't bother zeroing first. */
+	new->as_pbase1 = getppages(new->as_npages1, false);
+	new->as_pbase2 = getppages(new->as_npages2, false);
+	if (new->as_pbase1 == 0 || new->as_pbase2 == 0) {
+		as_destroy(new);
+		return ENOMEM;
+	}
+#else
 	/* (Mis)use as_prepare_load to allocate some physical memory. */
 	if (as_prepare_load(new)) {
 		as_destroy(new);
 		return ENOMEM;
 	}
+#endif
 
 	KASSERT(new->as_pbase1 != 0);
 	KASSERT(new->as_pbase2 != 0);
+#if !OPT_A3
 	KASSERT(new->as_stackpbase != 0);
+#endif
 
 	memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
 		(const void *)PADDR_TO_KVADDR(old->as_pbase1),
@@ -541,9 +1324,37 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		(const void *)PADDR_TO_KVADDR(old->as_pbase2),
 		old->as_npages2*PAGE_SIZE);
 
+#if !OPT_A3
 	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
+#endif
+
+#if OPT_A3
+	/*
+	 * Other threads of the old process keep running. Their stacks
+	 * stay behind: the child has only one thread, which gets its
+	 * stack from as_stack_copy if it isn't on the main stack.
+	 */
+	lock_acquire(old->as_lock);
+	new->as_heapbase = old->as_heapbase;
+	new->as_heaptop = old->as_heaptop;
+	new->as_tstacks = 0;
+	stackend = old->as_stackmax;
+	if (stackend > DUMBVM_STACKMAXPAGES) {
+		stackend = DUMBVM_STACKMAXPAGES;
+	}
+	if (pages_copy(old->as_heappages, 0, old->as_heapmax, new,
+		       &new->as_heappages, &new->as_heapmax) ||
+	    pages_copy(old->as_stackpages, 0, stackend, new,
+		       &new->as_stackpages, &new->as_stackmax) ||
+	    mmap_copy(old, new)) {
+		lock_release(old->as_lock);
+		as_destroy(new);
+		return ENOMEM;
+	}
+	lock_release(old->as_lock);
+#endif
 	
 	*ret = new;
 	return 0;
@@ -46,8 +46,16 @@
  * and (2) if the system crashes before we find a console, no output
  * at all may appear.
  *
+ * Output is buffered: when interrupts can be used, characters are
+ * put in a buffer and the caller goes on its way; the device's
+ * write-done interrupt sends the next one. Writers only wait when
+ * the buffer is full.
+ *
  * Note that we have no input buffering; characters typed too rapidly
  * will be lost.
+ *
+ * A reader whose process starts exiting while it waits for input
+ * gives up with EINTR; con_wakeall gets it moving.
  */
 
 #include <types.h>
@@ -57,6 +65,8 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
+#include <proc.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -111,6 +121,31 @@ flush_delay_buf(void)
 
 //////////////////////////////////////////////////
 
+/*
+ * Send whatever is in the output buffer by polling, so that polled
+ * output (which may be the last thing printed before a halt or a
+ * panic) doesn't overtake it. If we got here from inside the
+ * buffering code, the buffer is left alone.
+ */
+static
+void
+drain_polled(struct con_softc *cs)
+{
+	unsigned char ch;
+
+	if (spinlock_do_i_hold(&cs->cs_txlock)) {
+		return;
+	}
+
+	spinlock_acquire(&cs->cs_txlock);
+	while (cs->cs_txtail != cs->cs_txhead) {
+		ch = cs->cs_txbuf[cs->cs_txtail % CONSOLE_OUTPUT_BUFFER_SIZE];
+		cs->cs_txtail++;
+		cs->cs_sendpolled(cs->cs_devdata, ch);
+	}
+	spinlock_release(&cs->cs_txlock);
+}
+
 /*
  * Print a character, using polling instead of interrupts to wait for
  * I/O completion.
@@ -119,6 +154,7 @@ static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	drain_polled(cs);
 	cs->cs_sendpolled(cs->cs_devdata, ch);
 }
 
@@ -142,6 +178,71 @@ putch_complete_polled(struct con_softc *cs)
 
 //////////////////////////////////////////////////
 
+/*
+ * If the device is idle, start it on the next buffered character.
+ * A device without a write-done interrupt is done as soon as cs_send
+ * returns, so it is given everything there is.
+ */
+static
+void
+tx_start(struct con_softc *cs)
+{
+	unsigned char ch;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_txlock));
+
+	while (!cs->cs_txbusy && cs->cs_txtail != cs->cs_txhead) {
+		ch = cs->cs_txbuf[cs->cs_txtail % CONSOLE_OUTPUT_BUFFER_SIZE];
+		cs->cs_txtail++;
+		cs->cs_txbusy = !cs->cs_sendsync;
+		cs->cs_send(cs->cs_devdata, ch);
+	}
+}
+
+/*
+ * Put LEN characters in the output buffer, sleeping when it is full,
+ * and make sure the device is sending them. If CRLF is set, newlines
+ * are sent as CR-LF.
+ */
+static
+void
+putbuf_intr(struct con_softc *cs, const char *buf, size_t len, bool crlf)
+{
+	size_t i;
+	bool sentcr = false;
+
+	spinlock_acquire(&cs->cs_txlock);
+	i = 0;
+	while (i < len) {
+		if (cs->cs_txhead - cs->cs_txtail ==
+		    CONSOLE_OUTPUT_BUFFER_SIZE) {
+			tx_start(cs);
+			if (cs->cs_txhead - cs->cs_txtail <
+			    CONSOLE_OUTPUT_BUFFER_SIZE) {
+				/* A synchronous device took some */
+				continue;
+			}
+			cs->cs_txwanted = true;
+			wchan_lock(cs->cs_txwchan);
+			spinlock_release(&cs->cs_txlock);
+			wchan_sleep(cs->cs_txwchan);
+			spinlock_acquire(&cs->cs_txlock);
+			continue;
+		}
+		if (crlf && buf[i] == '\n' && !sentcr) {
+			sentcr = true;
+			cs->cs_txbuf[cs->cs_txhead++ %
+				     CONSOLE_OUTPUT_BUFFER_SIZE] = '\r';
+			continue;
+		}
+		cs->cs_txbuf[cs->cs_txhead++ % CONSOLE_OUTPUT_BUFFER_SIZE] =
+			buf[i++];
+		sentcr = false;
+	}
+	tx_start(cs);
+	spinlock_release(&cs->cs_txlock);
+}
+
 /*
  * Print a character, using interrupts to wait for I/O completion.
  */
@@ -149,34 +250,42 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	char c = ch;
+
+	putbuf_intr(cs, &c, 1, false);
 }
 
 /*
  * Read a character, using interrupts to wait for I/O completion.
+ * Fails with EINTR if the current process is exiting.
  */
 static
 int
-getch_intr(struct con_softc *cs)
+getch_intr(struct con_softc *cs, int *ret)
 {
-	unsigned char ret;
-
-	P(cs->cs_rsem);
-	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
+	spinlock_acquire(&cs->cs_rxlock);
+	while (cs->cs_gotchars_head == cs->cs_gotchars_tail) {
+		if (proc_exiting()) {
+			spinlock_release(&cs->cs_rxlock);
+			return EINTR;
+		}
+		wchan_lock(cs->cs_rxwchan);
+		spinlock_release(&cs->cs_rxlock);
+		wchan_sleep(cs->cs_rxwchan);
+		spinlock_acquire(&cs->cs_rxlock);
+	}
+	*ret = cs->cs_gotchars[cs->cs_gotchars_tail];
 	cs->cs_gotchars_tail =
 		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
-	return ret;
+	spinlock_release(&cs->cs_rxlock);
+	return 0;
 }
 
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
  * Note: if gotchars_head == gotchars_tail, the buffer is empty. Thus
- * if gotchars_head+1 == gotchars_tail, the buffer is full. A slightly
- * tidier way to implement this check (that avoids wasting a slot,
- * too) would be with a second semaphore used with a nonblocking P,
- * but we don't have that in OS/161.
+ * if gotchars_head+1 == gotchars_tail, the buffer is full.
  */
 void
 con_input(void *vcs, int ch)
@@ -184,27 +293,45 @@ con_input(void *vcs, int ch)
 	struct con_softc *cs = vcs;
 	unsigned nexthead;
 
+	spinlock_acquire(&cs->cs_rxlock);
 	nexthead = (cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE;
 	if (nexthead == cs->cs_gotchars_tail) {
 		/* overflow; drop character */
+		spinlock_release(&cs->cs_rxlock);
 		return;
 	}
 
 	cs->cs_gotchars[cs->cs_gotchars_head] = ch;
 	cs->cs_gotchars_head = nexthead;
-		
-	V(cs->cs_rsem);
+	spinlock_release(&cs->cs_rxlock);
+
+	wchan_wakeone(cs->cs_rxwchan);
 }
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Send the next buffered character, and once the buffer is down to
+ * half full, wake any writers that were waiting for room.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
+	bool wake = false;
+
+	spinlock_acquire(&cs->cs_txlock);
+	cs->cs_txbusy = false;
+	tx_start(cs);
+	if (cs->cs_txwanted && cs->cs_txhead - cs->cs_txtail <=
+	    CONSOLE_OUTPUT_BUFFER_SIZE / 2) {
+		cs->cs_txwanted = false;
+		wake = true;
+	}
+	spinlock_release(&cs->cs_txlock);
 
-	V(cs->cs_wsem);
+	if (wake) {
+		wchan_wakeall(cs->cs_txwchan);
+	}
 }
 
 //////////////////////////////////////////////////
@@ -269,10 +396,33 @@ int
 getch(void)
 {
 	struct con_softc *cs = the_console;
+	int ch, result;
+
 	KASSERT(cs != NULL);
 	KASSERT(!curthread->t_in_interrupt && curthread->t_iplhigh_count == 0);
 
-	return getch_intr(cs);
+	/* Only kernel threads get here, and they are never interrupted */
+	result = getch_intr(cs, &ch);
+	KASSERT(result == 0);
+	return ch;
+}
+
+void
+con_wakeall(void)
+{
+	struct con_softc *cs = the_console;
+
+	if (cs == NULL) {
+		return;
+	}
+	/*
+	 * A reader that saw the process wasn't exiting got on the
+	 * channel before letting go of cs_rxlock, so once we have had
+	 * the lock it is there to be woken.
+	 */
+	spinlock_acquire(&cs->cs_rxlock);
+	spinlock_release(&cs->cs_rxlock);
+	wchan_wakeall(cs->cs_rxwchan);
 }
 
 ////////////////////////////////////////////////////////////
@@ -298,15 +448,19 @@ con_close(struct device *dev)
 	return 0;
 }
 
+/* Bytes of a user write copied in at a time */
+#define CON_WRITECHUNK 256
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
-	int result;
+	int result, rch;
 	char ch;
+	char buf[CON_WRITECHUNK];
+	size_t len;
 	struct lock *lk;
-
-	(void)dev;  // unused
+	struct con_softc *cs = dev->d_data;
 
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
@@ -320,7 +474,12 @@ con_io(struct device *dev, struct uio *uio)
 
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
+			result = getch_intr(cs, &rch);
+			if (result) {
+				lock_release(lk);
+				return result;
+			}
+			ch = rch;
 			if (ch=='\r') {
 				ch = '\n';
 			}
@@ -334,15 +493,14 @@ con_io(struct device *dev, struct uio *uio)
 			}
 		}
 		else {
-			result = uiomove(&ch, 1, uio);
+			len = uio->uio_resid < sizeof(buf) ?
+				uio->uio_resid : sizeof(buf);
+			result = uiomove(buf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+			putbuf_intr(cs, buf, len, true);
 		}
 	}
 	lock_release(lk);
@@ -376,6 +534,7 @@ attach_console_to_vfs(struct con_softc *cs)
 	dev->d_close = con_close;
 	dev->d_io = con_io;
 	dev->d_ioctl = con_ioctl;
+	dev->d_submit = NULL;
 	dev->d_blocks = 0;
 	dev->d_blocksize = 1;
 	dev->d_data = cs;
@@ -398,7 +557,7 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct wchan *rxwchan, *txwchan;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -414,34 +573,41 @@ config_con(struct con_softc *cs, int unit)
 	}
 	KASSERT(the_console==NULL);
 
-	rsem = sem_create("console read", 0);
-	if (rsem == NULL) {
+	rxwchan = wchan_create("console read");
+	if (rxwchan == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
-		sem_destroy(rsem);
+	txwchan = wchan_create("console write");
+	if (txwchan == NULL) {
+		wchan_destroy(rxwchan);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
-		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(rxwchan);
+		wchan_destroy(txwchan);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
-		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(rxwchan);
+		wchan_destroy(txwchan);
 		return ENOMEM;
 	}
 
-	cs->cs_rsem = rsem; 
-	cs->cs_wsem = wsem; 
+	spinlock_init(&cs->cs_rxlock);
+	cs->cs_rxwchan = rxwchan;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
 
+	spinlock_init(&cs->cs_txlock);
+	cs->cs_txwchan = txwchan;
+	cs->cs_txwanted = false;
+	cs->cs_txbusy = false;
+	cs->cs_txhead = 0;
+	cs->cs_txtail = 0;
+
 	the_console = cs;
 	con_userlock_read = rlk;
 	con_userlock_write = wlk;
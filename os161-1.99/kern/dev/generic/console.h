@@ -34,10 +34,15 @@
  * Device data for the hardware-independent system console.
  *
  * devdata, send, and sendpolled are provided by the underlying
- * device, and are to be initialized by the attach routine.
+ * device, and are to be initialized by the attach routine. sendsync
+ * is set for devices whose send finishes before it returns and that
+ * have no write-done interrupt to call con_start.
  */
 
+#include <spinlock.h>
+
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_OUTPUT_BUFFER_SIZE 4096	/* must be a power of 2 */
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -46,13 +51,22 @@ struct con_softc {
 	void (*cs_sendpolled)(void *devdata, int ch);
 	void (*cs_startpolling)(void *devdata);
 	void (*cs_endpolling)(void *devdata);
+	bool cs_sendsync;
 
 	/* initialized by config routine */
-	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
+	struct spinlock cs_rxlock;	/* protects the input buffer */
+	struct wchan *cs_rxwchan;	/* readers waiting for input */
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+
+	struct spinlock cs_txlock;	/* protects the output buffer */
+	struct wchan *cs_txwchan;	/* writers waiting for room */
+	bool cs_txwanted;		/* someone is on cs_txwchan */
+	bool cs_txbusy;			/* device is sending a char */
+	unsigned cs_txhead;		/* chars put in (counts up) */
+	unsigned cs_txtail;		/* chars taken out (counts up) */
+	unsigned char cs_txbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
 };
 
 /*
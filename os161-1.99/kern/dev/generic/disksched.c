@@ -0,0 +1,409 @@
+/*
+ * Disk I/O scheduler. See disksched.h for the interface.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <disksched.h>
+
+/* Policy new schedulers start with */
+#define DS_DEFAULTPOLICY	"clook"
+
+/*
+ * Policy operations. dp_add inserts a request (which may carry a
+ * chain of merged requests) into the queue; dp_next removes and
+ * returns the request to dispatch. Both are called with ds_lock held.
+ */
+struct dsched_policy {
+	const char *dp_name;
+	void (*dp_add)(struct disksched *ds, struct diskreq *req);
+	struct diskreq *(*dp_next)(struct disksched *ds);
+};
+
+/* All schedulers, so they can be found by name from the menu */
+static struct spinlock disksched_listlock = SPINLOCK_INITIALIZER;
+static struct disksched *disksched_all;
+
+////////////////////////////////////////////////////////////
+//
+// FIFO
+
+static
+void
+fifo_add(struct disksched *ds, struct diskreq *req)
+{
+	struct diskreq **pp;
+
+	for (pp = &ds->ds_head; *pp != NULL; pp = &(*pp)->dr_next) {
+		/* nothing */
+	}
+	req->dr_next = NULL;
+	*pp = req;
+}
+
+static
+struct diskreq *
+fifo_next(struct disksched *ds)
+{
+	struct diskreq *req = ds->ds_head;
+
+	if (req != NULL) {
+		ds->ds_head = req->dr_next;
+	}
+	return req;
+}
+
+////////////////////////////////////////////////////////////
+//
+// C-LOOK
+//
+// The queue is kept sorted by starting sector.
+
+static
+void
+clook_add(struct disksched *ds, struct diskreq *req)
+{
+	struct diskreq **pp;
+
+	for (pp = &ds->ds_head; *pp != NULL; pp = &(*pp)->dr_next) {
+		if ((*pp)->dr_sector > req->dr_sector) {
+			break;
+		}
+	}
+	req->dr_next = *pp;
+	*pp = req;
+}
+
+static
+struct diskreq *
+clook_next(struct disksched *ds)
+{
+	struct diskreq **pp;
+	struct diskreq *req;
+
+	if (ds->ds_head == NULL) {
+		return NULL;
+	}
+
+	/* First request at or past the head; else wrap to the lowest */
+	for (pp = &ds->ds_head; *pp != NULL; pp = &(*pp)->dr_next) {
+		if ((*pp)->dr_sector >= ds->ds_headpos) {
+			break;
+		}
+	}
+	if (*pp == NULL) {
+		pp = &ds->ds_head;
+	}
+
+	req = *pp;
+	*pp = req->dr_next;
+	return req;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Policy table
+
+static const struct dsched_policy dsched_policies[] = {
+	{ "fifo",	fifo_add,	fifo_next },
+	{ "clook",	clook_add,	clook_next },
+};
+
+#define NPOLICIES (sizeof(dsched_policies)/sizeof(dsched_policies[0]))
+
+static
+const struct dsched_policy *
+disksched_findpolicy(const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<NPOLICIES; i++) {
+		if (!strcmp(dsched_policies[i].dp_name, name)) {
+			return &dsched_policies[i];
+		}
+	}
+	return NULL;
+}
+
+const char *
+disksched_policy(unsigned n)
+{
+	if (n >= NPOLICIES) {
+		return NULL;
+	}
+	return dsched_policies[n].dp_name;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Creation and lookup
+
+struct disksched *
+disksched_create(const char *name)
+{
+	struct disksched *ds;
+
+	ds = kmalloc(sizeof(*ds));
+	if (ds == NULL) {
+		return NULL;
+	}
+	ds->ds_name = kstrdup(name);
+	if (ds->ds_name == NULL) {
+		kfree(ds);
+		return NULL;
+	}
+
+	ds->ds_policy = disksched_findpolicy(DS_DEFAULTPOLICY);
+	KASSERT(ds->ds_policy != NULL);
+	spinlock_init(&ds->ds_lock);
+	ds->ds_head = NULL;
+	ds->ds_headpos = 0;
+	disksched_resetstats(ds);
+
+	spinlock_acquire(&disksched_listlock);
+	ds->ds_nextsched = disksched_all;
+	disksched_all = ds;
+	spinlock_release(&disksched_listlock);
+
+	return ds;
+}
+
+void
+disksched_destroy(struct disksched *ds)
+{
+	struct disksched **pp;
+
+	KASSERT(ds->ds_head == NULL);
+
+	spinlock_acquire(&disksched_listlock);
+	for (pp = &disksched_all; *pp != NULL; pp = &(*pp)->ds_nextsched) {
+		if (*pp == ds) {
+			*pp = ds->ds_nextsched;
+			break;
+		}
+	}
+	spinlock_release(&disksched_listlock);
+
+	spinlock_cleanup(&ds->ds_lock);
+	kfree(ds->ds_name);
+	kfree(ds);
+}
+
+struct disksched *
+disksched_lookup(const char *name)
+{
+	struct disksched *ds;
+
+	spinlock_acquire(&disksched_listlock);
+	for (ds = disksched_all; ds != NULL; ds = ds->ds_nextsched) {
+		if (!strcmp(ds->ds_name, name)) {
+			break;
+		}
+	}
+	spinlock_release(&disksched_listlock);
+	return ds;
+}
+
+/*
+ * Switch policies. Requests already queued are reinserted under the
+ * new policy, keeping any chains they have.
+ */
+int
+disksched_setpolicy(struct disksched *ds, const char *policy)
+{
+	const struct dsched_policy *dp;
+	struct diskreq *list, *req;
+
+	dp = disksched_findpolicy(policy);
+	if (dp == NULL) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&ds->ds_lock);
+	list = ds->ds_head;
+	ds->ds_head = NULL;
+	ds->ds_policy = dp;
+	while (list != NULL) {
+		req = list;
+		list = list->dr_next;
+		dp->dp_add(ds, req);
+	}
+	spinlock_release(&ds->ds_lock);
+
+	return 0;
+}
+
+const char *
+disksched_policyname(struct disksched *ds)
+{
+	return ds->ds_policy->dp_name;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Queue operations
+
+/*
+ * Try to attach REQ to a queued request for adjacent sectors in the
+ * same direction, either at the end of its chain (back merge) or in
+ * front of it (front merge). Returns true if it did.
+ */
+static
+bool
+disksched_merge(struct disksched *ds, struct diskreq *req)
+{
+	struct diskreq **pp, *q, *tail;
+
+	for (pp = &ds->ds_head; *pp != NULL; pp = &(*pp)->dr_next) {
+		q = *pp;
+		if (q->dr_write != req->dr_write ||
+		    q->dr_end - q->dr_sector + req->dr_nsect > DS_MAXMERGE) {
+			continue;
+		}
+
+		if (q->dr_end == req->dr_sector) {
+			for (tail = q; tail->dr_merged != NULL;
+			     tail = tail->dr_merged) {
+				/* nothing */
+			}
+			tail->dr_merged = req;
+			q->dr_end = req->dr_end;
+			return true;
+		}
+
+		if (req->dr_end == q->dr_sector) {
+			req->dr_merged = q;
+			req->dr_end = q->dr_end;
+			req->dr_next = q->dr_next;
+			q->dr_next = NULL;
+			*pp = req;
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+disksched_add(struct disksched *ds, struct diskreq *req)
+{
+	gettime(&req->dr_ssecs, &req->dr_snsecs);
+	req->dr_next = NULL;
+	req->dr_merged = NULL;
+	req->dr_end = req->dr_sector + req->dr_nsect;
+
+	spinlock_acquire(&ds->ds_lock);
+	if (disksched_merge(ds, req)) {
+		ds->ds_nmerged++;
+	}
+	else {
+		ds->ds_policy->dp_add(ds, req);
+	}
+	spinlock_release(&ds->ds_lock);
+}
+
+struct diskreq *
+disksched_next(struct disksched *ds)
+{
+	struct diskreq *req;
+
+	spinlock_acquire(&ds->ds_lock);
+	req = ds->ds_policy->dp_next(ds);
+	if (req != NULL) {
+		req->dr_next = NULL;
+		ds->ds_headpos = req->dr_end;
+	}
+	spinlock_release(&ds->ds_lock);
+	return req;
+}
+
+void
+disksched_done(struct disksched *ds, struct diskreq *req)
+{
+	time_t secs;
+	uint32_t nsecs;
+	uint64_t ns;
+	uint32_t us;
+
+	gettime(&secs, &nsecs);
+	getinterval(req->dr_ssecs, req->dr_snsecs, secs, nsecs,
+		    &secs, &nsecs);
+	ns = (uint64_t)secs * 1000000000 + nsecs;
+	us = ns / 1000;
+
+	spinlock_acquire(&ds->ds_lock);
+	ds->ds_nreqs++;
+	ds->ds_totalns += ns;
+	if (us > ds->ds_maxus) {
+		ds->ds_maxus = us;
+	}
+	ds->ds_samples[ds->ds_nextsample] = us;
+	ds->ds_nextsample = (ds->ds_nextsample + 1) % DS_NSAMPLES;
+	spinlock_release(&ds->ds_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Statistics
+
+void
+disksched_resetstats(struct disksched *ds)
+{
+	spinlock_acquire(&ds->ds_lock);
+	ds->ds_nreqs = 0;
+	ds->ds_nmerged = 0;
+	ds->ds_totalns = 0;
+	ds->ds_maxus = 0;
+	ds->ds_nextsample = 0;
+	spinlock_release(&ds->ds_lock);
+}
+
+/*
+ * Print request count, mean and 99th percentile latency. The
+ * percentile is taken over the last DS_NSAMPLES requests.
+ */
+void
+disksched_printstats(struct disksched *ds)
+{
+	uint32_t *sorted;
+	unsigned nreqs, nmerged, nsamples, i, j;
+	uint64_t totalns;
+	uint32_t maxus, avgus, p99us, tmp;
+
+	sorted = kmalloc(DS_NSAMPLES * sizeof(uint32_t));
+	if (sorted == NULL) {
+		kprintf("%s: out of memory\n", ds->ds_name);
+		return;
+	}
+
+	spinlock_acquire(&ds->ds_lock);
+	nreqs = ds->ds_nreqs;
+	nmerged = ds->ds_nmerged;
+	totalns = ds->ds_totalns;
+	maxus = ds->ds_maxus;
+	nsamples = nreqs < DS_NSAMPLES ? nreqs : DS_NSAMPLES;
+	memcpy(sorted, ds->ds_samples, nsamples * sizeof(uint32_t));
+	spinlock_release(&ds->ds_lock);
+
+	/* Insertion sort; there are only DS_NSAMPLES of them */
+	for (i=1; i<nsamples; i++) {
+		tmp = sorted[i];
+		for (j=i; j>0 && sorted[j-1] > tmp; j--) {
+			sorted[j] = sorted[j-1];
+		}
+		sorted[j] = tmp;
+	}
+
+	avgus = nreqs > 0 ? totalns / nreqs / 1000 : 0;
+	p99us = nsamples > 0 ? sorted[(nsamples * 99) / 100] : 0;
+	kfree(sorted);
+
+	kprintf("%s: %-5s %u requests (%u merged), "
+		"avg %u.%03u ms, p99 %u.%03u ms, max %u.%03u ms\n",
+		ds->ds_name, ds->ds_policy->dp_name, nreqs, nmerged,
+		avgus / 1000, avgus % 1000,
+		p99us / 1000, p99us % 1000,
+		maxus / 1000, maxus % 1000);
+}
@@ -0,0 +1,180 @@
+/*
+ * RAM disk pseudo-device. See ramdisk.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vm.h>
+#include <vfs.h>
+#include <generic/ramdisk.h>
+#include "autoconf.h"
+
+/* Sectors per backing page */
+#define RD_SECTPERPAGE	(PAGE_SIZE / RAMDISK_SECTSIZE)
+
+/*
+ * Function called when the device is opened.
+ */
+static
+int
+ramdisk_open(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+
+	return 0;
+}
+
+/*
+ * Function called when the device is closed. The contents stay
+ * around until shutdown.
+ */
+static
+int
+ramdisk_close(struct device *d)
+{
+	(void)d;
+
+	return 0;
+}
+
+/*
+ * I/O function (for both reads and writes). Each sector is copied
+ * directly to or from its backing page.
+ */
+static
+int
+ramdisk_io(struct device *d, struct uio *uio)
+{
+	struct ramdisk_softc *rd = d->d_data;
+
+	uint32_t sector = uio->uio_offset / RAMDISK_SECTSIZE;
+	uint32_t sectoff = uio->uio_offset % RAMDISK_SECTSIZE;
+	uint32_t len = uio->uio_resid / RAMDISK_SECTSIZE;
+	uint32_t lenoff = uio->uio_resid % RAMDISK_SECTSIZE;
+	char *page;
+	unsigned pageno, i;
+	size_t off;
+	int result;
+
+	/* Don't allow I/O that isn't sector-aligned. */
+	if (sectoff != 0 || lenoff != 0) {
+		return EINVAL;
+	}
+
+	/* Don't allow I/O past the end of the disk. */
+	if (sector+len > rd->rd_dev.d_blocks || sector+len < sector) {
+		return EINVAL;
+	}
+
+	result = 0;
+	lock_acquire(rd->rd_lock);
+	for (i=0; i<len; i++) {
+		pageno = (sector+i) / RD_SECTPERPAGE;
+		off = ((sector+i) % RD_SECTPERPAGE) * RAMDISK_SECTSIZE;
+		page = rd->rd_pages[pageno];
+
+		if (uio->uio_rw == UIO_WRITE && page == NULL) {
+			page = kmalloc(PAGE_SIZE);
+			if (page == NULL) {
+				result = ENOSPC;
+				break;
+			}
+			bzero(page, PAGE_SIZE);
+			rd->rd_pages[pageno] = page;
+		}
+
+		if (page != NULL) {
+			result = uiomove(page + off, RAMDISK_SECTSIZE, uio);
+		}
+		else {
+			/* Never written; read as zeros */
+			result = uiomovezeros(RAMDISK_SECTSIZE, uio);
+		}
+		if (result) {
+			break;
+		}
+	}
+	lock_release(rd->rd_lock);
+
+	return result;
+}
+
+/*
+ * Function for handling ioctls.
+ */
+static
+int
+ramdisk_ioctl(struct device *d, int op, userptr_t data)
+{
+	/*
+	 * We don't support any ioctls.
+	 */
+	(void)d;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+/*
+ * Create a ramdisk. Called from pseudoconfig() at boot; the backing
+ * pages are not allocated until they are written.
+ */
+struct ramdisk_softc *
+pseudoattach_ramdisk(int rdno)
+{
+	struct ramdisk_softc *rd;
+	char name[32];
+	unsigned i;
+	int result;
+
+	rd = kmalloc(sizeof(struct ramdisk_softc));
+	if (rd == NULL) {
+		return NULL;
+	}
+	rd->rd_unit = rdno;
+
+	snprintf(name, sizeof(name), "ramdisk%d", rdno);
+
+	rd->rd_lock = lock_create(name);
+	if (rd->rd_lock == NULL) {
+		kfree(rd);
+		return NULL;
+	}
+
+	rd->rd_npages = RAMDISK_SIZE / PAGE_SIZE;
+	rd->rd_pages = kmalloc(rd->rd_npages * sizeof(char *));
+	if (rd->rd_pages == NULL) {
+		lock_destroy(rd->rd_lock);
+		kfree(rd);
+		return NULL;
+	}
+	for (i=0; i<rd->rd_npages; i++) {
+		rd->rd_pages[i] = NULL;
+	}
+
+	/* Set up the VFS device structure. */
+	rd->rd_dev.d_open = ramdisk_open;
+	rd->rd_dev.d_close = ramdisk_close;
+	rd->rd_dev.d_io = ramdisk_io;
+	rd->rd_dev.d_ioctl = ramdisk_ioctl;
+	rd->rd_dev.d_submit = NULL;
+	rd->rd_dev.d_blocks = rd->rd_npages * RD_SECTPERPAGE;
+	rd->rd_dev.d_blocksize = RAMDISK_SECTSIZE;
+	rd->rd_dev.d_data = rd;
+
+	/* Add the VFS device structure to the VFS device list. */
+	result = vfs_adddev(name, &rd->rd_dev, 1);
+	if (result) {
+		kprintf("%s: vfs_adddev: %s\n", name, strerror(result));
+		kfree(rd->rd_pages);
+		lock_destroy(rd->rd_lock);
+		kfree(rd);
+		return NULL;
+	}
+
+	return rd;
+}
@@ -0,0 +1,26 @@
+#ifndef _GENERIC_RAMDISK_H_
+#define _GENERIC_RAMDISK_H_
+
+#include <device.h>
+
+/*
+ * RAM disk: a block device backed by kernel memory, for measuring
+ * filesystem code without the simulated disk's seek and rotational
+ * delays.
+ *
+ * The disk is RAMDISK_SIZE bytes in RAMDISK_SECTSIZE sectors. Memory
+ * is allocated a page at a time on first write; sectors that have
+ * never been written read as zeros. Contents are lost at shutdown.
+ */
+#define RAMDISK_SECTSIZE	512
+#define RAMDISK_SIZE		(512*1024)
+
+struct ramdisk_softc {
+	int rd_unit;			/* What number ramdisk we are */
+	struct lock *rd_lock;		/* Protects rd_pages */
+	char **rd_pages;		/* Backing pages, or NULL if unused */
+	unsigned rd_npages;		/* Size of rd_pages */
+	struct device rd_dev;		/* VFS device structure */
+};
+
+#endif /* _GENERIC_RAMDISK_H_ */
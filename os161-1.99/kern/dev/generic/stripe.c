@@ -0,0 +1,421 @@
+/*
+ * Striping (RAID-0) pseudo-device. See stripe.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <disksched.h>
+#include <generic/stripe.h>
+
+/* Sector size; all member disks must use it */
+#define STRIPE_SECTSIZE		512
+
+/* Number to give the next stripe made */
+static struct spinlock stripe_unitlock = SPINLOCK_INITIALIZER;
+static int stripe_nextunit = 0;
+
+/*
+ * A set of sub-requests issued together by one stripe_io call.
+ */
+struct stripe_batch {
+	struct stripe_softc *sb_st;
+	unsigned sb_pending;		/* Sub-requests not yet done */
+	int sb_result;			/* First error seen, or 0 */
+	struct diskreq sb_reqs[STRIPE_WINDOW];
+};
+
+/*
+ * Completion callback for sub-requests. Runs in the member disk's
+ * interrupt handler.
+ */
+static
+void
+stripe_subdone(struct diskreq *req)
+{
+	struct stripe_batch *sb = req->dr_arg;
+	struct stripe_softc *st = sb->sb_st;
+
+	spinlock_acquire(&st->st_lock);
+	if (req->dr_result != 0 && sb->sb_result == 0) {
+		sb->sb_result = req->dr_result;
+	}
+	KASSERT(sb->sb_pending > 0);
+	sb->sb_pending--;
+	if (sb->sb_pending == 0) {
+		wchan_wakeall(st->st_wchan);
+	}
+	spinlock_release(&st->st_lock);
+}
+
+/*
+ * Transfer NSECT sectors starting at SECTOR to or from DATA, one
+ * sub-request per stripe unit touched, all submitted before waiting
+ * for any. NSECT must be at most STRIPE_WINDOW.
+ */
+static
+int
+stripe_rw(struct stripe_softc *st, struct stripe_batch *sb,
+	  uint32_t sector, uint32_t nsect, char *data, bool iswrite)
+{
+	struct diskreq *req;
+	uint32_t row, unitoff, n;
+	unsigned disk, nreqs, i;
+	int result;
+
+	KASSERT(nsect <= STRIPE_WINDOW);
+
+	/* Carve the range up at stripe unit boundaries. */
+	nreqs = 0;
+	while (nsect > 0) {
+		row = sector / st->st_unitsects;
+		unitoff = sector % st->st_unitsects;
+		disk = row % st->st_ndisks;
+		n = st->st_unitsects - unitoff;
+		if (n > nsect) {
+			n = nsect;
+		}
+
+		req = &sb->sb_reqs[nreqs++];
+		req->dr_sector = (row / st->st_ndisks) * st->st_unitsects
+			+ unitoff;
+		req->dr_nsect = n;
+		req->dr_write = iswrite;
+		req->dr_data = data;
+		req->dr_done = stripe_subdone;
+		req->dr_arg = sb;
+		/* Borrow dr_pos to remember the disk until submission */
+		req->dr_pos = disk;
+
+		sector += n;
+		nsect -= n;
+		data += n * STRIPE_SECTSIZE;
+	}
+
+	sb->sb_st = st;
+	sb->sb_pending = nreqs;
+	sb->sb_result = 0;
+
+	for (i=0; i<nreqs; i++) {
+		req = &sb->sb_reqs[i];
+		disk = req->dr_pos;
+		result = st->st_disks[disk]->d_submit(st->st_disks[disk], req);
+		if (result) {
+			/* Account for this one and the ones never sent */
+			spinlock_acquire(&st->st_lock);
+			if (sb->sb_result == 0) {
+				sb->sb_result = result;
+			}
+			sb->sb_pending -= nreqs - i;
+			spinlock_release(&st->st_lock);
+			break;
+		}
+	}
+
+	/* Wait for the ones that were sent. */
+	spinlock_acquire(&st->st_lock);
+	while (sb->sb_pending > 0) {
+		wchan_lock(st->st_wchan);
+		spinlock_release(&st->st_lock);
+		wchan_sleep(st->st_wchan);
+		spinlock_acquire(&st->st_lock);
+	}
+	spinlock_release(&st->st_lock);
+
+	return sb->sb_result;
+}
+
+/*
+ * Function called when the device is opened.
+ */
+static
+int
+stripe_open(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+
+	return 0;
+}
+
+/*
+ * Function called when the device is closed.
+ */
+static
+int
+stripe_close(struct device *d)
+{
+	(void)d;
+
+	return 0;
+}
+
+/*
+ * I/O function (for both reads and writes)
+ *
+ * Works through the transfer STRIPE_WINDOW sectors at a time. A
+ * single kernel buffer is used in place; anything else goes through
+ * a bounce buffer.
+ */
+static
+int
+stripe_io(struct device *d, struct uio *uio)
+{
+	struct stripe_softc *st = d->d_data;
+
+	uint32_t sector = uio->uio_offset / STRIPE_SECTSIZE;
+	uint32_t sectoff = uio->uio_offset % STRIPE_SECTSIZE;
+	uint32_t len = uio->uio_resid / STRIPE_SECTSIZE;
+	uint32_t lenoff = uio->uio_resid % STRIPE_SECTSIZE;
+	bool iswrite = (uio->uio_rw == UIO_WRITE);
+	struct stripe_batch *sb;
+	struct iovec *iov;
+	char *direct, *buf;
+	uint32_t n;
+	int result;
+
+	/* Don't allow I/O that isn't sector-aligned. */
+	if (sectoff != 0 || lenoff != 0) {
+		return EINVAL;
+	}
+
+	/* Don't allow I/O past the end of the disk. */
+	if (sector+len > st->st_dev.d_blocks || sector+len < sector) {
+		return EINVAL;
+	}
+
+	if (len == 0) {
+		return 0;
+	}
+
+	sb = kmalloc(sizeof(*sb));
+	if (sb == NULL) {
+		return ENOMEM;
+	}
+
+	iov = uio->uio_iov;
+	direct = NULL;
+	buf = NULL;
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    iov->iov_len == uio->uio_resid) {
+		direct = iov->iov_kbase;
+	}
+	else {
+		buf = kmalloc(STRIPE_WINDOW * STRIPE_SECTSIZE);
+		if (buf == NULL) {
+			kfree(sb);
+			return ENOMEM;
+		}
+	}
+
+	result = 0;
+	while (len > 0) {
+		n = len < STRIPE_WINDOW ? len : STRIPE_WINDOW;
+
+		if (direct != NULL) {
+			result = stripe_rw(st, sb, sector, n, direct, iswrite);
+			if (result) {
+				break;
+			}
+			direct += n * STRIPE_SECTSIZE;
+			iov->iov_kbase = direct;
+			iov->iov_len -= n * STRIPE_SECTSIZE;
+			uio->uio_offset += n * STRIPE_SECTSIZE;
+			uio->uio_resid -= n * STRIPE_SECTSIZE;
+		}
+		else {
+			if (iswrite) {
+				result = uiomove(buf, n*STRIPE_SECTSIZE, uio);
+				if (result) {
+					break;
+				}
+			}
+			result = stripe_rw(st, sb, sector, n, buf, iswrite);
+			if (result) {
+				break;
+			}
+			if (!iswrite) {
+				result = uiomove(buf, n*STRIPE_SECTSIZE, uio);
+				if (result) {
+					break;
+				}
+			}
+		}
+
+		sector += n;
+		len -= n;
+	}
+
+	if (buf != NULL) {
+		kfree(buf);
+	}
+	kfree(sb);
+	return result;
+}
+
+/*
+ * Function for handling ioctls.
+ */
+static
+int
+stripe_ioctl(struct device *d, int op, userptr_t data)
+{
+	/*
+	 * We don't support any ioctls.
+	 */
+	(void)d;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+/*
+ * Open member disk NAME and check that we can use it.
+ */
+static
+int
+stripe_opendisk(const char *name, struct vnode **vnret, struct device **ret)
+{
+	char rawname[64];
+	size_t len;
+	struct vnode *vn;
+	struct device *d;
+	mode_t type;
+	int result;
+
+	snprintf(rawname, sizeof(rawname) - 4, "%s", name);
+
+	/* Allow (but do not require) colon after device name */
+	len = strlen(rawname);
+	if (len > 0 && rawname[len-1] == ':') {
+		rawname[len-1] = 0;
+	}
+	strcat(rawname, "raw:");
+
+	result = vfs_open(rawname, O_RDWR, 0, &vn);
+	if (result) {
+		return result;
+	}
+
+	/* Raw names only exist for devices, so vn_data is the device. */
+	result = VOP_GETTYPE(vn, &type);
+	if (result == 0 && type != S_IFBLK) {
+		result = ENODEV;
+	}
+	if (result) {
+		vfs_close(vn);
+		return result;
+	}
+	d = vn->vn_data;
+	if (d->d_submit == NULL || d->d_blocksize != STRIPE_SECTSIZE) {
+		vfs_close(vn);
+		return ENODEV;
+	}
+
+	*vnret = vn;
+	*ret = d;
+	return 0;
+}
+
+int
+stripe_create(uint32_t unitsects, unsigned ndisks, char **disks,
+	      char *name, size_t namelen)
+{
+	struct stripe_softc *st;
+	uint32_t perdisk;
+	unsigned i, j;
+	int result;
+
+	if (unitsects == 0 || unitsects > STRIPE_WINDOW ||
+	    ndisks < 1 || ndisks > STRIPE_MAXDISKS) {
+		return EINVAL;
+	}
+
+	st = kmalloc(sizeof(*st));
+	if (st == NULL) {
+		return ENOMEM;
+	}
+	st->st_ndisks = ndisks;
+	st->st_unitsects = unitsects;
+
+	for (i=0; i<ndisks; i++) {
+		result = stripe_opendisk(disks[i], &st->st_vn[i],
+					 &st->st_disks[i]);
+		if (result == 0) {
+			/* The same disk twice would be a mess. */
+			for (j=0; j<i; j++) {
+				if (st->st_disks[j] == st->st_disks[i]) {
+					vfs_close(st->st_vn[i]);
+					result = EINVAL;
+					break;
+				}
+			}
+		}
+		if (result) {
+			kprintf("stripe: %s: %s\n", disks[i],
+				strerror(result));
+			goto fail;
+		}
+	}
+
+	/* Use whole stripe units from the smallest disk. */
+	perdisk = st->st_disks[0]->d_blocks;
+	for (i=1; i<ndisks; i++) {
+		if (st->st_disks[i]->d_blocks < perdisk) {
+			perdisk = st->st_disks[i]->d_blocks;
+		}
+	}
+	perdisk -= perdisk % unitsects;
+	if (perdisk == 0) {
+		result = EINVAL;
+		goto fail;
+	}
+
+	spinlock_init(&st->st_lock);
+	st->st_wchan = wchan_create("stripe");
+	if (st->st_wchan == NULL) {
+		spinlock_cleanup(&st->st_lock);
+		result = ENOMEM;
+		goto fail;
+	}
+
+	/* Set up the VFS device structure. */
+	st->st_dev.d_open = stripe_open;
+	st->st_dev.d_close = stripe_close;
+	st->st_dev.d_io = stripe_io;
+	st->st_dev.d_ioctl = stripe_ioctl;
+	st->st_dev.d_submit = NULL;
+	st->st_dev.d_blocks = perdisk * ndisks;
+	st->st_dev.d_blocksize = STRIPE_SECTSIZE;
+	st->st_dev.d_data = st;
+
+	spinlock_acquire(&stripe_unitlock);
+	st->st_unit = stripe_nextunit++;
+	spinlock_release(&stripe_unitlock);
+	snprintf(name, namelen, "stripe%d", st->st_unit);
+
+	result = vfs_adddev(name, &st->st_dev, 1);
+	if (result) {
+		wchan_destroy(st->st_wchan);
+		spinlock_cleanup(&st->st_lock);
+		goto fail;
+	}
+
+	kprintf("%s: %u disks, %u-sector stripe unit, %u sectors\n",
+		name, ndisks, unitsects, st->st_dev.d_blocks);
+	return 0;
+
+ fail:
+	for (j=0; j<i; j++) {
+		vfs_close(st->st_vn[j]);
+	}
+	kfree(st);
+	return result;
+}
@@ -0,0 +1,50 @@
+#ifndef _GENERIC_STRIPE_H_
+#define _GENERIC_STRIPE_H_
+
+#include <device.h>
+#include <spinlock.h>
+
+/*
+ * Striping (RAID-0) pseudo-device.
+ *
+ * Combines several queueing block devices (ones with d_submit, i.e.
+ * lhd) into one. The address space is cut into stripe units of
+ * st_unitsects sectors which are dealt out to the member disks in
+ * turn, so a large transfer is split into sub-requests that run on
+ * all the disks at once.
+ *
+ * Stripe devices are made at runtime with the "stripe" menu command
+ * and are named stripe0, stripe1, ... They are mountable. They last
+ * until shutdown and keep their member disks open.
+ */
+
+/* Most member disks in one stripe */
+#define STRIPE_MAXDISKS		8
+
+/* Most sectors one stripe_io call has in flight at once */
+#define STRIPE_WINDOW		64
+
+struct vnode;
+
+struct stripe_softc {
+	int st_unit;			/* What number stripe we are */
+	unsigned st_ndisks;		/* Number of member disks */
+	uint32_t st_unitsects;		/* Sectors per stripe unit */
+	struct vnode *st_vn[STRIPE_MAXDISKS];	/* Open member disks */
+	struct device *st_disks[STRIPE_MAXDISKS];
+
+	struct spinlock st_lock;	/* For waiting on sub-requests */
+	struct wchan *st_wchan;
+
+	struct device st_dev;		/* VFS device structure */
+};
+
+/*
+ * Create a stripe over the NDISKS devices named in DISKS (with or
+ * without trailing colons) using a stripe unit of UNITSECTS sectors.
+ * The new device's name is returned in NAME.
+ */
+int stripe_create(uint32_t unitsects, unsigned ndisks, char **disks,
+		  char *name, size_t namelen);
+
+#endif /* _GENERIC_STRIPE_H_ */
@@ -51,6 +51,7 @@ attach_con_to_lscreen(int consno, struct lscreen_softc *ls)
 	cs->cs_sendpolled = lscreen_write;
 	cs->cs_startpolling = NULL;
 	cs->cs_endpolling = NULL;
+	cs->cs_sendsync = true;
 
 	ls->ls_devdata = cs;
 	ls->ls_start = con_start;
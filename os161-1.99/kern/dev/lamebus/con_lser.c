@@ -53,6 +53,7 @@ attach_con_to_lser(int consno, struct lser_softc *ls)
 	cs->cs_sendpolled = lser_writepolled;
 	cs->cs_startpolling = lser_startpolling;
 	cs->cs_endpolling = lser_endpolling;
+	cs->cs_sendsync = false;
 
 	ls->ls_devdata = cs;
 	ls->ls_start = con_start;
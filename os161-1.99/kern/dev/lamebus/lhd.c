@@ -35,9 +35,11 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
-#include <synch.h>
+#include <spinlock.h>
+#include <wchan.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <addrspace.h>
 #include <lamebus/lhd.h>
 #include "autoconf.h"
 
@@ -59,6 +61,9 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/* Sectors per chunk when bouncing user I/O through a kernel buffer */
+#define LHD_BOUNCESECTS 4
+
 /*
  * Shortcut for reading a register.
  */
@@ -95,28 +100,112 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the hardware on the next sector, if it isn't busy. If no
+ * request is in progress, ask the scheduler for one. Called with
+ * lh_lock held.
  */
 static
 void
+lhd_start(struct lhd_softc *lh)
+{
+	struct diskreq *req;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (lh->lh_cur == NULL) {
+		req = disksched_next(lh->lh_sched);
+		if (req == NULL) {
+			/* Nothing to do */
+			return;
+		}
+		lh->lh_cur = req;
+	}
+	req = lh->lh_cur;
+	KASSERT(req->dr_pos < req->dr_nsect);
+
+	/*
+	 * Are we writing? If so, transfer the data to the
+	 * on-card buffer.
+	 */
+	if (req->dr_write) {
+		memcpy(lh->lh_buf,
+		       (char *)req->dr_data + req->dr_pos*LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		iostats_add(LHD_SECTSIZE, LHD_SECTSIZE);
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, req->dr_sector + req->dr_pos);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Record that a sector transfer has completed. If the request is
+ * finished, take it off the device and return it so the caller can
+ * run its callback once the lock is dropped; otherwise return NULL.
+ * Then start the disk on whatever comes next: the rest of the
+ * request, the next request merged behind it, or whatever the
+ * scheduler picks. Called with lh_lock held.
+ */
+static
+struct diskreq *
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct diskreq *req = lh->lh_cur;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (req == NULL) {
+		kprintf("lhd%d: Spurious completion interrupt\n", lh->lh_unit);
+		return NULL;
+	}
+
+	/*
+	 * Are we reading? If so, and if we succeeded, transfer the
+	 * data out of the on-card buffer.
+	 */
+	if (err == 0) {
+		if (!req->dr_write) {
+			memcpy((char *)req->dr_data + req->dr_pos*LHD_SECTSIZE,
+			       lh->lh_buf, LHD_SECTSIZE);
+			iostats_add(LHD_SECTSIZE, LHD_SECTSIZE);
+		}
+		req->dr_pos++;
+	}
+
+	if (err == 0 && req->dr_pos < req->dr_nsect) {
+		/* More sectors to go in this request */
+		req = NULL;
+	}
+	else {
+		req->dr_result = err;
+		lh->lh_cur = req->dr_merged;
+		req->dr_merged = NULL;
+		disksched_done(lh->lh_sched, req);
+	}
+
+	lhd_start(lh);
+	return req;
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register, start the next sector or request, and report completion.
  */
 void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct diskreq *done = NULL;
 	uint32_t val;
-	
+
+	spinlock_acquire(&lh->lh_lock);
+
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
@@ -127,9 +216,44 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		done = lhd_iodone(lh, lhd_code_to_errno(lh, val));
 		break;
 	}
+
+	spinlock_release(&lh->lh_lock);
+
+	/* Call back without the lock so the callback may submit more */
+	if (done != NULL) {
+		done->dr_done(done);
+	}
+}
+
+/*
+ * Queue a request. If the disk is idle it is started right away;
+ * otherwise the interrupt handler starts it when the scheduler says
+ * its turn has come.
+ */
+int
+lhd_submit(struct lhd_softc *lh, struct diskreq *req)
+{
+	/* Don't allow I/O past the end of the disk. */
+	if (req->dr_nsect == 0 ||
+	    req->dr_sector + req->dr_nsect > lh->lh_dev.d_blocks ||
+	    req->dr_sector + req->dr_nsect < req->dr_sector) {
+		return EINVAL;
+	}
+
+	req->dr_result = 0;
+	req->dr_pos = 0;
+
+	spinlock_acquire(&lh->lh_lock);
+	disksched_add(lh->lh_sched, req);
+	if (lh->lh_cur == NULL) {
+		lhd_start(lh);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	return 0;
 }
 
 /*
@@ -163,6 +287,16 @@ lhd_close(struct device *d)
 	return 0;
 }
 
+/*
+ * Queueing interface for the VFS device structure.
+ */
+static
+int
+lhd_dsubmit(struct device *d, struct diskreq *req)
+{
+	return lhd_submit(d->d_data, req);
+}
+
 /*
  * Function for handling ioctls.
  */
@@ -193,8 +327,142 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * State for a synchronous request made through lhd_syncio.
+ */
+struct lhd_syncreq {
+	struct diskreq sr_req;
+	struct lhd_softc *sr_lh;
+	bool sr_finished;
+};
+
+/*
+ * Completion callback for synchronous requests: wake up the waiter.
+ */
+static
+void
+lhd_syncdone(struct diskreq *req)
+{
+	struct lhd_syncreq *sr = req->dr_arg;
+	struct lhd_softc *lh = sr->sr_lh;
+
+	spinlock_acquire(&lh->lh_lock);
+	sr->sr_finished = true;
+	wchan_wakeall(lh->lh_wchan);
+	spinlock_release(&lh->lh_lock);
+}
+
+/*
+ * Submit a request and sleep until it completes.
+ */
+int
+lhd_syncio(struct lhd_softc *lh, uint32_t sector, uint32_t nsect,
+	   void *data, bool iswrite)
+{
+	struct lhd_syncreq sr;
+	int result;
+
+	sr.sr_req.dr_sector = sector;
+	sr.sr_req.dr_nsect = nsect;
+	sr.sr_req.dr_write = iswrite;
+	sr.sr_req.dr_data = data;
+	sr.sr_req.dr_done = lhd_syncdone;
+	sr.sr_req.dr_arg = &sr;
+	sr.sr_lh = lh;
+	sr.sr_finished = false;
+
+	result = lhd_submit(lh, &sr.sr_req);
+	if (result) {
+		return result;
+	}
+
+	/* Now wait until the interrupt handler tells us we're done. */
+	spinlock_acquire(&lh->lh_lock);
+	while (!sr.sr_finished) {
+		wchan_lock(lh->lh_wchan);
+		spinlock_release(&lh->lh_lock);
+		wchan_sleep(lh->lh_wchan);
+		spinlock_acquire(&lh->lh_lock);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	return sr.sr_req.dr_result;
+}
+
+/*
+ * Transfer as much of a user-space uio as possible straight between
+ * the on-card buffer and the user's pages, as found through the
+ * address space, so the data is copied only once. Stops (leaving the
+ * rest for the bounce buffer) at anything it can't map, including a
+ * sector that straddles the end of a contiguous run. SECTORP and
+ * LENP are advanced past what was done. Each transfer holds the
+ * address space's I/O count (see as_translate), so other threads of
+ * the process can't free the pages out from under it.
+ */
+static
+int
+lhd_userio(struct lhd_softc *lh, struct uio *uio,
+	   uint32_t *sectorp, uint32_t *lenp)
+{
+	bool iswrite = (uio->uio_rw == UIO_WRITE);
+	struct iovec *iov;
+	vaddr_t kva;
+	size_t contig, bytes;
+	uint32_t n;
+	int result;
+
+	while (*lenp > 0) {
+		iov = uio->uio_iov;
+		if (iov->iov_len == 0) {
+			KASSERT(uio->uio_iovcnt > 1);
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+
+		/* Reading from the disk means writing user memory. */
+		result = as_translate(uio->uio_space,
+				      (vaddr_t)iov->iov_ubase, !iswrite,
+				      &kva, &contig);
+		if (result) {
+			break;
+		}
+		if (contig > iov->iov_len) {
+			contig = iov->iov_len;
+		}
+		n = contig / LHD_SECTSIZE;
+		if (n > *lenp) {
+			n = *lenp;
+		}
+		if (n == 0) {
+			as_iodone(uio->uio_space);
+			break;
+		}
+
+		result = lhd_syncio(lh, *sectorp, n, (void *)kva, iswrite);
+		as_iodone(uio->uio_space);
+		if (result) {
+			return result;
+		}
+
+		bytes = n * LHD_SECTSIZE;
+		iov->iov_ubase += bytes;
+		iov->iov_len -= bytes;
+		uio->uio_offset += bytes;
+		uio->uio_resid -= bytes;
+		*sectorp += n;
+		*lenp -= n;
+	}
+	return 0;
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * Kernel buffers are handed to the driver as they are, so the whole
+ * transfer is a single request. User buffers are reached directly
+ * through the address space where possible. Anything else goes
+ * through a bounce buffer a few sectors at a time.
  */
 static
 int
@@ -206,8 +474,10 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
+	bool iswrite = (uio->uio_rw == UIO_WRITE);
+	struct iovec *iov;
+	char *buf;
+	uint32_t n;
 	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
@@ -220,59 +490,64 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			if (result) {
-				V(lh->lh_clear);
-				return result;
-			}
+	iov = uio->uio_iov;
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    iov->iov_len == uio->uio_resid) {
+		/* Transfer straight into/out of the caller's buffer. */
+		result = lhd_syncio(lh, sector, len, iov->iov_kbase, iswrite);
+		if (result) {
+			return result;
 		}
+		iov->iov_kbase = (char *)iov->iov_kbase + uio->uio_resid;
+		iov->iov_len = 0;
+		uio->uio_offset += uio->uio_resid;
+		uio->uio_resid = 0;
+		return 0;
+	}
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		result = lhd_userio(lh, uio, &sector, &len);
+		if (result || len == 0) {
+			return result;
+		}
+	}
 
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
+	buf = kmalloc(LHD_BOUNCESECTS * LHD_SECTSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
 
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
+	result = 0;
+	while (len > 0) {
+		n = len < LHD_BOUNCESECTS ? len : LHD_BOUNCESECTS;
 
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		if (iswrite) {
+			result = uiomove(buf, n*LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
 		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		result = lhd_syncio(lh, sector, n, buf, iswrite);
 		if (result) {
-			return result;
+			break;
+		}
+		if (!iswrite) {
+			result = uiomove(buf, n*LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
 		}
+
+		sector += n;
+		len -= n;
 	}
 
-	return 0;
+	kfree(buf);
+	return result;
 }
 
 /*
@@ -289,15 +564,18 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_cur = NULL;
+	lh->lh_sched = disksched_create(name);
+	if (lh->lh_sched == NULL) {
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
+		disksched_destroy(lh->lh_sched);
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
 
@@ -306,6 +584,7 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	lh->lh_dev.d_close = lhd_close;
 	lh->lh_dev.d_io = lhd_io;
 	lh->lh_dev.d_ioctl = lhd_ioctl;
+	lh->lh_dev.d_submit = lhd_dsubmit;
 	lh->lh_dev.d_blocks = bus_read_register(lh->lh_busdata, lh->lh_buspos,
 						LHD_REG_NSECT);
 	lh->lh_dev.d_blocksize = LHD_SECTSIZE;
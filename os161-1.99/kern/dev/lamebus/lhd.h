@@ -31,6 +31,8 @@
 #define _LAMEBUS_LHD_H_
 
 #include <device.h>
+#include <spinlock.h>
+#include <disksched.h>
 
 /*
  * Our sector size
@@ -51,9 +53,10 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the fields below */
+	struct diskreq *lh_cur;		/* Request the disk is working on */
+	struct disksched *lh_sched;	/* Requests waiting to start */
+	struct wchan *lh_wchan;		/* Threads waiting in lhd_io */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -61,4 +64,11 @@ struct lhd_softc {
 /* Functions called by lower-level drivers */
 void lhd_irq(/*struct lhd_softc*/ void *);	/* Interrupt handler */
 
+/* Queue a request; returns EINVAL if it runs off the end of the disk */
+int lhd_submit(struct lhd_softc *lh, struct diskreq *req);
+
+/* Do a transfer to or from a kernel buffer and wait for it */
+int lhd_syncio(struct lhd_softc *lh, uint32_t sector, uint32_t nsect,
+	       void *data, bool iswrite);
+
 #endif /* _LAMEBUS_LHD_H_ */
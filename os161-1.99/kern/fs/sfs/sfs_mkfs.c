@@ -0,0 +1,163 @@
+/*
+ * In-kernel SFS formatter. Lays out the same empty filesystem as the
+ * userlevel mksfs: superblock, empty root directory, and a freemap
+ * with the metadata blocks (and any bits past the end of the
+ * device) marked in use.
+ *
+ * This lets devices that only exist while the kernel is running,
+ * like the RAM disk, be formatted and mounted without a userlevel
+ * program.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <sfs.h>
+
+/*
+ * Write one block to the raw device.
+ */
+static
+int
+sfs_mkfs_wblock(struct vnode *vn, void *data, uint32_t block)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
+	return VOP_WRITE(vn, &ku);
+}
+
+/*
+ * Is BIT set in a freshly made freemap for a volume of NBLOCKS
+ * blocks?
+ */
+static
+bool
+sfs_mkfs_inuse(uint32_t bit, uint32_t nblocks)
+{
+	if (bit == SFS_SB_LOCATION || bit == SFS_ROOT_LOCATION) {
+		return true;
+	}
+	if (bit >= SFS_MAP_LOCATION &&
+	    bit < SFS_MAP_LOCATION + SFS_BITBLOCKS(nblocks)) {
+		return true;
+	}
+	return bit >= nblocks;
+}
+
+/*
+ * Write the empty volume to DEVICE's raw device.
+ */
+static
+int
+sfs_mkfs_format(const char *device, const char *volname)
+{
+	char rawname[64];
+	struct vnode *vn;
+	struct stat st;
+	struct sfs_super *sp;
+	struct sfs_inode *sfi;
+	uint8_t *map;
+	char *buf;
+	uint32_t nblocks, i, bit;
+	int result;
+
+	if (strlen(volname) >= SFS_VOLNAME_SIZE ||
+	    strchr(volname, '/') != NULL || strchr(volname, ':') != NULL) {
+		return EINVAL;
+	}
+
+	snprintf(rawname, sizeof(rawname), "%sraw:", device);
+	result = vfs_open(rawname, O_WRONLY, 0, &vn);
+	if (result) {
+		return result;
+	}
+
+	result = VOP_STAT(vn, &st);
+	if (result) {
+		vfs_close(vn);
+		return result;
+	}
+	if (st.st_blksize != SFS_BLOCKSIZE) {
+		vfs_close(vn);
+		return EINVAL;
+	}
+	nblocks = st.st_size / SFS_BLOCKSIZE;
+	if (nblocks <= SFS_MAP_LOCATION + SFS_BITBLOCKS(nblocks)) {
+		vfs_close(vn);
+		return ENOSPC;
+	}
+
+	buf = kmalloc(SFS_BLOCKSIZE);
+	if (buf == NULL) {
+		vfs_close(vn);
+		return ENOMEM;
+	}
+
+	/* Superblock */
+	bzero(buf, SFS_BLOCKSIZE);
+	sp = (struct sfs_super *)buf;
+	sp->sp_magic = SFS_MAGIC;
+	sp->sp_nblocks = nblocks;
+	strcpy(sp->sp_volname, volname);
+	result = sfs_mkfs_wblock(vn, buf, SFS_SB_LOCATION);
+	if (result) {
+		goto done;
+	}
+
+	/* Root directory inode */
+	bzero(buf, SFS_BLOCKSIZE);
+	sfi = (struct sfs_inode *)buf;
+	sfi->sfi_size = 0;
+	sfi->sfi_type = SFS_TYPE_DIR;
+	sfi->sfi_linkcount = 1;
+	result = sfs_mkfs_wblock(vn, buf, SFS_ROOT_LOCATION);
+	if (result) {
+		goto done;
+	}
+
+	/* Freemap, one block at a time */
+	map = (uint8_t *)buf;
+	for (i=0; i<SFS_BITBLOCKS(nblocks); i++) {
+		bzero(buf, SFS_BLOCKSIZE);
+		for (bit=0; bit<SFS_BLOCKBITS; bit++) {
+			if (sfs_mkfs_inuse(i*SFS_BLOCKBITS + bit, nblocks)) {
+				map[bit/CHAR_BIT] |= 1 << (bit % CHAR_BIT);
+			}
+		}
+		result = sfs_mkfs_wblock(vn, buf, SFS_MAP_LOCATION + i);
+		if (result) {
+			goto done;
+		}
+	}
+
+ done:
+	kfree(buf);
+	vfs_close(vn);
+	return result;
+}
+
+/*
+ * Format DEVICE (without the colon) as an empty SFS volume named
+ * VOLNAME. Fails with EBUSY if the device is mounted; holding
+ * vfs_biglock throughout keeps it from being mounted meanwhile.
+ */
+int
+sfs_mkfs(const char *device, const char *volname)
+{
+	int result;
+
+	vfs_biglock_acquire();
+	result = vfs_checkunmounted(device);
+	if (result == 0) {
+		result = sfs_mkfs_format(device, volname);
+	}
+	vfs_biglock_release();
+	return result;
+}
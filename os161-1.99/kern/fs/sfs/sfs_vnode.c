@@ -44,6 +44,10 @@
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
+#include <kmemcache.h>
+
+/* In-memory vnodes for all SFS volumes; made on first use */
+static struct kmem_cache *sfs_vnode_cache;
 
 /* At bottom of file */
 static int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int type,
@@ -135,6 +139,93 @@ sfs_bused(struct sfs_fs *sfs, uint32_t diskblock)
 //
 // Block mapping/inode maintenance
 
+/*
+ * Get the in-memory copy of the indirect block BLOCK, which sits at
+ * depth DEPTH (0 for the block the inode points at) on the path
+ * down to a data block. If ISNEW is set the block was just allocated
+ * and is known to be all zeros, so there is no need to read it.
+ *
+ * The buffers are allocated the first time the file grows past its
+ * direct blocks and live until the vnode is reclaimed.
+ */
+static
+int
+sfs_getibuf(struct sfs_vnode *sv, unsigned depth, uint32_t block,
+	    bool isnew, struct sfs_ibuf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_ibuf *ib;
+	unsigned i;
+	int result;
+
+	KASSERT(depth < SFS_NINDIRECT);
+	KASSERT(block != 0);
+	KASSERT(sizeof(ib->ib_data)==SFS_BLOCKSIZE);
+
+	if (sv->sv_ibufs == NULL) {
+		sv->sv_ibufs = kmalloc(SFS_NINDIRECT*sizeof(struct sfs_ibuf));
+		if (sv->sv_ibufs == NULL) {
+			return ENOMEM;
+		}
+		for (i=0; i<SFS_NINDIRECT; i++) {
+			sv->sv_ibufs[i].ib_block = 0;
+		}
+	}
+
+	ib = &sv->sv_ibufs[depth];
+	if (ib->ib_block != block) {
+		/* Invalidate first in case the read fails */
+		ib->ib_block = 0;
+		if (isnew) {
+			bzero(ib->ib_data, sizeof(ib->ib_data));
+		}
+		else {
+			result = sfs_rblock(sfs, ib->ib_data, block);
+			if (result) {
+				return result;
+			}
+		}
+		ib->ib_block = block;
+	}
+
+	*ret = ib;
+	return 0;
+}
+
+/*
+ * Drop all cached indirect blocks of a vnode. Called when blocks
+ * are freed out from under the cache.
+ */
+static
+void
+sfs_flushibufs(struct sfs_vnode *sv)
+{
+	unsigned i;
+
+	if (sv->sv_ibufs != NULL) {
+		for (i=0; i<SFS_NINDIRECT; i++) {
+			sv->sv_ibufs[i].ib_block = 0;
+		}
+	}
+}
+
+/*
+ * Return a pointer to the inode slot holding the top block of the
+ * indirection tree with LEVELS levels (1 = single indirect).
+ */
+static
+uint32_t *
+sfs_itop(struct sfs_vnode *sv, unsigned levels)
+{
+	switch (levels) {
+	    case 1: return &sv->sv_i.sfi_indirect;
+	    case 2: return &sv->sv_i.sfi_dindirect;
+	    case 3: return &sv->sv_i.sfi_tindirect;
+	}
+	panic("sfs: itop: invalid indirection level %u\n", levels);
+	return NULL;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
@@ -146,23 +237,15 @@ int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	 uint32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-	uint32_t block;
-	uint32_t idblock;
-	uint32_t idnum, idoff;
+	struct sfs_ibuf *ib;
+	uint32_t block = 0, idblock;
+	uint32_t *topp;
+	uint32_t span, idoff;
+	unsigned levels, depth;
+	bool isnew;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
 	/*
 	 * If the block we want is one of the direct blocks...
 	 */
@@ -198,92 +281,98 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * It's not a direct block; it must be under one of the
+	 * indirect blocks. Subtract off the number of direct blocks,
+	 * then the size of each indirection tree in turn, until
+	 * FILEBLOCK is an offset within the tree that holds it. SPAN
+	 * is the number of file blocks the tree covers.
 	 */
-
 	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
-
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum > 0) {
-		return EFBIG;
+	levels = 1;
+	span = SFS_DBPERIDB;
+	while (fileblock >= span) {
+		fileblock -= span;
+		levels++;
+		if (levels > SFS_NINDIRECT) {
+			/* Past the largest file the inode can describe */
+			return EFBIG;
+		}
+		span *= SFS_DBPERIDB;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top indirect block. */
+	topp = sfs_itop(sv, levels);
+	idblock = *topp;
+	isnew = false;
 
 	if (idblock==0 && !doalloc) {
 		/*
 		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
+		 * asked to allocate anything, so pretend the whole
+		 * tree was filled with zeros.
 		 */
 		*diskblock = 0;
 		return 0;
 	}
 	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
 		result = sfs_balloc(sfs, &idblock);
 		if (result) {
 			return result;
 		}
 
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
-
-		/* Mark the inode dirty */
+		/* Remember the block we just allocated; mark inode dirty */
+		*topp = idblock;
 		sv->sv_dirty = true;
-
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+		isnew = true;
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
+
+	/*
+	 * Walk down the tree, one indirect block per level. At each
+	 * step SPAN shrinks to the number of file blocks covered by
+	 * one entry of the current indirect block.
+	 */
+	for (depth=0; depth<levels; depth++) {
+		span /= SFS_DBPERIDB;
+		idoff = fileblock / span;
+		fileblock %= span;
+
+		result = sfs_getibuf(sv, depth, idblock, isnew, &ib);
 		if (result) {
 			return result;
 		}
-	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+		block = ib->ib_data[idoff];
+		isnew = false;
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
-		if (result) {
-			return result;
+		if (block==0 && !doalloc) {
+			/* Hole in the file */
+			*diskblock = 0;
+			return 0;
 		}
+		else if (block==0) {
+			result = sfs_balloc(sfs, &block);
+			if (result) {
+				return result;
+			}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+			/* Remember the block we allocated */
+			ib->ib_data[idoff] = block;
+			isnew = true;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
+			/* The indirect block is now dirty; write it back */
+			result = sfs_wblock(sfs, ib->ib_data, idblock);
+			if (result) {
+				return result;
+			}
 		}
+
+		idblock = block;
 	}
 
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
-		panic("sfs: Data block %u (block %u of file %u) marked free\n",
-		      block, fileblock, sv->sv_ino);
+		panic("sfs: Data block %u (file %u) marked free\n",
+		      block, sv->sv_ino);
 	}
 	*diskblock = block;
 	return 0;
@@ -953,7 +1042,10 @@ sfs_reclaim(struct vnode *v)
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	if (sv->sv_ibufs != NULL) {
+		kfree(sv->sv_ibufs);
+	}
+	kmem_cache_free(sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
@@ -1110,14 +1202,114 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). The VM system pages the file in and out with
+ * VOP_READ and VOP_WRITE, so there is nothing to set up here.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return EUNIMP;
+	return 0;
+}
+
+/*
+ * Free everything at or past file block BLOCKLEN in the indirection
+ * subtree rooted at *IDBLOCKP. LEVELS is the height of the subtree
+ * (1 means its entries are data blocks) and BASEBLOCK is the file
+ * block mapped by its first entry. Entries that are zero are skipped
+ * without reading anything, so only allocated parts of the tree are
+ * visited. If the subtree ends up empty, its root is freed and
+ * *IDBLOCKP is cleared.
+ *
+ * The vnode's indirect block buffers are used to hold the blocks, one
+ * per level; the caller must flush them afterwards since some of the
+ * blocks they name may have been freed.
+ */
+static
+int
+sfs_itruncate(struct sfs_vnode *sv, uint32_t *idblockp, unsigned levels,
+	      uint32_t baseblock, uint32_t blocklen)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_ibuf *ib;
+	uint32_t idblock = *idblockp;
+	uint32_t span, entrybase;
+	uint32_t j;
+	bool hasnonzero, iddirty;
+	int result;
+
+	if (idblock == 0) {
+		return 0;
+	}
+
+	/* Number of file blocks covered by one entry */
+	span = 1;
+	for (j=1; j<levels; j++) {
+		span *= SFS_DBPERIDB;
+	}
+
+	if (baseblock + span*SFS_DBPERIDB <= blocklen) {
+		/* The whole subtree is before the new EOF */
+		return 0;
+	}
+
+	/* Read the indirect block */
+	result = sfs_getibuf(sv, levels-1, idblock, false, &ib);
+	if (result) {
+		return result;
+	}
+
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		if (ib->ib_data[j] == 0) {
+			continue;
+		}
+		entrybase = baseblock + j*span;
+
+		if (levels == 1) {
+			/* Discard any blocks that are past the new EOF */
+			if (entrybase >= blocklen) {
+				sfs_bfree(sfs, ib->ib_data[j]);
+				ib->ib_data[j] = 0;
+				iddirty = true;
+			}
+		}
+		else if (entrybase + span > blocklen) {
+			/* Part of this subtree is past EOF; descend */
+			uint32_t old = ib->ib_data[j];
+
+			result = sfs_itruncate(sv, &ib->ib_data[j], levels-1,
+					       entrybase, blocklen);
+			if (result) {
+				return result;
+			}
+			if (ib->ib_data[j] != old) {
+				iddirty = true;
+			}
+		}
+
+		/* Remember if we see any nonzero blocks in here */
+		if (ib->ib_data[j] != 0) {
+			hasnonzero = true;
+		}
+	}
+
+	if (!hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		sfs_bfree(sfs, idblock);
+		*idblockp = 0;
+	}
+	else if (iddirty) {
+		/* The indirect block is dirty; write it back */
+		result = sfs_wblock(sfs, ib->ib_data, idblock);
+		if (result) {
+			return result;
+		}
+	}
+
+	return 0;
 }
 
 /*
@@ -1127,27 +1319,17 @@ static
 int
 sfs_truncate(struct vnode *v, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j, block;
-	uint32_t idblock, baseblock, highblock;
+	uint32_t i, block;
+	uint32_t baseblock, span;
+	uint32_t *topp, oldtop;
+	unsigned levels;
 	int result;
-	int hasnonzero, iddirty;
-
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
 
 	vfs_biglock_acquire();
 
@@ -1164,54 +1346,29 @@ sfs_truncate(struct vnode *v, off_t len)
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
+	/*
+	 * Now each indirection tree in turn. BASEBLOCK is the first
+	 * file block mapped by the tree and SPAN the number of blocks
+	 * it covers.
+	 */
 	baseblock = SFS_NDIRECT;
+	span = SFS_DBPERIDB;
+	for (levels=1; levels<=SFS_NINDIRECT; levels++) {
+		topp = sfs_itop(sv, levels);
+		oldtop = *topp;
 
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
+		result = sfs_itruncate(sv, topp, levels, baseblock, blocklen);
+		sfs_flushibufs(sv);
 		if (result) {
 			vfs_biglock_release();
 			return result;
 		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
+		if (*topp != oldtop) {
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
+
+		baseblock += span;
+		span *= SFS_DBPERIDB;
 	}
 
 	/* Set the file size */
@@ -1685,7 +1842,16 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	if (sfs_vnode_cache == NULL) {
+		/* We hold the biglock, so nobody else is doing this */
+		sfs_vnode_cache = kmem_cache_create("sfs_vnode",
+						    sizeof(struct sfs_vnode),
+						    NULL);
+		if (sfs_vnode_cache == NULL) {
+			return ENOMEM;
+		}
+	}
+	sv = kmem_cache_alloc(sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -1699,13 +1865,16 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_rblock(sfs, &sv->sv_i, ino);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* No indirect blocks cached until we need them */
+	sv->sv_ibufs = NULL;
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out and thus the type
@@ -1736,7 +1905,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -1747,7 +1916,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
 	if (result) {
 		VOP_CLEANUP(&sv->sv_v);
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -36,9 +36,12 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 #include "opt-A3.h"
 
 struct vnode;
+struct vm_map;
+struct wchan;
 
 
 /* 
@@ -59,6 +62,44 @@ struct addrspace {
 
 #if OPT_A3
   bool isLoaded;
+  struct vm_map *as_maps;	/* mmap()ed regions; see mmap.h */
+
+  /*
+   * Heap, from the end of the data segment up to the break. Pages
+   * get a frame (zero-filled) the first time they are touched.
+   */
+  vaddr_t as_heapbase;		/* page-aligned start */
+  vaddr_t as_heaptop;		/* the break; need not be aligned */
+  paddr_t *as_heappages;	/* frame per heap page, 0 if untouched */
+  unsigned as_heapmax;		/* entries in as_heappages */
+
+  /*
+   * Stack, growing down from USERSTACK as it is touched. Entry 0 is
+   * the page just below USERSTACK. (as_stackpbase is unused.)
+   */
+  paddr_t *as_stackpages;
+  unsigned as_stackmax;		/* entries in as_stackpages */
+  uint32_t as_tstacks;		/* thread stack slots in use */
+
+  /*
+   * Taken by vm_fault, and by the system calls that change the
+   * layout (sbrk, mmap and friends, thread stacks), since the
+   * threads of a process may be running on several CPUs at once.
+   * Never held across file I/O: a thread in the VFS may be faulting
+   * on this address space, waiting for it.
+   */
+  struct lock *as_lock;
+
+  /*
+   * Direct I/O to user pages in progress (see as_translate), and
+   * the lock under which as_translate looks at the page arrays.
+   * Anything that frees frames or swaps the arrays of a live
+   * address space takes as_iolock, and waits for as_iopins to drop
+   * to zero before freeing frames.
+   */
+  struct spinlock as_iolock;
+  unsigned as_iopins;
+  struct wchan *as_iowchan;	/* waiting for as_iopins to drain */
 #endif // OPT_A3 adding isLoaded flag
 };
 
@@ -96,6 +137,38 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_translate - find a kernel address through which user address
+ *                VADDR can be reached directly, for I/O that skips
+ *                copyin/copyout. Also hands back how many bytes from
+ *                there on are contiguous in kernel memory. Fails with
+ *                EFAULT if VADDR is not mapped, or if WRITING and the
+ *                page is read-only. On success the memory stays put
+ *                until the caller calls as_iodone, even if another
+ *                thread of the process unmaps it; the caller must
+ *                not hold as_lock, and should be quick about it.
+ *
+ *    as_iodone - the I/O on memory found with as_translate is done.
+ *
+ *    as_sbrk   - move the break by AMOUNT bytes and hand back the old
+ *                break. Pages dropped off the end of the heap are
+ *                freed. EINVAL if the break would go below the start
+ *                of the heap, ENOMEM if it would run into a mapping.
+ *
+ *    as_stack_alloc - set aside a stack for a new user thread and hand
+ *                back its initial stack pointer. EAGAIN if all the
+ *                thread stacks are in use.
+ *
+ *    as_stack_free - give back the thread stack whose initial stack
+ *                pointer was STACKTOP, freeing its pages.
+ *
+ *    as_stack_copy - after as_copy, which leaves out thread stacks,
+ *                give NEW a copy of the thread stack in OLD that SP
+ *                points into, if any. For fork from a thread other
+ *                than the first.
+ *
+ * as_sbrk, as_stack_alloc and as_stack_free are called with as_lock
+ * held; as_stack_copy takes it.
  */
 
 struct addrspace *as_create(void);
@@ -112,6 +185,18 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_translate(struct addrspace *as, vaddr_t vaddr,
+                               bool writing, vaddr_t *kvaddr,
+                               size_t *contig);
+void              as_iodone(struct addrspace *as);
+#if OPT_A3
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_stack_alloc(struct addrspace *as, vaddr_t *stacktop);
+void              as_stack_free(struct addrspace *as, vaddr_t stacktop);
+int               as_stack_copy(struct addrspace *old,
+                                struct addrspace *new, vaddr_t sp);
+#endif
 
 
 /*
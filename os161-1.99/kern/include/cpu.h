@@ -59,7 +59,10 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_freethreads; /* Destroyed threads kept for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	struct sysstats *c_sysstats;	/* System call statistics */
+	struct cpuiostats *c_iostats;	/* I/O copy statistics */
 
 	/*
 	 * Accessed by other cpus.
@@ -152,6 +155,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends a shootdown to all CPUs except the
+ * current one.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,6 +171,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
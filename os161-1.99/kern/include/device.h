@@ -36,16 +36,22 @@
 
 
 struct uio;  /* in <uio.h> */
+struct diskreq;  /* in <disksched.h> */
 
 /*
  * Filesystem-namespace-accessible device.
  * d_io is for both reads and writes; the uio indicates the direction.
+ *
+ * d_submit, if not NULL, queues a block request and returns without
+ * waiting for it; see <disksched.h>. Only block devices that keep a
+ * request queue provide it.
  */
 struct device {
 	int (*d_open)(struct device *, int flags_from_open);
 	int (*d_close)(struct device *);
 	int (*d_io)(struct device *, struct uio *);
 	int (*d_ioctl)(struct device *, int op, userptr_t data);
+	int (*d_submit)(struct device *, struct diskreq *);
 
 	blkcnt_t d_blocks;
 	blksize_t d_blocksize;
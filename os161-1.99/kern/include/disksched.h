@@ -0,0 +1,109 @@
+#ifndef _DISKSCHED_H_
+#define _DISKSCHED_H_
+
+/*
+ * Disk I/O scheduling.
+ *
+ * A disk driver that can have more than one request outstanding
+ * keeps its pending requests in a struct disksched instead of a
+ * plain FIFO. The scheduler decides which request the driver starts
+ * next, merges requests for adjacent sectors so they go to the disk
+ * back to back, and keeps latency statistics.
+ *
+ * Policies:
+ *    fifo   - arrival order.
+ *    clook  - circular LOOK: sweep upward in sector order from the
+ *             current head position, then jump back to the lowest
+ *             pending sector and sweep up again.
+ *
+ * Each scheduler is registered under the name of its device (e.g.
+ * "lhd1") so the policy can be changed from the kernel menu, which
+ * also means from the boot command line.
+ */
+
+#include <spinlock.h>
+
+/*
+ * A block I/O request. The submitter fills in the first group of
+ * fields and hands the request to the driver, which queues it and
+ * returns at once. When the transfer finishes or fails, dr_done is
+ * called with dr_result set. dr_done is called from the interrupt
+ * handler and must not sleep; it may submit further requests.
+ *
+ * The request structure belongs to the driver until dr_done is
+ * called.
+ */
+struct diskreq {
+	uint32_t dr_sector;		/* First sector to transfer */
+	uint32_t dr_nsect;		/* Number of sectors */
+	bool dr_write;			/* Direction: true to write */
+	void *dr_data;			/* Kernel buffer, dr_nsect sectors */
+	void (*dr_done)(struct diskreq *);	/* Completion callback */
+	void *dr_arg;			/* For use by dr_done */
+
+	/* Used by the driver and scheduler */
+	int dr_result;			/* 0 or errno value */
+	uint32_t dr_pos;		/* Sectors transferred so far */
+	struct diskreq *dr_next;	/* Queue linkage */
+	struct diskreq *dr_merged;	/* Adjacent requests run after us */
+	uint32_t dr_end;		/* Sector past the end of the chain */
+	time_t dr_ssecs;		/* Time of submission */
+	uint32_t dr_snsecs;
+};
+
+/* Number of latency samples kept for computing percentiles */
+#define DS_NSAMPLES	1024
+
+/* Most sectors merged into one chain */
+#define DS_MAXMERGE	64
+
+struct dsched_policy;
+
+struct disksched {
+	char *ds_name;			/* Device name */
+	const struct dsched_policy *ds_policy;
+	struct spinlock ds_lock;	/* Protects everything below */
+	struct diskreq *ds_head;	/* Pending requests */
+	uint32_t ds_headpos;		/* Sector past the last dispatch */
+
+	/* Statistics */
+	unsigned ds_nreqs;		/* Requests completed */
+	unsigned ds_nmerged;		/* Requests merged into a chain */
+	uint64_t ds_totalns;		/* Sum of latencies */
+	uint32_t ds_maxus;		/* Largest latency */
+	uint32_t ds_samples[DS_NSAMPLES];	/* Recent latencies (us) */
+	unsigned ds_nextsample;
+
+	struct disksched *ds_nextsched;	/* Registry linkage */
+};
+
+/* Create a scheduler for device NAME with the default policy. */
+struct disksched *disksched_create(const char *name);
+void disksched_destroy(struct disksched *ds);
+
+/* Find the scheduler for a device. Returns NULL if there is none. */
+struct disksched *disksched_lookup(const char *name);
+
+/* Change policy; returns EINVAL if there is no such policy. */
+int disksched_setpolicy(struct disksched *ds, const char *policy);
+const char *disksched_policyname(struct disksched *ds);
+const char *disksched_policy(unsigned n);	/* NULL past the last */
+
+/*
+ * Queue operations, called by drivers.
+ *    disksched_add  - queue a request (stamping its submission time).
+ *    disksched_next - remove and return the next request to start,
+ *                     or NULL if none. Requests merged behind it are
+ *                     on its dr_merged list and should be started
+ *                     in order after it.
+ *    disksched_done - record that a request has completed.
+ */
+void disksched_add(struct disksched *ds, struct diskreq *req);
+struct diskreq *disksched_next(struct disksched *ds);
+void disksched_done(struct disksched *ds, struct diskreq *req);
+
+/* Statistics */
+void disksched_resetstats(struct disksched *ds);
+void disksched_printstats(struct disksched *ds);
+
+#endif /* _DISKSCHED_H_ */
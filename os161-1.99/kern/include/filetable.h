@@ -0,0 +1,73 @@
+#ifndef _FILETABLE_H_
+#define _FILETABLE_H_
+
+/*
+ * Open files and per-process file descriptor tables.
+ *
+ * An openfile is what open() creates: a vnode, the access mode the
+ * file was opened with, and the seek position. It is shared, and
+ * reference counted, by every descriptor that refers to it, whether
+ * through dup2() in one process or through fork() across processes.
+ *
+ * of_lock serializes I/O on one open file so that reads and writes
+ * through it see and update the offset atomically. Each open file
+ * has its own lock, so I/O on different open files does not contend.
+ *
+ * A filetable maps descriptor numbers to openfiles. Its spinlock
+ * covers only the slots, never I/O.
+ */
+
+#include <limits.h>
+#include <spinlock.h>
+
+struct vnode;
+struct lock;
+
+struct openfile {
+	struct vnode *of_vn;		/* The file */
+	int of_accmode;			/* O_RDONLY, O_WRONLY, or O_RDWR */
+	bool of_append;			/* O_APPEND */
+	struct lock *of_lock;		/* Protects of_offset */
+	off_t of_offset;		/* Seek position */
+
+	struct spinlock of_reflock;	/* Protects of_refcount */
+	unsigned of_refcount;
+};
+
+/* Open PATH (which may be destroyed) and make an openfile for it. */
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+/* Make an openfile for VN, already opened, taking over its reference. */
+int openfile_fromvnode(struct vnode *vn, int accmode, struct openfile **ret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+struct filetable {
+	struct spinlock ft_lock;	/* Protects ft_files */
+	struct openfile *ft_files[OPEN_MAX];
+};
+
+struct filetable *filetable_create(void);
+void filetable_destroy(struct filetable *ft);
+
+/* Make a copy sharing all the open files, for fork(). */
+int filetable_copy(struct filetable *src, struct filetable **ret);
+
+/* Open the console on descriptors 0, 1, and 2. */
+int filetable_openconsole(struct filetable *ft);
+
+/*
+ * Descriptor operations. filetable_get returns the openfile with a
+ * reference added, which the caller must drop with openfile_decref.
+ *    filetable_get     - look up FD; EBADF if it isn't open.
+ *    filetable_place   - put OF in the lowest free slot; EMFILE if full.
+ *    filetable_setfd   - put OF in slot FD, returning what was there.
+ *    filetable_remove  - empty slot FD and return what was there.
+ * place and setfd take over the caller's reference to OF.
+ */
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+int filetable_place(struct filetable *ft, struct openfile *of, int *fd);
+int filetable_setfd(struct filetable *ft, int fd, struct openfile *of,
+		    struct openfile **oldret);
+int filetable_remove(struct filetable *ft, int fd, struct openfile **ret);
+
+#endif /* _FILETABLE_H_ */
@@ -0,0 +1,24 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap(), munmap(), and msync(), shared between the
+ * kernel and libc's <sys/mman.h>.
+ */
+
+/* Page protections for mmap: PROT_NONE or any of the others or'd */
+#define PROT_NONE     0
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define PROT_EXEC     4
+
+/* Mapping types for mmap: choose one */
+#define MAP_SHARED    1      /* Writes go back to the file */
+#define MAP_PRIVATE   2      /* Writes are private to this process */
+
+/* Flags for msync */
+#define MS_SYNC       1      /* Write back before returning */
+#define MS_ASYNC      2      /* (treated like MS_SYNC) */
+#define MS_INVALIDATE 4      /* (ignored; mappings are always coherent) */
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,66 @@
+#ifndef _KERN_RING_H_
+#define _KERN_RING_H_
+
+/*
+ * Submission/completion rings for batching system calls, shared
+ * between the kernel and libc's <sys/ring.h>.
+ *
+ * A ring lives in user memory: a struct ring, then r_nentries
+ * submission entries, then r_nentries completion entries (see
+ * RING_BYTES). The process registers it with ring_setup. To run
+ * system calls it fills in submission entries at r_sqtail, advances
+ * r_sqtail, and calls ring_submit(n); the kernel runs up to n of
+ * them in order from r_sqhead, posting a completion entry for each
+ * at r_cqtail. Completions are read straight out of memory, from
+ * r_cqhead up to r_cqtail, advancing r_cqhead; no system call is
+ * needed to collect them. The kernel stops early if the completion
+ * ring fills up. Requests whose completions can't be written (the
+ * memory is gone) still count as run, and are not run again; their
+ * completions are lost.
+ *
+ * The indexes count up forever; entry i is at i % r_nentries, and
+ * r_nentries must be a power of 2.
+ */
+
+/* Operations */
+#define RING_OP_NOP     0
+#define RING_OP_WRITE   1	/* write(fd, addr, len) */
+#define RING_OP_READ    2	/* read(fd, addr, len) */
+#define RING_OP_GETPID  3	/* getpid() */
+#define RING_OP_TIME    4	/* __time(addr, addr2) */
+
+/* Largest ring */
+#define RING_MAXENTRIES 4096
+
+struct ring_sqe {
+	__u32 sqe_op;		/* RING_OP_* */
+	__i32 sqe_fd;
+	__u32 sqe_addr;		/* user buffer */
+	__u32 sqe_len;
+	__u32 sqe_addr2;	/* second pointer, for RING_OP_TIME */
+	__u32 sqe_data;		/* handed back in the completion */
+};
+
+struct ring_cqe {
+	__i32 cqe_res;		/* return value, or -errno */
+	__u32 cqe_data;		/* sqe_data of the request */
+};
+
+struct ring {
+	volatile __u32 r_sqhead;	/* next entry the kernel runs */
+	volatile __u32 r_sqtail;	/* next entry the process fills */
+	volatile __u32 r_cqhead;	/* next completion to read */
+	volatile __u32 r_cqtail;	/* next completion the kernel posts */
+	__u32 r_nentries;
+	__u32 r_pad;
+};
+
+#define RING_BYTES(n) \
+	(sizeof(struct ring) + (n) * (sizeof(struct ring_sqe) + \
+				      sizeof(struct ring_cqe)))
+
+/* Offsets of the two arrays from the start of the ring */
+#define RING_SQOFF(n)	(sizeof(struct ring))
+#define RING_CQOFF(n)	(sizeof(struct ring) + (n) * sizeof(struct ring_sqe))
+
+#endif /* _KERN_RING_H_ */
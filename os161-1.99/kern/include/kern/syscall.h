@@ -197,6 +197,18 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Local additions --
+#define SYS_msync        121
+#define SYS_spawn        122
+#define SYS_futex_wait   123
+#define SYS_futex_wake   124
+#define SYS___thread_create 125
+#define SYS_thread_exit  126
+#define SYS_thread_join  127
+#define SYS_ring_setup   128
+#define SYS_ring_submit  129
+#define SYS_sysstats     130
+
 /*CALLEND*/
 
 
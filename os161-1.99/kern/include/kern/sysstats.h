@@ -0,0 +1,28 @@
+#ifndef _KERN_SYSSTATS_H_
+#define _KERN_SYSSTATS_H_
+
+/*
+ * Per-system-call statistics, as returned by the sysstats system
+ * call (see <sys/sysstats.h> in userland).
+ *
+ * ss_count counts every call, including ones that never return
+ * (_exit, a successful execv). The latency histogram and total cover
+ * the calls that returned: ss_hist[i] counts calls that took from
+ * 2^i up to 2^(i+1) nanoseconds, and the last bucket also takes
+ * anything longer.
+ */
+
+/* Calls numbered this high or higher are not counted */
+#define SYSSTATS_NCALLS   160
+
+/* Histogram buckets */
+#define SYSSTATS_NBUCKETS 32
+
+struct sysstat {
+	__u32 ss_count;			/* Calls made */
+	__u32 ss_pad;
+	__u64 ss_totalns;		/* Time spent in calls that returned */
+	__u32 ss_hist[SYSSTATS_NBUCKETS];	/* log2 latency histogram */
+};
+
+#endif /* _KERN_SYSSTATS_H_ */
@@ -0,0 +1,35 @@
+#ifndef _KMALLOCPROF_H_
+#define _KMALLOCPROF_H_
+
+/*
+ * kmalloc allocation-site profiling (options kmallocprof).
+ *
+ * Every live kmalloc block is recorded with the address it was
+ * called from, its size, and an allocation sequence number, so that
+ * memory can be charged to the code that allocated it. Blocks are
+ * grouped by call site for reporting:
+ *
+ *    kmprof_print    - live bytes and blocks for the top sites, by
+ *                      bytes and by count, with the sequence number
+ *                      of each site's oldest live block.
+ *    kmprof_snapshot - remember the per-site totals as of now.
+ *    kmprof_diff     - print the sites whose totals have changed
+ *                      since the snapshot; a site that keeps growing
+ *                      across runs of a workload is a leak.
+ *
+ * Call sites are raw code addresses; look them up in the kernel
+ * image with addr2line or nm. Calls that go through kstrdup are
+ * charged to kstrdup.
+ *
+ * The record table is a fixed size. Blocks allocated while it is
+ * full aren't tracked, and the report says how many.
+ */
+
+void kmprof_alloc(void *ptr, size_t size, const void *caller);
+void kmprof_free(void *ptr);
+
+void kmprof_print(void);
+void kmprof_snapshot(void);
+void kmprof_diff(void);
+
+#endif /* _KMALLOCPROF_H_ */
@@ -0,0 +1,41 @@
+#ifndef _KMEMCACHE_H_
+#define _KMEMCACHE_H_
+
+/*
+ * Object caches ("slab allocator").
+ *
+ * A cache hands out objects of one fixed size, carved out of whole
+ * pages (slabs) that hold nothing else, so freeing an object finds
+ * its slab from the address alone instead of searching. Each CPU
+ * also keeps a small stack (magazine) of recently freed objects that
+ * it can reuse without taking the cache lock; most allocations and
+ * frees in steady state only touch the magazine.
+ *
+ * If a constructor is given, it is run on each object once, when
+ * its slab is created, not on every allocation. Objects must be
+ * returned to the cache in constructed state. Constructors must not
+ * sleep.
+ *
+ * Caches are meant for structures that are allocated and freed all
+ * the time (threads, processes, vnodes); kmalloc is still the thing
+ * to use for everything else. Objects may be at most
+ * KMC_MAXOBJSIZE bytes.
+ *
+ * kmem_cache_printstats (called from kheap_printstats) prints usage
+ * for every cache.
+ */
+
+#define KMC_MAXOBJSIZE	(PAGE_SIZE / 4)
+
+struct kmem_cache;
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     void (*ctor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+void kmem_cache_printstats(void);
+
+#endif /* _KMEMCACHE_H_ */
@@ -164,6 +164,9 @@ void putch_complete(void);
 int getch(void);
 void beep(void);
 
+/* Wake console readers, so those in an exiting process leave. */
+void con_wakeall(void);
+
 /*
  * Higher-level console output.
  *
@@ -0,0 +1,90 @@
+#ifndef _MMAP_H_
+#define _MMAP_H_
+
+/*
+ * File mappings made by mmap().
+ *
+ * A mapping covers a page-aligned range of user addresses and is
+ * backed by a mapped object: a vnode, the file offset the mapping
+ * starts at, and one slot per page holding the physical page once it
+ * has been read in. Pages are read in by vm_fault the first time
+ * they are touched.
+ *
+ * Private mappings have an object of their own, copied page by page
+ * on fork. Shared mappings share one object between parent and child
+ * after fork, so both see the same pages. Pages of shared mappings
+ * are mapped read-only until first written; that write fault marks
+ * the page dirty, and msync or munmap writes dirty pages back.
+ */
+
+#include <spinlock.h>
+#include <vm.h>
+
+struct addrspace;
+struct vnode;
+
+/* Mapped object */
+struct vm_mobj {
+	struct spinlock mo_lock;	/* Protects mo_refcount, mo_pages */
+	unsigned mo_refcount;		/* Mappings using this object */
+	struct vnode *mo_vn;		/* File, with a reference held */
+	off_t mo_offset;		/* File offset of page 0 */
+	bool mo_shared;			/* MAP_SHARED */
+	unsigned mo_npages;
+	paddr_t *mo_pages;		/* Page, or 0 if not read in yet */
+};
+
+/* Low bit of an mo_pages entry: page written since last writeback */
+#define MO_DIRTY	0x1
+
+/* One mapping in an address space */
+struct vm_map {
+	vaddr_t vm_base;		/* First address */
+	unsigned vm_npages;
+	int vm_prot;			/* PROT_* */
+	struct vm_mobj *vm_obj;
+	struct vm_map *vm_next;		/* Next mapping, highest first */
+};
+
+/*
+ * Mappings are placed top-down starting below this address, leaving
+ * room under USERSTACK for the stack.
+ */
+#define MMAP_TOP	(USERSTACK - 0x01000000)
+
+/*
+ * Called from the system call layer, without as_lock, which they take
+ * themselves and drop before writing anything back (addresses and
+ * sizes are in pages or page-aligned):
+ *    mmap_map     - map NPAGES of VN from OFFSET somewhere free and
+ *                   hand back the address. Takes its own reference to
+ *                   VN.
+ *    mmap_unmap   - remove the mappings inside [BASE, BASE+NPAGES),
+ *                   writing back shared pages. EINVAL if a mapping
+ *                   sticks out of the range.
+ *    mmap_sync    - write back dirty shared pages in the range.
+ *                   ENOMEM if nothing is mapped there.
+ */
+int mmap_map(struct addrspace *as, struct vnode *vn, off_t offset,
+	     unsigned npages, int prot, bool shared, vaddr_t *ret);
+int mmap_unmap(struct addrspace *as, vaddr_t base, unsigned npages);
+int mmap_sync(struct addrspace *as, vaddr_t base, unsigned npages);
+
+/*
+ * Called from the VM system:
+ *    mmap_fault    - handle a fault at VADDR if it is in a mapping,
+ *                    with as_lock held. Hands back the physical page
+ *                    and whether it may be mapped writable. EFAULT if
+ *                    there is no mapping there or the access isn't
+ *                    allowed. If the page has to be read in, as_lock
+ *                    is let go meanwhile and EAGAIN is returned: the
+ *                    caller should look at the address again.
+ *    mmap_copy     - copy the mappings of OLD into NEW, for fork.
+ *    mmap_destroy  - remove all mappings, writing back shared pages.
+ */
+int mmap_fault(struct addrspace *as, int faulttype, vaddr_t vaddr,
+	       paddr_t *paddr, bool *writable);
+int mmap_copy(struct addrspace *old, struct addrspace *new);
+void mmap_destroy(struct addrspace *as);
+
+#endif /* _MMAP_H_ */
@@ -0,0 +1,46 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Pipes.
+ *
+ * A pipe is a fixed-size ring buffer in the kernel with a vnode for
+ * each end, so that the ends can go in openfiles and file tables like
+ * anything else and read(), write() and close() need no special
+ * cases.
+ *
+ *    - read returns whatever is buffered, up to the amount asked
+ *      for, and sleeps only if nothing is. It returns 0 (end of
+ *      file) once the buffer is empty and the write end is closed.
+ *    - write sleeps until everything is written. Writes of at most
+ *      PIPE_BUF bytes go in all at once, never interleaved with
+ *      other writers. If the read end is closed, write fails with
+ *      EPIPE, or returns a short count if some data went in.
+ *
+ * Sleepers are woken only when it's worth it: readers when a write
+ * finishes or the writer has to wait for space, and writers when at
+ * least PIPE_WAKESPACE bytes are free. So a stream of small writes
+ * doesn't cost a context switch per write.
+ *
+ * A reader or writer whose process starts exiting while it sleeps
+ * gives up with EINTR; pipe_wakeall gets them moving.
+ */
+
+/* Size of the ring buffer */
+#define PIPE_SIZE	4096
+
+/* Free space at which waiting writers are woken; at least PIPE_BUF */
+#define PIPE_WAKESPACE	(PIPE_SIZE / 2)
+
+struct vnode;
+
+/* Call once during system startup. */
+void pipe_bootstrap(void);
+
+/* Make a pipe. Hands back one opened vnode for each end. */
+int pipe_create(struct vnode **readend, struct vnode **writeend);
+
+/* Wake all pipe sleepers, so those in an exiting process leave. */
+void pipe_wakeall(void);
+
+#endif /* _PIPE_H_ */
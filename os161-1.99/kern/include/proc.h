@@ -43,24 +43,30 @@
 
 struct addrspace;
 struct vnode;
+struct filetable;
 #ifdef UW
 struct semaphore;
 #endif // UW
 
 #if OPT_A2
+/* Size of the process table; pids run from PID_MIN up to this */
+#define PROC_MAXPROCS 256
 
-struct proc *Procs[64];
-struct lock *waitlk;
-//struct int ecodes[64];
-
+/*
+ * A user thread made by thread_create, from creation until it has
+ * exited and been joined. The initial thread of a process has no
+ * record; its tid is 0.
+ */
+struct uthread {
+  int ut_tid;
+  struct thread *ut_thread;       /* set once it starts running */
+  vaddr_t ut_stack;               /* top of its user stack */
+  bool ut_exited;
+  int ut_code;                    /* thread_exit code */
+  struct uthread *ut_next;        /* p_uthreads */
+};
 #endif /* OPT_A2 */
 
-#if OPT_A3
-
-struct lock *murderlk;
-
-#endif
-
 /*
  * Process structure.
  */
@@ -74,25 +80,52 @@ struct proc {
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
-
-#ifdef UW
-  /* a vnode to refer to the console device */
-  /* this is a quick-and-dirty way to get console writes working */
-  /* you will probably need to change this when implementing file-related
-     system calls, since each process will need to keep track of all files
-     it has opened, not just the console. */
-  struct vnode *console;                /* a vnode for the console device */
-#endif
+	struct filetable *p_filetable;	/* open file descriptors */
 
 	/* add more material here as needed */
 #if OPT_A2
-  struct proc *parent;
-  int exitcode;
+  /*
+   * Process family. Each process's p_waitlock protects its own lists
+   * of children and the p_sib* and p_zombie fields of the children
+   * on them, as well as its own p_exited, p_released and p_nlive.
+   * Take a parent's p_waitlock before a child's.
+   *
+   * A process is destroyed once it has exited, nobody is going to
+   * wait for it (p_released), and it has no running children, which
+   * still need its p_waitlock to exit.
+   */
+  struct proc *parent;            /* NULL if none; never changes */
+  int exitcode;                   /* wait status, set at exit */
   int pid;
-  struct cv *procv;
-  int num_child;
-  int alive_kids;
-  struct proc* children[64];
+  struct lock *p_waitlock;
+  struct cv *p_waitcv;            /* a child has exited */
+  struct proc *p_children;        /* running children */
+  struct proc *p_zombies;         /* exited children not yet waited for */
+  unsigned p_nlive;               /* number of running children */
+  bool p_exited;
+  bool p_released;
+  bool p_zombie;                  /* on our parent's p_zombies */
+  struct proc *p_sibnext;         /* parent's p_children or p_zombies */
+  struct proc **p_sibprev;
+
+  /*
+   * User threads, also under p_waitlock. p_nthreads counts the
+   * threads running in the process; the last one to leave tears it
+   * down. Once some thread calls _exit, p_exiting is set and the
+   * others leave the next time they are on their way back to user
+   * mode (see proc_checkexit). No threads are created while
+   * p_execing is set, during execv.
+   */
+  unsigned p_nthreads;
+  volatile bool p_exiting;
+  bool p_execing;
+  struct uthread *p_uthreads;
+  int p_nexttid;
+  struct cv *p_joincv;            /* a thread has exited */
+
+  /* Batched system call ring (see <kern/ring.h>), or NULL */
+  userptr_t p_ring;
+  unsigned p_ringentries;
 #endif /* OPT_A2  */
 };
 
@@ -119,6 +152,60 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+#if OPT_A2
+/*
+ * End the current process with wait status STATUS (see <kern/wait.h>):
+ * release its address space and files, detach the current thread,
+ * and pass the status to the parent. Does not return. If other
+ * threads are still running, they are told to leave, and the last
+ * one out does the rest; the status is the first exiting thread's.
+ */
+void proc_exit(int status);
+
+/*
+ * Wait for a child of the current process: PID, or any child if PID
+ * is WAIT_ANY. With WNOHANG, hands back a pid of 0 instead of
+ * sleeping if no such child has exited yet.
+ */
+int proc_wait(pid_t pid, int options, int *status, pid_t *retpid);
+
+/* Unlink and destroy a child of the current process that never ran. */
+void proc_discard(struct proc *child);
+
+/*
+ * User threads of the current process:
+ *    proc_uthread_add   - make a record for a thread about to be
+ *                         created with stack STACK and count it as
+ *                         running. Fails with EINTR if the process is
+ *                         exiting, EBUSY if it is in execv.
+ *    proc_uthread_start - called by the new thread, with its record,
+ *                         before it first goes to user mode.
+ *    proc_uthread_undo  - the thread couldn't be created after all.
+ *    proc_uthread_exit  - end the current thread with CODE. The last
+ *                         thread out ends the process with status 0.
+ *                         Does not return.
+ *    proc_uthread_join  - wait for thread TID to exit and hand back
+ *                         its code. ESRCH if there is no such thread
+ *                         (or it has been joined), EINVAL if it is
+ *                         the current thread, EINTR if the process
+ *                         starts exiting.
+ *    proc_checkexit     - leave if the process is exiting. Called on
+ *                         the way back to user mode.
+ *    proc_exiting       - true if the current process is exiting.
+ *                         Sleeps that can last indefinitely (waitpid,
+ *                         thread_join, futex, pipe and console reads)
+ *                         check it and give up with EINTR; proc_exit
+ *                         wakes them.
+ */
+int proc_uthread_add(vaddr_t stack, struct uthread **ret);
+void proc_uthread_start(struct uthread *ut);
+void proc_uthread_undo(struct uthread *ut);
+void proc_uthread_exit(int code);
+int proc_uthread_join(int tid, int *code);
+void proc_checkexit(void);
+#endif /* OPT_A2 */
+bool proc_exiting(void);
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
@@ -48,11 +48,22 @@
  */
 #include <kern/sfs.h>
 
+/*
+ * In-memory copy of an indirect block. Each vnode keeps one of these
+ * per level of indirection, so walking down to consecutive file
+ * blocks does not reread the same indirect blocks every time.
+ */
+struct sfs_ibuf {
+	uint32_t ib_block;              /* disk block cached, 0 if none */
+	uint32_t ib_data[SFS_DBPERIDB]; /* contents of that block */
+};
+
 struct sfs_vnode {
 	struct vnode sv_v;              /* abstract vnode structure */
 	struct sfs_inode sv_i;		/* on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct sfs_ibuf *sv_ibufs;      /* SFS_NINDIRECT cached blocks */
 };
 
 struct sfs_fs {
@@ -70,6 +81,12 @@ struct sfs_fs {
  */
 int sfs_mount(const char *device);
 
+/*
+ * Function for formatting a device as an empty sfs volume
+ * (EBUSY if it is mounted)
+ */
+int sfs_mkfs(const char *device, const char *volname);
+
 
 /*
  * Internal functions
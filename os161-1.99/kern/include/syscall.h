@@ -32,6 +32,7 @@
 
 #include "limits.h"
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -48,6 +49,24 @@ void syscall(struct trapframe *tf);
 /* Helper for fork(). You write this. */
 void enter_forked_process(void *tf, unsigned long ul);
 
+#if OPT_A2
+/*
+ * Set up the cache fork's trapframe copies come from, and make one.
+ * enter_forked_process frees the copy; trapframe_free is for a copy
+ * that never got that far.
+ */
+void syscall_bootstrap(void);
+struct trapframe *trapframe_dup(const struct trapframe *tf);
+void trapframe_free(struct trapframe *tf);
+
+/* Set up the futex hash table; called by syscall_bootstrap. */
+void futex_bootstrap(void);
+
+/* Wake every thread asleep on a futex in AS; for proc_exit. */
+struct addrspace;
+void futex_wakeall(struct addrspace *as);
+#endif
+
 /* Enter user mode. Does not return. */
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
@@ -70,7 +89,31 @@ int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 
 #if OPT_A2
 int sys_fork(struct trapframe *tf, int  *retval);
-int sys_execv(char *progname, char** args);
+int sys_execv(userptr_t progname, userptr_t args);
+int sys_spawn(userptr_t progname, userptr_t args, pid_t *retval);
+int sys_open(userptr_t path, int flags, mode_t mode, int *retval);
+int sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval);
+int sys_close(int fdesc);
+int sys_lseek(int fdesc, off_t pos, int whence, off_t *retval);
+int sys_pipe(userptr_t fds, int *retval);
+int sys_futex_wait(userptr_t uaddr, int val);
+int sys_futex_wake(userptr_t uaddr, int n, int *retval);
+int sys_ring_setup(userptr_t ring, unsigned nentries);
+int sys_ring_submit(unsigned n, int *retval);
+int sys_sysstats(userptr_t buf, unsigned n, int *retval);
+int sys_dup2(int oldfd, int newfd, int *retval);
 #endif /* OPT_A2 */
 
+#if OPT_A3
+int sys_sbrk(intptr_t amount, int32_t *retval);
+int sys_mmap(vaddr_t addr, size_t len, int prot, int flags, int fd,
+	     off_t offset, int32_t *retval);
+int sys_munmap(vaddr_t addr, size_t len);
+int sys_msync(vaddr_t addr, size_t len, int flags);
+int sys___thread_create(struct trapframe *tf, userptr_t entry,
+			userptr_t arg0, userptr_t arg1, int *retval);
+void sys_thread_exit(int code);
+int sys_thread_join(int tid, userptr_t code);
+#endif /* OPT_A3 */
+
 #endif /* _SYSCALL_H_ */
@@ -0,0 +1,36 @@
+#ifndef _SYSSTATS_H_
+#define _SYSSTATS_H_
+
+/*
+ * System call statistics.
+ *
+ * Each CPU keeps its own counters and latency histograms for every
+ * system call number (struct sysstat, in <kern/sysstats.h>), so
+ * recording a call costs two clock reads and touches no shared
+ * state. The dispatcher calls sysstats_enter before running a call
+ * and sysstats_exit after it returns.
+ *
+ * Readers add up the per-CPU copies without stopping anything, so
+ * calls in progress while statistics are printed or reset may or
+ * may not show up.
+ */
+
+#include <kern/sysstats.h>
+
+struct cpu;
+
+/* Allocate the statistics for a new CPU. */
+void sysstats_cpuinit(struct cpu *c);
+
+/* Record a call: stamp the start time, then account for it. */
+void sysstats_enter(int callno, time_t *secs, uint32_t *nsecs);
+void sysstats_exit(int callno, time_t secs, uint32_t nsecs);
+
+/* Totals for one call number over all CPUs. */
+void sysstats_get(unsigned callno, struct sysstat *ret);
+
+/* Clear or print (from the kernel menu) everything. */
+void sysstats_reset(void);
+void sysstats_print(void);
+
+#endif /* _SYSSTATS_H_ */
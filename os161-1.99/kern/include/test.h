@@ -74,8 +74,15 @@ int readstress(int, char **);
 int writestress(int, char **);
 int writestress2(int, char **);
 int createstress(int, char **);
+int readwritestress(int, char **);
 int printfile(int, char **);
 
+/* disk scheduler benchmark */
+int dschedbench(int, char **);
+
+/* striping benchmark */
+int stripebench(int, char **);
+
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
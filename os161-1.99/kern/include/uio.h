@@ -119,5 +119,26 @@ int uiomovezeros(size_t len, struct uio *uio);
 void uio_kinit(struct iovec *, struct uio *,
 	       void *kbuf, size_t len, off_t pos, enum uio_rw rw);
 
+/*
+ * Copy accounting. Every byte uiomove copies, and every byte a disk
+ * driver copies to or from its device buffer, is counted as copied;
+ * every byte moved to or from a disk is counted as transferred. The
+ * ratio of the two shows how many times I/O data is copied in memory.
+ *
+ * Each CPU counts into its own copy; iostats_get adds them up without
+ * stopping anything, so copies in progress may or may not show up.
+ */
+struct iostats {
+	uint64_t is_copied;
+	uint64_t is_transferred;
+};
+
+struct cpu;
+
+void iostats_cpuinit(struct cpu *c);
+void iostats_add(size_t copied, size_t transferred);
+void iostats_get(struct iostats *ret);
+void iostats_reset(void);
+
 
 #endif /* _UIO_H_ */
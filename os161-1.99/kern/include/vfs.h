@@ -157,6 +157,11 @@ int vfs_getcwd(struct uio *buf);
  *                    specified device.
  *
  *    vfs_unmountall - Unmount all mounted filesystems.
+ *
+ *    vfs_checkunmounted - Fail with EBUSY if a filesystem is mounted on
+ *                    the device DEVNAME, or ENODEV if there is no such
+ *                    mountable device. Hold vfs_biglock across the
+ *                    call and whatever relies on the answer.
  */
 
 void vfs_bootstrap(void);
@@ -173,6 +178,7 @@ int vfs_mount(const char *devname, void *data,
 			       struct fs **result));
 int vfs_unmount(const char *devname);
 int vfs_unmountall(void);
+int vfs_checkunmounted(const char *devname);
 
 /*
  * Array of vnodes.
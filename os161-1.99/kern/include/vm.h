@@ -55,9 +55,27 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+/* Like alloc_kpages, but the pages come back zero-filled */
+vaddr_t alloc_zeroed_kpages(int npages);
+
+/*
+ * Background work for an idle CPU (keeping a supply of zeroed
+ * frames). Returns true if it did something, in which case it should
+ * be called again before the CPU goes to sleep.
+ */
+bool vm_idle(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Drop user mappings from the TLB of every CPU, after pages some
+ * other CPU may have mapped have been freed or made read-only. The
+ * other CPUs do it when they take the shootdown interrupt, which is
+ * not waited for.
+ */
+void vm_tlbflush(void);
+
 
 #endif /* _VM_H_ */
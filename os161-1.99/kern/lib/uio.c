@@ -33,11 +33,28 @@
 #include <proc.h>
 #include <current.h>
 #include <copyinout.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
 
 /*
  * See uio.h for a description.
  */
 
+/*
+ * Per-CPU copy accounting, so that counting doesn't serialize every
+ * uiomove on one lock. As with the system call statistics, CPUs are
+ * never destroyed, so once the list head has been read the list can
+ * be walked without the lock.
+ */
+struct cpuiostats {
+	struct iostats ci_stats;
+	struct cpuiostats *ci_next;	/* Registry linkage */
+};
+
+static struct spinlock iostats_lock = SPINLOCK_INITIALIZER;
+static struct cpuiostats *iostats_all;
+
 int
 uiomove(void *ptr, size_t n, struct uio *uio)
 {
@@ -109,6 +126,8 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 				  (int)uio->uio_segflg);
 		}
 
+		iostats_add(size, 0);
+
 		iov->iov_len -= size;
 		uio->uio_resid -= size;
 		uio->uio_offset += size;
@@ -163,3 +182,77 @@ uio_kinit(struct iovec *iov, struct uio *u,
 	u->uio_rw = rw;
 	u->uio_space = NULL;
 }
+
+void
+iostats_cpuinit(struct cpu *c)
+{
+	struct cpuiostats *ci;
+
+	ci = kmalloc(sizeof(*ci));
+	if (ci == NULL) {
+		panic("iostats_cpuinit: Out of memory\n");
+	}
+	ci->ci_stats.is_copied = 0;
+	ci->ci_stats.is_transferred = 0;
+
+	spinlock_acquire(&iostats_lock);
+	ci->ci_next = iostats_all;
+	iostats_all = ci;
+	spinlock_release(&iostats_lock);
+
+	c->c_iostats = ci;
+}
+
+static
+struct cpuiostats *
+iostats_first(void)
+{
+	struct cpuiostats *ci;
+
+	spinlock_acquire(&iostats_lock);
+	ci = iostats_all;
+	spinlock_release(&iostats_lock);
+	return ci;
+}
+
+/*
+ * Only the owning CPU writes its counters. Interrupts are off so a
+ * thread switch can't move us to another CPU partway through, and so
+ * a disk interrupt can't interleave its own update.
+ */
+void
+iostats_add(size_t copied, size_t transferred)
+{
+	struct iostats *st;
+	int spl;
+
+	spl = splhigh();
+	st = &curcpu->c_iostats->ci_stats;
+	st->is_copied += copied;
+	st->is_transferred += transferred;
+	splx(spl);
+}
+
+void
+iostats_get(struct iostats *ret)
+{
+	struct cpuiostats *ci;
+
+	ret->is_copied = 0;
+	ret->is_transferred = 0;
+	for (ci = iostats_first(); ci != NULL; ci = ci->ci_next) {
+		ret->is_copied += ci->ci_stats.is_copied;
+		ret->is_transferred += ci->ci_stats.is_transferred;
+	}
+}
+
+void
+iostats_reset(void)
+{
+	struct cpuiostats *ci;
+
+	for (ci = iostats_first(); ci != NULL; ci = ci->ci_next) {
+		ci->ci_stats.is_copied = 0;
+		ci->ci_stats.is_transferred = 0;
+	}
+}
@@ -0,0 +1,287 @@
+/*
+ * Open files and file descriptor tables. See filetable.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <filetable.h>
+
+////////////////////////////////////////////////////////////
+//
+// Open files
+
+/*
+ * Allocate an openfile with no vnode yet.
+ */
+static
+struct openfile *
+openfile_create(int accmode)
+{
+	struct openfile *of;
+
+	of = kmalloc(sizeof(*of));
+	if (of == NULL) {
+		return NULL;
+	}
+	of->of_lock = lock_create("openfile");
+	if (of->of_lock == NULL) {
+		kfree(of);
+		return NULL;
+	}
+	of->of_vn = NULL;
+	of->of_accmode = accmode;
+	of->of_append = false;
+	of->of_offset = 0;
+	spinlock_init(&of->of_reflock);
+	of->of_refcount = 1;
+	return of;
+}
+
+static
+void
+openfile_free(struct openfile *of)
+{
+	lock_destroy(of->of_lock);
+	spinlock_cleanup(&of->of_reflock);
+	kfree(of);
+}
+
+int
+openfile_open(char *path, int flags, mode_t mode, struct openfile **ret)
+{
+	struct openfile *of;
+	int result;
+
+	switch (flags & O_ACCMODE) {
+	    case O_RDONLY:
+	    case O_WRONLY:
+	    case O_RDWR:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	of = openfile_create(flags & O_ACCMODE);
+	if (of == NULL) {
+		return ENOMEM;
+	}
+
+	result = vfs_open(path, flags, mode, &of->of_vn);
+	if (result) {
+		openfile_free(of);
+		return result;
+	}
+	of->of_append = (flags & O_APPEND) != 0;
+
+	*ret = of;
+	return 0;
+}
+
+int
+openfile_fromvnode(struct vnode *vn, int accmode, struct openfile **ret)
+{
+	struct openfile *of;
+
+	of = openfile_create(accmode);
+	if (of == NULL) {
+		return ENOMEM;
+	}
+	of->of_vn = vn;
+
+	*ret = of;
+	return 0;
+}
+
+void
+openfile_incref(struct openfile *of)
+{
+	spinlock_acquire(&of->of_reflock);
+	of->of_refcount++;
+	spinlock_release(&of->of_reflock);
+}
+
+void
+openfile_decref(struct openfile *of)
+{
+	bool last;
+
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount--;
+	last = (of->of_refcount == 0);
+	spinlock_release(&of->of_reflock);
+
+	if (last) {
+		vfs_close(of->of_vn);
+		openfile_free(of);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Descriptor tables
+
+struct filetable *
+filetable_create(void)
+{
+	struct filetable *ft;
+	int fd;
+
+	ft = kmalloc(sizeof(*ft));
+	if (ft == NULL) {
+		return NULL;
+	}
+	spinlock_init(&ft->ft_lock);
+	for (fd=0; fd<OPEN_MAX; fd++) {
+		ft->ft_files[fd] = NULL;
+	}
+	return ft;
+}
+
+/*
+ * Close everything. The table must no longer be reachable from its
+ * process, so no lock is needed.
+ */
+void
+filetable_destroy(struct filetable *ft)
+{
+	int fd;
+
+	for (fd=0; fd<OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] != NULL) {
+			openfile_decref(ft->ft_files[fd]);
+			ft->ft_files[fd] = NULL;
+		}
+	}
+	spinlock_cleanup(&ft->ft_lock);
+	kfree(ft);
+}
+
+int
+filetable_copy(struct filetable *src, struct filetable **ret)
+{
+	struct filetable *ft;
+	struct openfile *of;
+	int fd;
+
+	ft = filetable_create();
+	if (ft == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&src->ft_lock);
+	for (fd=0; fd<OPEN_MAX; fd++) {
+		of = src->ft_files[fd];
+		if (of != NULL) {
+			openfile_incref(of);
+			ft->ft_files[fd] = of;
+		}
+	}
+	spinlock_release(&src->ft_lock);
+
+	*ret = ft;
+	return 0;
+}
+
+int
+filetable_openconsole(struct filetable *ft)
+{
+	static const int modes[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+	char path[5];
+	struct openfile *of;
+	int fd, result;
+
+	for (fd=0; fd<3; fd++) {
+		/* vfs_open may destroy the path, so make it fresh each time */
+		strcpy(path, "con:");
+		result = openfile_open(path, modes[fd], 0, &of);
+		if (result) {
+			return result;
+		}
+		KASSERT(ft->ft_files[fd] == NULL);
+		ft->ft_files[fd] = of;
+	}
+	return 0;
+}
+
+int
+filetable_get(struct filetable *ft, int fd, struct openfile **ret)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	of = ft->ft_files[fd];
+	if (of != NULL) {
+		openfile_incref(of);
+	}
+	spinlock_release(&ft->ft_lock);
+
+	if (of == NULL) {
+		return EBADF;
+	}
+	*ret = of;
+	return 0;
+}
+
+int
+filetable_place(struct filetable *ft, struct openfile *of, int *fdret)
+{
+	int fd;
+
+	spinlock_acquire(&ft->ft_lock);
+	for (fd=0; fd<OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] == NULL) {
+			ft->ft_files[fd] = of;
+			spinlock_release(&ft->ft_lock);
+			*fdret = fd;
+			return 0;
+		}
+	}
+	spinlock_release(&ft->ft_lock);
+	return EMFILE;
+}
+
+int
+filetable_setfd(struct filetable *ft, int fd, struct openfile *of,
+		struct openfile **oldret)
+{
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	*oldret = ft->ft_files[fd];
+	ft->ft_files[fd] = of;
+	spinlock_release(&ft->ft_lock);
+	return 0;
+}
+
+int
+filetable_remove(struct filetable *ft, int fd, struct openfile **ret)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	of = ft->ft_files[fd];
+	ft->ft_files[fd] = NULL;
+	spinlock_release(&ft->ft_lock);
+
+	if (of == NULL) {
+		return EBADF;
+	}
+	*ret = of;
+	return 0;
+}
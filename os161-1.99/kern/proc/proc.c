@@ -43,12 +43,19 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <limits.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <filetable.h>
+#include <kmemcache.h>
+#include <syscall.h>
+#include <pipe.h>
 #include <kern/fcntl.h>  
 #include "opt-A2.h"
 #include "opt-A3.h"
@@ -57,6 +64,9 @@
  */
 struct proc *kproc;
 
+/* Where proc structures come from */
+static struct kmem_cache *proc_cache;
+
 /*
  * Mechanism for making the kernel menu thread sleep while processes are running
  */
@@ -72,20 +82,17 @@ struct semaphore *no_proc_sem;
 
 #if OPT_A2
 
-static struct semaphore *pid_mutex;
-volatile int curpid;
-struct proc *Procs[64];
-struct lock *waitlk;
-//int ecodes[64];
+/*
+ * Process table, indexed by pid. Processes remove themselves in
+ * proc_destroy, under the table lock, so a pointer found here is good
+ * for as long as that lock is held.
+ */
+static struct spinlock proc_tablelock = SPINLOCK_INITIALIZER;
+static struct proc *proc_table[PROC_MAXPROCS];
+static pid_t proc_nextpid = PID_MIN;
 
 #endif /* OPT_A2 */
 
-#if OPT_A3
-
-struct lock *murderlk;
-
-#endif
-
 /*
  * Create a proc structure.
  */
@@ -95,13 +102,13 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
@@ -113,17 +120,30 @@ proc_create(const char *name)
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
-
-#ifdef UW
-	proc->console = NULL;
-#endif // UW
+	proc->p_filetable = NULL;
 
 #if OPT_A2
-    proc->num_child = 0;
-    proc->alive_kids = 0;
     proc->pid = 0;
     proc->exitcode = 0;
     proc->parent = NULL;
+    proc->p_waitlock = NULL;
+    proc->p_waitcv = NULL;
+    proc->p_children = NULL;
+    proc->p_zombies = NULL;
+    proc->p_nlive = 0;
+    proc->p_exited = false;
+    proc->p_released = false;
+    proc->p_zombie = false;
+    proc->p_sibnext = NULL;
+    proc->p_sibprev = NULL;
+    proc->p_nthreads = 0;
+    proc->p_exiting = false;
+    proc->p_execing = false;
+    proc->p_uthreads = NULL;
+    proc->p_nexttid = 1;
+    proc->p_joincv = NULL;
+    proc->p_ring = NULL;
+    proc->p_ringentries = 0;
 #endif /* OPT_A2 */
 
 	return proc;
@@ -148,14 +168,31 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != kproc);
 
 #if OPT_A2
-    
-    // curproc ded thus orphanning all children, earsing the bound to parent
-    int num = proc->num_child;
-    for (int i = 0; i < num; i++) {
-      ((proc->children)[i])->parent = NULL;
+    KASSERT(proc->p_children == NULL);
+    KASSERT(proc->p_zombies == NULL);
+    KASSERT(proc->p_sibprev == NULL);
+
+    if (proc->pid != 0) {
+      spinlock_acquire(&proc_tablelock);
+      KASSERT(proc_table[proc->pid] == proc);
+      proc_table[proc->pid] = NULL;
+      spinlock_release(&proc_tablelock);
+    }
+    /* Threads that exited without being joined */
+    while (proc->p_uthreads != NULL) {
+      struct uthread *ut = proc->p_uthreads;
+      proc->p_uthreads = ut->ut_next;
+      kfree(ut);
+    }
+    if (proc->p_joincv != NULL) {
+      cv_destroy(proc->p_joincv);
+    }
+    if (proc->p_waitcv != NULL) {
+      cv_destroy(proc->p_waitcv);
+    }
+    if (proc->p_waitlock != NULL) {
+      lock_destroy(proc->p_waitlock);
     }
-    cv_destroy(proc->procv);
-
 #endif	/* OPT_A2 */
 
     /*
@@ -169,6 +206,10 @@ proc_destroy(struct proc *proc)
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
 	}
+	if (proc->p_filetable) {
+		filetable_destroy(proc->p_filetable);
+		proc->p_filetable = NULL;
+	}
 
 
 #ifndef UW  // in the UW version, space destruction occurs in sys_exit, not here
@@ -191,17 +232,11 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-#ifdef UW
-	if (proc->console) {
-	  vfs_close(proc->console);
-	}
-#endif // UW
-
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(proc_cache, proc);
 
 #ifdef UW
 	/* decrement the process count */
@@ -226,19 +261,16 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+  proc_cache = kmem_cache_create("proc", sizeof(struct proc), NULL);
+  if (proc_cache == NULL) {
+    panic("could not create proc cache\n");
+  }
   kproc = proc_create("[kernel]");
   if (kproc == NULL) {
     panic("proc_create for kproc failed\n");
   }
 #ifdef UW
   proc_count = 0;
-  
-  #if OPT_A2
-
-  curpid = 1;
-
-#endif /* OPT_A2  */
-  
   proc_count_mutex = sem_create("proc_count_mutex",1);
   if (proc_count_mutex == NULL) {
     panic("could not create proc_count_mutex semaphore\n");
@@ -248,19 +280,6 @@ proc_bootstrap(void)
     panic("could not create no_proc_sem semaphore\n");
   }
 #endif // UW 
-
-#if OPT_A2
-
-  pid_mutex = sem_create("pid_mutex",1);
-  waitlk = lock_create("waitlk");
-
-#endif /* OPT_A2 */  
-
-#if OPT_A3
-
-murderlk = lock_create("murderlk");
-
-#endif
 }
 
 /*
@@ -273,25 +292,46 @@ struct proc *
 proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
-	char *console_path;
+	int result;
+#if OPT_A2
+	pid_t pid;
+	int i;
+#endif
 
 	proc = proc_create(name);
 	if (proc == NULL) {
 		return NULL;
 	}
 
-#ifdef UW
-	/* open the console - this should always succeed */
-	console_path = kstrdup("con:");
-	if (console_path == NULL) {
-	  panic("unable to copy console path name during process creation\n");
+	/*
+	 * A process forked from a user process shares its parent's
+	 * open files; one started from the menu gets the console on
+	 * stdin, stdout, and stderr.
+	 */
+	if (curproc->p_filetable != NULL) {
+		result = filetable_copy(curproc->p_filetable,
+					&proc->p_filetable);
+	}
+	else {
+		proc->p_filetable = filetable_create();
+		if (proc->p_filetable == NULL) {
+			result = ENOMEM;
+		}
+		else {
+			result = filetable_openconsole(proc->p_filetable);
+		}
 	}
-	if (vfs_open(console_path,O_WRONLY,0,&(proc->console))) {
-	  panic("unable to open the console during process creation\n");
+	if (result) {
+		if (proc->p_filetable != NULL) {
+			filetable_destroy(proc->p_filetable);
+		}
+		threadarray_cleanup(&proc->p_threads);
+		spinlock_cleanup(&proc->p_lock);
+		kfree(proc->p_name);
+		kmem_cache_free(proc_cache, proc);
+		return NULL;
 	}
-	kfree(console_path);
-#endif // UW
-	  
+
 	/* VM fields */
 
 	proc->p_addrspace = NULL;
@@ -325,23 +365,57 @@ proc_create_runprogram(const char *name)
 #endif // UW
 
 #if OPT_A2
+	proc->p_waitlock = lock_create(name);
+	proc->p_waitcv = cv_create(name);
+	proc->p_joincv = cv_create(name);
+	if (proc->p_waitlock == NULL || proc->p_waitcv == NULL ||
+	    proc->p_joincv == NULL) {
+		proc_destroy(proc);
+		return NULL;
+	}
+	/* The thread the caller is about to give us */
+	proc->p_nthreads = 1;
+
+	/* Find a free pid, starting after the last one handed out */
+	spinlock_acquire(&proc_tablelock);
+	for (i = 0; i < PROC_MAXPROCS - PID_MIN; i++) {
+		pid = proc_nextpid++;
+		if (proc_nextpid >= PROC_MAXPROCS) {
+			proc_nextpid = PID_MIN;
+		}
+		if (proc_table[pid] == NULL) {
+			proc_table[pid] = proc;
+			proc->pid = pid;
+			break;
+		}
+	}
+	spinlock_release(&proc_tablelock);
+	if (proc->pid == 0) {
+		/* Table full */
+		proc_destroy(proc);
+		return NULL;
+	}
 
-   P(pid_mutex);
-
-     proc->pid = curpid;
-     if (curproc != kproc) { proc->parent = curproc; } else {proc->parent = NULL;}
-     (curproc->children)[curproc->num_child] = proc;
-     proc->procv = cv_create(proc->p_name);
-     
-     Procs[curpid] = proc;
-
-     curproc->num_child++;
-     curproc->alive_kids++;
-     curpid++;
-
-   V(pid_mutex);   
-
-#endif /* OPT_A2  */
+	/*
+	 * Processes started from the menu have no parent; nobody
+	 * waits for them.
+	 */
+	if (curproc != kproc) {
+		proc->parent = curproc;
+		lock_acquire(curproc->p_waitlock);
+		proc->p_sibnext = curproc->p_children;
+		if (proc->p_sibnext != NULL) {
+			proc->p_sibnext->p_sibprev = &proc->p_sibnext;
+		}
+		proc->p_sibprev = &curproc->p_children;
+		curproc->p_children = proc;
+		curproc->p_nlive++;
+		lock_release(curproc->p_waitlock);
+	}
+	else {
+		proc->p_released = true;
+	}
+#endif /* OPT_A2 */
 
 	return proc;
 }
@@ -396,6 +470,418 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+#if OPT_A2
+
+/*
+ * Family lists. Called with the parent's p_waitlock held.
+ */
+static
+void
+proc_link(struct proc **head, struct proc *child)
+{
+	KASSERT(child->p_sibprev == NULL);
+	child->p_sibnext = *head;
+	if (child->p_sibnext != NULL) {
+		child->p_sibnext->p_sibprev = &child->p_sibnext;
+	}
+	child->p_sibprev = head;
+	*head = child;
+}
+
+static
+void
+proc_unlink(struct proc *child)
+{
+	KASSERT(child->p_sibprev != NULL);
+	*child->p_sibprev = child->p_sibnext;
+	if (child->p_sibnext != NULL) {
+		child->p_sibnext->p_sibprev = child->p_sibprev;
+	}
+	child->p_sibnext = NULL;
+	child->p_sibprev = NULL;
+}
+
+/*
+ * Record that nobody is going to wait for exited process P, and
+ * destroy it unless it still has running children.
+ */
+static
+void
+proc_release(struct proc *p)
+{
+	bool destroy;
+
+	lock_acquire(p->p_waitlock);
+	KASSERT(p->p_exited);
+	p->p_released = true;
+	destroy = (p->p_nlive == 0);
+	lock_release(p->p_waitlock);
+
+	if (destroy) {
+		proc_destroy(p);
+	}
+}
+
+void
+proc_exit(int status)
+{
+	struct proc *p = curproc;
+	struct proc *parent = p->parent;
+	struct proc *z;
+	struct addrspace *as;
+	bool destroy, orphaned;
+
+	/*
+	 * The first thread to exit decides the status. If there are
+	 * other threads, get them moving and leave the rest to the
+	 * last of them.
+	 */
+	lock_acquire(p->p_waitlock);
+	if (!p->p_exiting) {
+		p->p_exiting = true;
+		p->exitcode = status;
+		if (p->p_nthreads > 1) {
+			cv_broadcast(p->p_joincv, p->p_waitlock);
+			cv_broadcast(p->p_waitcv, p->p_waitlock);
+			futex_wakeall(p->p_addrspace);
+			pipe_wakeall();
+			con_wakeall();
+		}
+	}
+	KASSERT(p->p_nthreads > 0);
+	if (p->p_nthreads > 1) {
+		p->p_nthreads--;
+		proc_remthread(curthread);
+		lock_release(p->p_waitlock);
+		thread_exit();
+	}
+	p->p_nthreads = 0;
+	lock_release(p->p_waitlock);
+
+	as_deactivate();
+	as = curproc_setas(NULL);
+	if (as != NULL) {
+		as_destroy(as);
+	}
+
+	/* close our files now rather than when we are reaped */
+	if (p->p_filetable != NULL) {
+		filetable_destroy(p->p_filetable);
+		p->p_filetable = NULL;
+	}
+
+	/* note: curproc cannot be used after this call */
+	proc_remthread(curthread);
+
+	/*
+	 * Children that have already exited won't be waited for now.
+	 * Running ones see p_exited when they exit.
+	 */
+	lock_acquire(p->p_waitlock);
+	p->p_exited = true;
+	while ((z = p->p_zombies) != NULL) {
+		proc_unlink(z);
+		z->p_zombie = false;
+		proc_release(z);
+	}
+	destroy = (parent == NULL && p->p_nlive == 0);
+	lock_release(p->p_waitlock);
+
+	if (parent == NULL) {
+		/* Started from the menu; p_released is already set */
+		if (destroy) {
+			proc_destroy(p);
+		}
+		thread_exit();
+	}
+
+	/* Hand our status to the parent, unless it has exited too */
+	lock_acquire(parent->p_waitlock);
+	proc_unlink(p);
+	parent->p_nlive--;
+	orphaned = parent->p_exited;
+	if (orphaned) {
+		destroy = parent->p_released && parent->p_nlive == 0;
+	}
+	else {
+		destroy = false;
+		p->p_zombie = true;
+		proc_link(&parent->p_zombies, p);
+		cv_broadcast(parent->p_waitcv, parent->p_waitlock);
+	}
+	lock_release(parent->p_waitlock);
+
+	/* If we were on p_zombies, p may be gone already */
+	if (destroy) {
+		/* We were the last thing keeping the parent around */
+		proc_destroy(parent);
+	}
+	if (orphaned) {
+		proc_release(p);
+	}
+	thread_exit();
+}
+
+int
+proc_wait(pid_t pid, int options, int *status, pid_t *retpid)
+{
+	struct proc *p = curproc;
+	struct proc *child;
+	int result = 0;
+
+	if (options & ~WNOHANG) {
+		return EINVAL;
+	}
+	if (pid != WAIT_ANY && pid < PID_MIN) {
+		/* No process groups */
+		return EINVAL;
+	}
+	if (pid >= PROC_MAXPROCS) {
+		return ESRCH;
+	}
+
+	lock_acquire(p->p_waitlock);
+	while (1) {
+		if (pid == WAIT_ANY) {
+			child = p->p_zombies;
+			if (child == NULL && p->p_nlive == 0) {
+				result = ECHILD;
+				break;
+			}
+		}
+		else {
+			/*
+			 * Look it up each time round; another thread
+			 * may have waited for it while we slept.
+			 */
+			spinlock_acquire(&proc_tablelock);
+			child = proc_table[pid];
+			if (child == NULL) {
+				result = ESRCH;
+			}
+			else if (child->parent != p) {
+				result = ECHILD;
+			}
+			spinlock_release(&proc_tablelock);
+			if (result) {
+				break;
+			}
+			if (!child->p_zombie) {
+				child = NULL;
+			}
+		}
+
+		if (child != NULL) {
+			proc_unlink(child);
+			child->p_zombie = false;
+			break;
+		}
+		if (options & WNOHANG) {
+			break;
+		}
+		if (p->p_exiting) {
+			result = EINTR;
+			break;
+		}
+		cv_wait(p->p_waitcv, p->p_waitlock);
+	}
+	lock_release(p->p_waitlock);
+
+	if (result) {
+		return result;
+	}
+	if (child == NULL) {
+		/* WNOHANG and nothing has exited */
+		*retpid = 0;
+		return 0;
+	}
+
+	*status = child->exitcode;
+	*retpid = child->pid;
+	proc_release(child);
+	return 0;
+}
+
+int
+proc_uthread_add(vaddr_t stack, struct uthread **ret)
+{
+	struct proc *p = curproc;
+	struct uthread *ut;
+	int result;
+
+	ut = kmalloc(sizeof(*ut));
+	if (ut == NULL) {
+		return ENOMEM;
+	}
+	ut->ut_thread = NULL;
+	ut->ut_stack = stack;
+	ut->ut_exited = false;
+	ut->ut_code = 0;
+
+	lock_acquire(p->p_waitlock);
+	if (p->p_exiting || p->p_execing) {
+		result = p->p_exiting ? EINTR : EBUSY;
+		lock_release(p->p_waitlock);
+		kfree(ut);
+		return result;
+	}
+	ut->ut_tid = p->p_nexttid++;
+	ut->ut_next = p->p_uthreads;
+	p->p_uthreads = ut;
+	p->p_nthreads++;
+	lock_release(p->p_waitlock);
+
+	*ret = ut;
+	return 0;
+}
+
+void
+proc_uthread_start(struct uthread *ut)
+{
+	struct proc *p = curproc;
+
+	lock_acquire(p->p_waitlock);
+	ut->ut_thread = curthread;
+	lock_release(p->p_waitlock);
+}
+
+void
+proc_uthread_undo(struct uthread *ut)
+{
+	struct proc *p = curproc;
+	struct uthread **pp;
+
+	lock_acquire(p->p_waitlock);
+	for (pp = &p->p_uthreads; *pp != ut; pp = &(*pp)->ut_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = ut->ut_next;
+	p->p_nthreads--;
+	lock_release(p->p_waitlock);
+	kfree(ut);
+}
+
+void
+proc_uthread_exit(int code)
+{
+	struct proc *p = curproc;
+	struct uthread *ut;
+#if OPT_A3
+	struct addrspace *as;
+#endif
+
+	lock_acquire(p->p_waitlock);
+	if (p->p_nthreads == 1) {
+		/* Last one out; nothing can start another thread now */
+		lock_release(p->p_waitlock);
+		proc_exit(_MKWAIT_EXIT(0));
+	}
+
+	/* The initial thread has no record */
+	for (ut = p->p_uthreads; ut != NULL; ut = ut->ut_next) {
+		if (ut->ut_thread == curthread) {
+			break;
+		}
+	}
+	if (ut != NULL) {
+		ut->ut_exited = true;
+		ut->ut_code = code;
+		cv_broadcast(p->p_joincv, p->p_waitlock);
+#if OPT_A3
+		/* While we still count, so the address space is there */
+		as = p->p_addrspace;
+		lock_acquire(as->as_lock);
+		as_stack_free(as, ut->ut_stack);
+		lock_release(as->as_lock);
+#endif
+	}
+
+	p->p_nthreads--;
+	proc_remthread(curthread);
+	lock_release(p->p_waitlock);
+	thread_exit();
+}
+
+int
+proc_uthread_join(int tid, int *code)
+{
+	struct proc *p = curproc;
+	struct uthread *ut, **pp;
+	int result = 0;
+
+	lock_acquire(p->p_waitlock);
+	while (1) {
+		for (pp = &p->p_uthreads; *pp != NULL; pp = &(*pp)->ut_next) {
+			if ((*pp)->ut_tid == tid) {
+				break;
+			}
+		}
+		ut = *pp;
+		if (ut == NULL) {
+			result = ESRCH;
+			break;
+		}
+		if (ut->ut_thread == curthread) {
+			result = EINVAL;
+			break;
+		}
+		if (ut->ut_exited) {
+			*pp = ut->ut_next;
+			*code = ut->ut_code;
+			break;
+		}
+		if (p->p_exiting) {
+			result = EINTR;
+			break;
+		}
+		cv_wait(p->p_joincv, p->p_waitlock);
+	}
+	lock_release(p->p_waitlock);
+
+	if (result == 0) {
+		kfree(ut);
+	}
+	return result;
+}
+
+void
+proc_checkexit(void)
+{
+	/* Unlocked; at worst we go round once more */
+	if (proc_exiting()) {
+		/* The status was set by whoever started the exit */
+		proc_exit(0);
+	}
+}
+
+void
+proc_discard(struct proc *child)
+{
+	KASSERT(child->parent == curproc);
+	KASSERT(threadarray_num(&child->p_threads) == 0);
+
+	lock_acquire(curproc->p_waitlock);
+	proc_unlink(child);
+	curproc->p_nlive--;
+	lock_release(curproc->p_waitlock);
+
+	proc_destroy(child);
+}
+
+#endif /* OPT_A2 */
+
+bool
+proc_exiting(void)
+{
+#if OPT_A2
+	struct proc *p = curproc;
+
+	return p != NULL && p != kproc && p->p_exiting;
+#else
+	return false;
+#endif
+}
+
 /*
  * Fetch the address space of the current process. Caution: it isn't
  * refcounted. If you implement multithreaded processes, make sure to
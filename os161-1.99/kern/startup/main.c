@@ -109,6 +109,9 @@ boot(void)
 	ram_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
+#if OPT_A2
+	syscall_bootstrap();
+#endif
 	hardclock_bootstrap();
 	vfs_bootstrap();
 
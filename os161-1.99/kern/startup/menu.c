@@ -41,10 +41,15 @@
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
+#include <disksched.h>
+#include <sysstats.h>
+#include <generic/stripe.h>
 #include <test.h>
+#include <kmallocprof.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-kmallocprof.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -334,6 +339,38 @@ cmd_mount(int nargs, char **args)
 	return EINVAL;
 }
 
+#if OPT_SFS
+/*
+ * Command for formatting a device with an empty SFS volume.
+ */
+static
+int
+cmd_mksfs(int nargs, char **args)
+{
+	char *device;
+	int result;
+
+	if (nargs != 3) {
+		kprintf("Usage: mksfs device: volname\n");
+		return EINVAL;
+	}
+
+	device = args[1];
+
+	/* Allow (but do not require) colon after device name */
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	result = sfs_mkfs(device, args[2]);
+	if (result) {
+		kprintf("mksfs: %s: %s\n", device, strerror(result));
+		return result;
+	}
+	return 0;
+}
+#endif
+
 static
 int
 cmd_unmount(int nargs, char **args)
@@ -384,6 +421,56 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+/*
+ * Command for printing how many times I/O data has been copied in
+ * memory per byte moved to or from disk.
+ */
+static
+int
+cmd_iostats(int nargs, char **args)
+{
+	struct iostats st;
+	uint64_t ratio;
+
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		iostats_reset();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: iostats [reset]\n");
+		return EINVAL;
+	}
+
+	iostats_get(&st);
+	/* hundredths */
+	ratio = st.is_transferred ? st.is_copied * 100 / st.is_transferred : 0;
+	kprintf("%llu bytes transferred, %llu bytes copied, "
+		"%u.%02u copies per byte\n",
+		st.is_transferred, st.is_copied,
+		(unsigned)(ratio / 100), (unsigned)(ratio % 100));
+	return 0;
+}
+
+/*
+ * Command for the per-system-call counts and latency histograms.
+ */
+static
+int
+cmd_sysstats(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		sysstats_reset();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: sysstats [reset]\n");
+		return EINVAL;
+	}
+
+	sysstats_print();
+	return 0;
+}
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -396,6 +483,111 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_KMALLOCPROF
+/*
+ * Command for the kmalloc allocation-site profile.
+ */
+static
+int
+cmd_kmprof(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kmprof_print();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "snap")) {
+		kmprof_snapshot();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "diff")) {
+		kmprof_diff();
+	}
+	else {
+		kprintf("Usage: kmprof [snap|diff]\n");
+		return EINVAL;
+	}
+	return 0;
+}
+#endif
+
+/*
+ * Command for showing or changing a disk's I/O scheduling policy
+ * and printing its request latency statistics.
+ */
+static
+int
+cmd_dsched(int nargs, char **args)
+{
+	struct disksched *ds;
+	char *device;
+	const char *policy;
+	unsigned i;
+	int result;
+
+	if (nargs != 2 && nargs != 3) {
+		kprintf("Usage: dsched device [policy|reset]\n");
+		kprintf("Policies:");
+		for (i=0; (policy = disksched_policy(i)) != NULL; i++) {
+			kprintf(" %s", policy);
+		}
+		kprintf("\n");
+		return EINVAL;
+	}
+
+	device = args[1];
+
+	/* Allow (but do not require) colon after device name */
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	ds = disksched_lookup(device);
+	if (ds == NULL) {
+		kprintf("dsched: %s has no disk scheduler\n", device);
+		return ENODEV;
+	}
+
+	if (nargs == 3) {
+		if (!strcmp(args[2], "reset")) {
+			disksched_resetstats(ds);
+		}
+		else {
+			result = disksched_setpolicy(ds, args[2]);
+			if (result) {
+				kprintf("dsched: %s: %s\n", args[2],
+					strerror(result));
+				return result;
+			}
+		}
+	}
+
+	disksched_printstats(ds);
+	return 0;
+}
+
+/*
+ * Command for making a striped device out of several disks.
+ */
+static
+int
+cmd_stripe(int nargs, char **args)
+{
+	char name[32];
+	int unitsects;
+
+	if (nargs < 3) {
+		kprintf("Usage: stripe unit-sectors disk: [disk:...]\n");
+		return EINVAL;
+	}
+
+	unitsects = atoi(args[1]);
+	if (unitsects <= 0) {
+		kprintf("stripe: invalid stripe unit %s\n", args[1]);
+		return EINVAL;
+	}
+
+	return stripe_create(unitsects, nargs - 2, &args[2],
+			     name, sizeof(name));
+}
+
 /*
 Command for dth: enabling the DB_THREADS debugging messages
 */
@@ -444,12 +636,19 @@ static const char *opsmenu[] = {
 	"[s]       Shell                     ",
 	"[p]       Other program             ",
 	"[mount]   Mount a filesystem        ",
+#if OPT_SFS
+	"[mksfs]   Format an SFS volume      ",
+#endif
 	"[unmount] Unmount a filesystem      ",
 	"[bootfs]  Set \"boot\" filesystem     ",
 	"[pf]      Print a file              ",
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[dsched]  Disk scheduler            ",
+	"[iostats] I/O copy statistics       ",
+	"[sysstats] System call statistics   ",
+	"[stripe]  Make a striped device     ",
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
     "[dth]     enbale DB_THREADS         ",
@@ -490,6 +689,9 @@ static const char *testmenu[] = {
 	"[fs3] FS write stress       (4)     ",
 	"[fs4] FS write stress 2     (4)     ",
 	"[fs5] FS create stress      (4)     ",
+	"[fs6] FS read/write stress  (4)     ",
+	"[dsb] Disk scheduler bench  (4)     ",
+	"[stb] Striping benchmark            ",
 	NULL
 };
 
@@ -521,6 +723,9 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_KMALLOCPROF
+	"[kmprof] kmalloc sites [snap|diff]  ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -555,12 +760,19 @@ static struct {
 	{ "s",		cmd_shell },
 	{ "p",		cmd_prog },
 	{ "mount",	cmd_mount },
+#if OPT_SFS
+	{ "mksfs",	cmd_mksfs },
+#endif
 	{ "unmount",	cmd_unmount },
 	{ "bootfs",	cmd_bootfs },
 	{ "pf",		printfile },
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "dsched",	cmd_dsched },
+	{ "iostats",	cmd_iostats },
+	{ "sysstats",	cmd_sysstats },
+	{ "stripe",	cmd_stripe },
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -578,6 +790,9 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_KMALLOCPROF
+	{ "kmprof",	cmd_kmprof },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -606,6 +821,9 @@ static struct {
 	{ "fs3",	writestress },
 	{ "fs4",	writestress2 },
 	{ "fs5",	createstress },
+	{ "fs6",	readwritestress },
+	{ "dsb",	dschedbench },
+	{ "stb",	stripebench },
 
 	{ NULL, NULL }
 };
@@ -1,5 +1,8 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
 #include <kern/unistd.h>
 #include <lib.h>
 #include <uio.h>
@@ -8,53 +11,298 @@
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <filetable.h>
+#include <pipe.h>
+#include "opt-A2.h"
 
-/* handler for write() system call                  */
 /*
- * n.b.
- * This implementation handles only writes to standard output 
- * and standard error, both of which go to the console.
- * Also, it does not provide any synchronization, so writes
- * are not atomic.
+ * Common code for read() and write(): move NBYTES between the user
+ * buffer UBUF and the open file at descriptor FDESC.
  *
- * You will need to improve this implementation
+ * The open file's lock is held across the transfer so that the
+ * offset is read and advanced atomically with respect to other
+ * users of the same open file (after dup2 or fork).
  */
-
+static
 int
-sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+file_rw(int fdesc, userptr_t ubuf, size_t nbytes, enum uio_rw rw,
+	int *retval)
 {
+  struct openfile *of;
   struct iovec iov;
   struct uio u;
+  struct stat st;
+  bool seekable;
   int res;
 
-  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
-  
-  /* only stdout and stderr writes are currently implemented */
-  if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
-    return EUNIMP;
+  res = filetable_get(curproc->p_filetable, fdesc, &of);
+  if (res) {
+    return res;
+  }
+
+  if ((rw == UIO_READ && of->of_accmode == O_WRONLY) ||
+      (rw == UIO_WRITE && of->of_accmode == O_RDONLY)) {
+    openfile_decref(of);
+    return EBADF;
+  }
+
+  /* the console and other character devices have no offset */
+  seekable = (VOP_TRYSEEK(of->of_vn, 0) == 0);
+
+  lock_acquire(of->of_lock);
+
+  if (rw == UIO_WRITE && of->of_append && seekable) {
+    res = VOP_STAT(of->of_vn, &st);
+    if (res) {
+      lock_release(of->of_lock);
+      openfile_decref(of);
+      return res;
+    }
+    of->of_offset = st.st_size;
   }
-  KASSERT(curproc != NULL);
-  KASSERT(curproc->console != NULL);
-  KASSERT(curproc->p_addrspace != NULL);
 
   /* set up a uio structure to refer to the user program's buffer (ubuf) */
   iov.iov_ubase = ubuf;
   iov.iov_len = nbytes;
   u.uio_iov = &iov;
   u.uio_iovcnt = 1;
-  u.uio_offset = 0;  /* not needed for the console */
+  u.uio_offset = seekable ? of->of_offset : 0;
   u.uio_resid = nbytes;
   u.uio_segflg = UIO_USERSPACE;
-  u.uio_rw = UIO_WRITE;
+  u.uio_rw = rw;
   u.uio_space = curproc->p_addrspace;
 
-  res = VOP_WRITE(curproc->console,&u);
+  if (rw == UIO_READ) {
+    res = VOP_READ(of->of_vn, &u);
+  }
+  else {
+    res = VOP_WRITE(of->of_vn, &u);
+  }
+  if (res == 0 && seekable) {
+    of->of_offset = u.uio_offset;
+  }
+
+  lock_release(of->of_lock);
+  openfile_decref(of);
+
   if (res) {
     return res;
   }
 
-  /* pass back the number of bytes actually written */
+  /* pass back the number of bytes actually transferred */
   *retval = nbytes - u.uio_resid;
   KASSERT(*retval >= 0);
   return 0;
 }
+
+/* handler for write() system call                  */
+int
+sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+
+  return file_rw(fdesc, ubuf, nbytes, UIO_WRITE, retval);
+}
+
+#if OPT_A2
+
+/* handler for read() system call */
+int
+sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: read(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+
+  return file_rw(fdesc, ubuf, nbytes, UIO_READ, retval);
+}
+
+/* handler for open() system call */
+int
+sys_open(userptr_t upath, int flags, mode_t mode, int *retval)
+{
+  struct openfile *of;
+  char *path;
+  int res;
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  res = copyinstr(upath, path, PATH_MAX, NULL);
+  if (res) {
+    kfree(path);
+    return res;
+  }
+
+  DEBUG(DB_SYSCALL,"Syscall: open(%s,%d)\n",path,flags);
+
+  res = openfile_open(path, flags, mode, &of);
+  kfree(path);
+  if (res) {
+    return res;
+  }
+
+  res = filetable_place(curproc->p_filetable, of, retval);
+  if (res) {
+    openfile_decref(of);
+    return res;
+  }
+  return 0;
+}
+
+/* handler for close() system call */
+int
+sys_close(int fdesc)
+{
+  struct openfile *of;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: close(%d)\n",fdesc);
+
+  res = filetable_remove(curproc->p_filetable, fdesc, &of);
+  if (res) {
+    return res;
+  }
+  openfile_decref(of);
+  return 0;
+}
+
+/* handler for lseek() system call */
+int
+sys_lseek(int fdesc, off_t pos, int whence, off_t *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  off_t newpos;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: lseek(%d,%lld,%d)\n",fdesc,pos,whence);
+
+  res = filetable_get(curproc->p_filetable, fdesc, &of);
+  if (res) {
+    return res;
+  }
+
+  newpos = 0;
+  lock_acquire(of->of_lock);
+  switch (whence) {
+  case SEEK_SET:
+    newpos = pos;
+    break;
+  case SEEK_CUR:
+    newpos = of->of_offset + pos;
+    break;
+  case SEEK_END:
+    res = VOP_STAT(of->of_vn, &st);
+    newpos = st.st_size + pos;
+    break;
+  default:
+    res = EINVAL;
+    break;
+  }
+  if (res == 0) {
+    /* ESPIPE for the console, EINVAL for negative positions */
+    res = VOP_TRYSEEK(of->of_vn, newpos);
+  }
+  if (res == 0) {
+    of->of_offset = newpos;
+    *retval = newpos;
+  }
+  lock_release(of->of_lock);
+
+  openfile_decref(of);
+  return res;
+}
+
+/* handler for dup2() system call */
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+  struct openfile *of, *oldof;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: dup2(%d,%d)\n",oldfd,newfd);
+
+  res = filetable_get(curproc->p_filetable, oldfd, &of);
+  if (res) {
+    return res;
+  }
+
+  if (oldfd == newfd) {
+    openfile_decref(of);
+    *retval = newfd;
+    return 0;
+  }
+
+  /* the reference from filetable_get goes into the new slot */
+  res = filetable_setfd(curproc->p_filetable, newfd, of, &oldof);
+  if (res) {
+    openfile_decref(of);
+    return res;
+  }
+  if (oldof != NULL) {
+    openfile_decref(oldof);
+  }
+
+  *retval = newfd;
+  return 0;
+}
+
+/* handler for pipe() system call */
+int
+sys_pipe(userptr_t fds, int *retval)
+{
+  struct vnode *rvn, *wvn;
+  struct openfile *rof, *wof;
+  int kfds[2];
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: pipe(%x)\n",(unsigned int)fds);
+
+  res = pipe_create(&rvn, &wvn);
+  if (res) {
+    return res;
+  }
+
+  res = openfile_fromvnode(rvn, O_RDONLY, &rof);
+  if (res) {
+    vfs_close(rvn);
+    vfs_close(wvn);
+    return res;
+  }
+  res = openfile_fromvnode(wvn, O_WRONLY, &wof);
+  if (res) {
+    openfile_decref(rof);
+    vfs_close(wvn);
+    return res;
+  }
+
+  res = filetable_place(curproc->p_filetable, rof, &kfds[0]);
+  if (res) {
+    openfile_decref(rof);
+    openfile_decref(wof);
+    return res;
+  }
+  res = filetable_place(curproc->p_filetable, wof, &kfds[1]);
+  if (res) {
+    filetable_remove(curproc->p_filetable, kfds[0], &rof);
+    openfile_decref(rof);
+    openfile_decref(wof);
+    return res;
+  }
+
+  res = copyout(kfds, fds, sizeof(kfds));
+  if (res) {
+    filetable_remove(curproc->p_filetable, kfds[0], &rof);
+    filetable_remove(curproc->p_filetable, kfds[1], &wof);
+    openfile_decref(rof);
+    openfile_decref(wof);
+    return res;
+  }
+
+  *retval = 0;
+  return 0;
+}
+
+#endif /* OPT_A2 */
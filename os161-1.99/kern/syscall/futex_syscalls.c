@@ -0,0 +1,233 @@
+/*
+ * Futexes: sleeping on a word of user memory.
+ *
+ * futex_wait(addr, val) sleeps if the word at ADDR still holds VAL;
+ * futex_wake(addr, n) wakes up to N threads sleeping on ADDR and
+ * returns how many it woke. User-level locks use them to sleep only
+ * when contended; the uncontended path never enters the kernel.
+ *
+ * A futex is identified by the address space and the virtual address
+ * of the word. Threads sleeping on one are on a wait channel that
+ * exists only while someone is asleep on it; the channels are kept
+ * in a hash table whose buckets each have a lock. Holding the bucket
+ * lock across both the check of the user's word and going to sleep
+ * is what keeps a wakeup from slipping in between; waking takes the
+ * same lock.
+ *
+ * When a multithreaded process exits, futex_wakeall turns out its
+ * sleepers so they can leave too.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <wchan.h>
+#include <current.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/* Hash buckets; a power of 2 */
+#define FUTEX_NBUCKETS	64
+
+struct futex {
+	struct addrspace *f_as;
+	vaddr_t f_addr;
+	struct wchan *f_wchan;
+	unsigned f_nsleep;		/* threads asleep or going to sleep */
+	struct futex *f_next;		/* bucket chain */
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct futex *fb_futexes;
+};
+
+static struct futex_bucket futex_table[FUTEX_NBUCKETS];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		if (futex_table[i].fb_lock == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_table[i].fb_futexes = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_bucket(struct addrspace *as, vaddr_t addr)
+{
+	uint32_t h;
+
+	h = (uint32_t)as ^ (addr >> 2);
+	h ^= h >> 11;
+	return &futex_table[h % FUTEX_NBUCKETS];
+}
+
+/* Called with the bucket lock held */
+static
+struct futex *
+futex_find(struct futex_bucket *fb, struct addrspace *as, vaddr_t addr)
+{
+	struct futex *f;
+
+	for (f = fb->fb_futexes; f != NULL; f = f->f_next) {
+		if (f->f_as == as && f->f_addr == addr) {
+			return f;
+		}
+	}
+	return NULL;
+}
+
+static
+int
+futex_check(userptr_t uaddr)
+{
+	if (((vaddr_t)uaddr & (sizeof(int) - 1)) != 0) {
+		return EINVAL;
+	}
+	if (curproc_getas() == NULL) {
+		return EFAULT;
+	}
+	return 0;
+}
+
+int
+sys_futex_wait(userptr_t uaddr, int val)
+{
+	struct addrspace *as;
+	struct futex_bucket *fb;
+	struct futex *f;
+	vaddr_t addr = (vaddr_t)uaddr;
+	int cur, result;
+
+	result = futex_check(uaddr);
+	if (result) {
+		return result;
+	}
+	as = curproc_getas();
+	fb = futex_bucket(as, addr);
+
+	lock_acquire(fb->fb_lock);
+
+	if (curproc->p_exiting) {
+		/* futex_wakeall has been through or will find us gone */
+		lock_release(fb->fb_lock);
+		return EINTR;
+	}
+
+	result = copyin(uaddr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		/* It changed already; go back and look again */
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	f = futex_find(fb, as, addr);
+	if (f == NULL) {
+		f = kmalloc(sizeof(*f));
+		if (f == NULL) {
+			lock_release(fb->fb_lock);
+			return ENOMEM;
+		}
+		f->f_wchan = wchan_create("futex");
+		if (f->f_wchan == NULL) {
+			kfree(f);
+			lock_release(fb->fb_lock);
+			return ENOMEM;
+		}
+		f->f_as = as;
+		f->f_addr = addr;
+		f->f_nsleep = 0;
+		f->f_next = fb->fb_futexes;
+		fb->fb_futexes = f;
+	}
+
+	/*
+	 * Lock the channel before letting go of the bucket, so that a
+	 * waker, which needs the bucket lock, can't get in before we
+	 * are on the channel. The waker accounts for us in f_nsleep
+	 * and frees the futex; don't touch it after waking.
+	 */
+	f->f_nsleep++;
+	wchan_lock(f->f_wchan);
+	lock_release(fb->fb_lock);
+	wchan_sleep(f->f_wchan);
+	return 0;
+}
+
+int
+sys_futex_wake(userptr_t uaddr, int n, int *retval)
+{
+	struct addrspace *as;
+	struct futex_bucket *fb;
+	struct futex *f, **fp;
+	vaddr_t addr = (vaddr_t)uaddr;
+	int woken, result;
+
+	result = futex_check(uaddr);
+	if (result) {
+		return result;
+	}
+	as = curproc_getas();
+	fb = futex_bucket(as, addr);
+
+	woken = 0;
+	lock_acquire(fb->fb_lock);
+	f = futex_find(fb, as, addr);
+	if (f != NULL) {
+		while (woken < n && f->f_nsleep > 0) {
+			wchan_wakeone(f->f_wchan);
+			f->f_nsleep--;
+			woken++;
+		}
+		if (f->f_nsleep == 0) {
+			for (fp = &fb->fb_futexes; *fp != f; fp = &(*fp)->f_next) {
+				/* nothing */
+			}
+			*fp = f->f_next;
+			wchan_destroy(f->f_wchan);
+			kfree(f);
+		}
+	}
+	lock_release(fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
+
+void
+futex_wakeall(struct addrspace *as)
+{
+	struct futex_bucket *fb;
+	struct futex *f, **fp;
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		fb = &futex_table[i];
+		lock_acquire(fb->fb_lock);
+		fp = &fb->fb_futexes;
+		while ((f = *fp) != NULL) {
+			if (f->f_as != as) {
+				fp = &f->f_next;
+				continue;
+			}
+			*fp = f->f_next;
+			wchan_wakeall(f->f_wchan);
+			wchan_destroy(f->f_wchan);
+			kfree(f);
+		}
+		lock_release(fb->fb_lock);
+	}
+}
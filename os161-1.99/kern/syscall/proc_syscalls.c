@@ -12,6 +12,7 @@
 #include <mips/trapframe.h>
 #include <vm.h>
 #include <vfs.h>
+#include <filetable.h>
 #include <kern/fcntl.h>
 #include "opt-A2.h"
 
@@ -23,17 +24,40 @@
  */
 int sys_fork(struct trapframe *tf, int* retval) 
 {
-  
+  struct proc *child_proc;
+  struct addrspace *as_new;
+  struct trapframe *tfcopy;
+  int result;
+
   // Create process structure for child process and assign PID
   // and create parent/child relationship in runprogram
-  struct proc *child_proc = proc_create_runprogram("child");
-  KASSERT(child_proc != NULL);
-  *retval = child_proc->pid;  
+  child_proc = proc_create_runprogram("child");
+  if (child_proc == NULL) {
+    return ENPROC;
+  }
 
   // Create and copy address space
-  struct addrspace *as_new;
-  as_copy(curproc_getas(),&as_new);
-  KASSERT(as_new != NULL);
+  result = as_copy(curproc_getas(), &as_new);
+  if (result) {
+    proc_discard(child_proc);
+    return ENOMEM;
+  }
+#if OPT_A3
+  // Forking from a user thread: the child runs on that thread's stack
+  result = as_stack_copy(curproc_getas(), as_new, tf->tf_sp);
+  if (result) {
+    as_destroy(as_new);
+    proc_discard(child_proc);
+    return ENOMEM;
+  }
+#endif
+
+  tfcopy = trapframe_dup(tf);
+  if (tfcopy == NULL) {
+    as_destroy(as_new);
+    proc_discard(child_proc);
+    return ENOMEM;
+  }
 
   // Link the new address space to the new process
   spinlock_acquire(&child_proc->p_lock);
@@ -41,68 +65,33 @@ int sys_fork(struct trapframe *tf, int* retval)
   spinlock_release(&child_proc->p_lock);
 
   // Create thread for child process
-  int temp;
-  struct trapframe *tfcopy = kmalloc(sizeof(struct trapframe));
-  memcpy(tfcopy, tf, sizeof(struct trapframe));
-  temp = thread_fork("some_thread",child_proc,enter_forked_process,(void *)tfcopy, 0);
-  return(0);  
+  result = thread_fork("some_thread", child_proc, enter_forked_process,
+                       (void *)tfcopy, 0);
+  if (result) {
+    trapframe_free(tfcopy);
+    child_proc->p_addrspace = NULL;
+    as_destroy(as_new);
+    proc_discard(child_proc);
+    return ENOMEM;
+  }
 
+  *retval = child_proc->pid;
+  return(0);
 }
 
 #endif /* OPT_A2 */
 
-  /* this implementation of sys__exit does not do anything with the exit code */
-  /* this needs to be fixed to get exit() and waitpid() working properly */
-
 void sys__exit(int exitcode) {
 
-  struct addrspace *as;
-  struct proc *p = curproc;
-
   DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
 
 #if OPT_A2
-
-  KASSERT(curproc->p_addrspace != NULL);
-  as_deactivate();
-  as = curproc_setas(NULL);
-  as_destroy(as);
-  p->exitcode = _MKWAIT_EXIT(exitcode);
-
-  /* detach this thread from its process */
-  /* note: curproc cannot be used after this call */
-  proc_remthread(curthread);
-
-  /* curproc becomes zombie (as popped) */
-
-  // locking
-  lock_acquire(waitlk);
-  
-  // Clearing zombie children
-  int size = p->num_child;
-  struct proc *kid;
-  for (int i = 0; i < size; i++) {
-    kid = p->children[i];
-    if (kid->p_addrspace == NULL) { // kid is a zombie
-      proc_destroy(kid);
-    }
-  }
-  // If p is an orphan, destroy
-  if (p->parent == NULL) {
-    Procs[p->pid] = NULL;
-    proc_destroy(p);
-  } else { // if p has a parent, signal waiting parent
-    cv_signal(p->procv, waitlk);
-  }
-  
-  //v_broadcast(p->procv, waitlk);
-  //proc_destroy(p);
-  // unlocking
-  lock_release(waitlk);
-
- #endif /* OPT_A2 */ 
+  proc_exit(_MKWAIT_EXIT(exitcode));
+#else
+  (void)exitcode;
   thread_exit();
-/* thread_exit() does not return, so we should never get here */
+#endif /* OPT_A2 */
+  /* proc_exit() does not return, so we should never get here */
   panic("return from thread_exit in sys_exit\n");
 }
 
@@ -121,55 +110,34 @@ sys_getpid(pid_t *retval)
 #endif /* OPT_A2 */
 }
 
-/* stub handler for waitpid() system call                */
-
+/*
+ * waitpid: PID may be a child's pid or -1 for any child. WNOHANG
+ * returns 0 at once if no such child has exited.
+ */
 int
 sys_waitpid(pid_t pid,
 	    userptr_t status,
 	    int options,
 	    pid_t *retval)
 {
-  if (options != 0) {
-    return(EINVAL);
-  }
-  
-#if OPT_A2
-
-  // initialize variables
   int exitstatus;
   int result;
-  struct proc *cproc = Procs[pid];
- 
- if (cproc == NULL) { // such proc does not exist
-    return ESRCH;
- }
-
- if (cproc->parent != curproc) { // proc called on is not interested
-  return ECHILD;
- }
-
- // locking
- lock_acquire(waitlk);
-
- while (cproc->p_addrspace != NULL) {
-  cv_wait(cproc->procv, waitlk);
- }
-
- // unlocking
- lock_release(waitlk);
-
- exitstatus = cproc->exitcode;
- proc_destroy(cproc);
 
+#if OPT_A2
 
- result = copyout((void *)&exitstatus,status,sizeof(int));
- if (result) {
-    return(result);
- }
- *retval = pid;
- return(0);
+  result = proc_wait(pid, options, &exitstatus, retval);
+  if (result) {
+    return result;
+  }
+  if (*retval == 0 || status == NULL) {
+    return 0;
+  }
+  return copyout((void *)&exitstatus,status,sizeof(int));
 
 #else
+  if (options != 0) {
+    return(EINVAL);
+  }
   /* for now, just pretend the exitstatus is 0 */
   exitstatus = 0;
   result = copyout((void *)&exitstatus,status,sizeof(int));
@@ -183,80 +151,193 @@ sys_waitpid(pid_t pid,
 
 #if OPT_A2
 
-/* execv replaces currently executing program with a newly loaded program image. Process id remains unchanged.
- * Path of the program is passed in as progname. Arguments to the program args is an array of NULL terminated
- * strings. The array is terminated by a NULL ptr. In the new usr program, argv[argc] == NULL.
+/*
+ * Program loading and argument passing, shared by execv and spawn.
  */
-int
-sys_execv(char *progname, char ** args)
+
+/*
+ * An argument vector in transit. argv_copyin packs the strings, with
+ * their terminators, back to back at the start of ab_buf, which holds
+ * ARG_MAX bytes. argv_copyout then writes the argv array after them
+ * in the same buffer and copies the whole block to the new stack with
+ * one copyout:
+ *
+ *      stackptr -> strings, padded to a word
+ *                  argv[0..argc-1], NULL
+ *                  (8-byte alignment padding)
+ *      old stackptr
+ *
+ * So ARG_MAX bounds the strings and the pointers together.
+ */
+struct argblock {
+  char *ab_buf;
+  size_t ab_len;                  /* bytes of strings */
+  int ab_argc;
+};
+
+/*
+ * ARG_MAX buffers are 16 pages, which is a lot to find free and
+ * contiguous on every exec; keep a few around once allocated.
+ */
+#define ARGBUF_POOLSIZE 2
+
+static struct spinlock argbuf_lock = SPINLOCK_INITIALIZER;
+static char *argbuf_pool[ARGBUF_POOLSIZE];
+static unsigned argbuf_npool;
+
+static char *
+argbuf_get(void)
 {
+  char *buf = NULL;
 
-  if (progname == NULL) {
-    return EFAULT;
+  spinlock_acquire(&argbuf_lock);
+  if (argbuf_npool > 0) {
+    buf = argbuf_pool[--argbuf_npool];
   }
+  spinlock_release(&argbuf_lock);
 
-  struct addrspace *as;
-  struct vnode *v;
-  vaddr_t entrypoint, stackptr;
+  if (buf == NULL) {
+    buf = kmalloc(ARG_MAX);
+  }
+  return buf;
+}
+
+static void
+argbuf_put(char *buf)
+{
+  spinlock_acquire(&argbuf_lock);
+  if (argbuf_npool < ARGBUF_POOLSIZE) {
+    argbuf_pool[argbuf_npool++] = buf;
+    buf = NULL;
+  }
+  spinlock_release(&argbuf_lock);
+
+  if (buf != NULL) {
+    kfree(buf);
+  }
+}
+
+/* Release the buffer from argv_copyin */
+static void
+argv_free(struct argblock *ab)
+{
+  argbuf_put(ab->ab_buf);
+  ab->ab_buf = NULL;
+}
+
+/*
+ * Copy the user's argument vector UARGV into the kernel. Both the
+ * array and the strings are fetched with copyin/copyinstr, so bad
+ * pointers give EFAULT. Returns E2BIG if the strings and the argv
+ * array together won't fit in ARG_MAX.
+ */
+static int
+argv_copyin(userptr_t uargv, struct argblock *ab)
+{
+  userptr_t uarg;
+  size_t actual;
   int result;
-  size_t actual; // I have no idea what this shit does
-  int total_arg_size = 0;
 
-  // Count the number of arguments
-  int num_args = 0;
-  while (args[num_args] != NULL) {
-    num_args++;
+  if (uargv == NULL) {
+    return EFAULT;
   }
-  //kprintf("number of argument is: %d \n", num_args);
 
-  // check for limit
-  if (num_args > ARG_MAX) {
-        return E2BIG;
+  ab->ab_buf = argbuf_get();
+  if (ab->ab_buf == NULL) {
+    return ENOMEM;
   }
+  ab->ab_len = 0;
+  ab->ab_argc = 0;
+
+  while (1) {
+    result = copyin(uargv, &uarg, sizeof(uarg));
+    if (result) {
+      goto fail;
+    }
+    if (uarg == NULL) {
+      break;
+    }
+    uargv += sizeof(uarg);
 
-  // Copy args into the kernel
-  char **kargs = kmalloc(sizeof(char*) * num_args);
-  for (int i = 0; i < num_args; i++) {
-    int size = strlen(args[i]) + 1; // did not forget the \n
-    if (size % 4) { 
-      total_arg_size += ROUNDUP(size,4);
-    } else {
-      total_arg_size += size;
+    /* Leave room for argv[0..argc] after the strings */
+    if (ab->ab_len + (ab->ab_argc + 2) * sizeof(userptr_t) + 4 > ARG_MAX) {
+      result = E2BIG;
+      goto fail;
     }
-    kargs[i] = kmalloc(sizeof(char*) * size);
-    result = copyinstr((userptr_t)args[i], kargs[i], ARG_MAX, &actual);
+    result = copyinstr(uarg, ab->ab_buf + ab->ab_len,
+                       ARG_MAX - 4 - ab->ab_len -
+                       (ab->ab_argc + 2) * sizeof(userptr_t),
+                       &actual);
+    if (result == ENAMETOOLONG) {
+      result = E2BIG;
+    }
+    if (result) {
+      goto fail;
+    }
+    ab->ab_len += actual;
+    ab->ab_argc++;
   }
+  return 0;
 
-  // Copy progname into the kernel
-  char *pname = kmalloc(sizeof(char) * NAME_MAX);
-  result = copyinstr((userptr_t)progname, pname, NAME_MAX, &actual);
+ fail:
+  argv_free(ab);
+  return result;
+}
 
-  if (result) {
-      kfree(pname);
-      return result;
+/*
+ * Lay out the arguments below *STACKPTR in the current address space
+ * and copy them there. On return *STACKPTR is the new stack pointer
+ * and *ARGV the user address of argv.
+ */
+static int
+argv_copyout(struct argblock *ab, vaddr_t *stackptr, userptr_t *argv)
+{
+  userptr_t *uargs;
+  size_t argsoff, total, pos;
+  vaddr_t base;
+  int i, result;
+
+  argsoff = ROUNDUP(ab->ab_len, sizeof(userptr_t));
+  total = argsoff + (ab->ab_argc + 1) * sizeof(userptr_t);
+  KASSERT(total <= ARG_MAX);
+  base = (*stackptr - total) & ~(vaddr_t)7;
+
+  /* Fill in argv, pointing at where each string will land */
+  bzero(ab->ab_buf + ab->ab_len, argsoff - ab->ab_len);
+  uargs = (userptr_t *)(ab->ab_buf + argsoff);
+  pos = 0;
+  for (i = 0; i < ab->ab_argc; i++) {
+    uargs[i] = (userptr_t)(base + pos);
+    pos += strlen(ab->ab_buf + pos) + 1;
   }
+  uargs[ab->ab_argc] = NULL;
 
-  /* ------------ runprogram cpy ----------- */
-  /* Open the file. */
-  result = vfs_open(pname, O_RDONLY, 0, &v);
+  result = copyout(ab->ab_buf, (userptr_t)base, total);
   if (result) {
-    kfree(pname);
     return result;
   }
 
-  // Pop the current as
-  as = curproc->p_addrspace;
-  curproc->p_addrspace = NULL;
-  as_destroy(as);
+  *stackptr = base;
+  *argv = (userptr_t)(base + argsoff);
+  return 0;
+}
+
+/*
+ * Load the executable V into a new address space, make it the
+ * current process's, and set up its stack. The current process must
+ * not have an address space. The caller closes V.
+ */
+static int
+load_program(struct vnode *v, vaddr_t *entrypoint, vaddr_t *stackptr)
+{
+  struct addrspace *as;
+  int result;
 
-  /* We should be a new process. */
   KASSERT(curproc_getas() == NULL);
 
   /* Create a new address space. */
   as = as_create();
-  if (as ==NULL) {
-    vfs_close(v);
-    kfree(pname);
+  if (as == NULL) {
     return ENOMEM;
   }
 
@@ -265,65 +346,226 @@ sys_execv(char *progname, char ** args)
   as_activate();
 
   /* Load the executable. */
-  result = load_elf(v, &entrypoint);
+  result = load_elf(v, entrypoint);
   if (result) {
     /* p_addrspace will go away when curproc is destroyed */
-    vfs_close(v);
-    kfree(pname);
     return result;
   }
 
-  /* Done with the file now. */
-  vfs_close(v);
-  /* ------------------------SETTING UP THE AS---------------------------*/
   /* Define the user stack in the address space */
-  result = as_define_stack(as, &stackptr);
-  if (result) {
-    /* p_addrspace will go away when curproc is destroyed */
-    kfree(pname);
-    return result;
-  }
+  return as_define_stack(as, stackptr);
+}
 
-  // Array of address of the args, to be passed onto the user as
-  char **user_args_addr = kmalloc(sizeof(char*) * num_args + 1);
-  user_args_addr[num_args] = NULL;
+/* execv replaces currently executing program with a newly loaded program image. Process id remains unchanged.
+ * Path of the program is passed in as progname. Arguments to the program args is an array of NULL terminated
+ * strings. The array is terminated by a NULL ptr. In the new usr program, argv[argc] == NULL.
+ *
+ * The other threads of a multithreaded process would be left running
+ * in an address space that is gone, so that is refused with EBUSY.
+ * p_execing keeps new threads from being created until the new image
+ * is in place.
+ */
+int
+sys_execv(userptr_t progname, userptr_t args)
+{
+  struct addrspace *as;
+  struct vnode *v;
+  struct argblock ab;
+  vaddr_t entrypoint, stackptr;
+  userptr_t argv;
+  char *pname;
+  int result;
 
-  // Copy arguments into user stack
-  stackptr -= total_arg_size;
-  for (int i = 0; i < num_args; i++) {
-    int size = strlen(kargs[i]) + 1;
-    if (size % 4) {
-      size = ROUNDUP(size, 4);
-    } 
-    user_args_addr[i] = (char *)stackptr;
-    copyoutstr(kargs[i], (userptr_t)stackptr, size, &actual);
-    stackptr += size;
+  lock_acquire(curproc->p_waitlock);
+  if (curproc->p_nthreads != 1) {
+    lock_release(curproc->p_waitlock);
+    return EBUSY;
   }
-  // get space for the array of ptrs to the args
-  stackptr = stackptr - total_arg_size - (sizeof(char*) * (1 + num_args));
-  for (int i = 0; i < num_args + 1; i++) {
-      copyout(user_args_addr + i, (userptr_t)stackptr, sizeof(char *));
-      stackptr += sizeof(char *);
+  curproc->p_execing = true;
+  lock_release(curproc->p_waitlock);
+
+  result = argv_copyin(args, &ab);
+  if (result) {
+    goto fail;
   }
-  // reset stackptr
-  stackptr -= sizeof(char*) * (1 + num_args);
 
-  // cleanup
+  // Copy progname into the kernel
+  pname = kmalloc(PATH_MAX);
+  if (pname == NULL) {
+    argv_free(&ab);
+    result = ENOMEM;
+    goto fail;
+  }
+  result = copyinstr(progname, pname, PATH_MAX, NULL);
+  if (result == 0) {
+    /* Open the file. */
+    result = vfs_open(pname, O_RDONLY, 0, &v);
+  }
   kfree(pname);
-  kfree(user_args_addr);
-  for (int i = 0; i < num_args; i++) {
-    kfree(kargs[i]);
+  if (result) {
+    argv_free(&ab);
+    goto fail;
   }
-  kfree(kargs);
+
+  // Pop the current as
+  as = curproc->p_addrspace;
+  curproc->p_addrspace = NULL;
+  as_destroy(as);
+  /* A syscall ring was in the old image */
+  curproc->p_ring = NULL;
+  curproc->p_ringentries = 0;
+
+  result = load_program(v, &entrypoint, &stackptr);
+  /* Done with the file now. */
+  vfs_close(v);
+  if (result == 0) {
+    result = argv_copyout(&ab, &stackptr, &argv);
+  }
+  argv_free(&ab);
+  if (result) {
+    goto fail;
+  }
+
+  lock_acquire(curproc->p_waitlock);
+  curproc->p_execing = false;
+  lock_release(curproc->p_waitlock);
 
   /* Warp to user mode. */
-  enter_new_process(num_args /*argc*/, (userptr_t)stackptr /*userspace addr of argv*/,
-        stackptr, entrypoint);
-  /* ------------------------SETTING UP THE AS---------------------------*/ 
+  enter_new_process(ab.ab_argc, argv, stackptr, entrypoint);
   /* enter_new_process does not return. */
-  panic("enter_newg_process returned\n");
+  panic("enter_new_process returned\n");
   return EINVAL;
+
+ fail:
+  lock_acquire(curproc->p_waitlock);
+  curproc->p_execing = false;
+  lock_release(curproc->p_waitlock);
+  return result;
 }
 
-#endif // OPT_A2
+/*
+ * spawn: fork and execv in one step. The child process starts with
+ * no address space; its first thread loads the program into a fresh
+ * one, so nothing of the parent's is copied. The parent waits for
+ * the load so that errors (no such file, bad executable, E2BIG) come
+ * back from spawn itself rather than as the child's exit status.
+ */
+struct spawn_args {
+  struct vnode *sa_vnode;         /* the program, opened by the parent */
+  struct argblock sa_args;
+  struct semaphore *sa_done;      /* V'd when the child has loaded */
+  int sa_result;
+};
+
+/*
+ * First function run by the child's thread.
+ */
+static void
+spawn_enter(void *data, unsigned long unused)
+{
+  struct spawn_args *sa = data;
+  struct addrspace *as;
+  vaddr_t entrypoint, stackptr;
+  userptr_t argv;
+  int argc = sa->sa_args.ab_argc;
+  int result;
+
+  (void)unused;
+
+  result = load_program(sa->sa_vnode, &entrypoint, &stackptr);
+  if (result == 0) {
+    result = argv_copyout(&sa->sa_args, &stackptr, &argv);
+  }
+  sa->sa_result = result;
+
+  if (result) {
+    /* Detach completely; the parent destroys the process */
+    as_deactivate();
+    as = curproc_setas(NULL);
+    if (as != NULL) {
+      as_destroy(as);
+    }
+    proc_remthread(curthread);
+    V(sa->sa_done);
+    thread_exit();
+  }
+
+  /* The parent owns *sa again once we V */
+  V(sa->sa_done);
+  enter_new_process(argc, argv, stackptr, entrypoint);
+  panic("enter_new_process returned\n");
+}
+
+int
+sys_spawn(userptr_t progname, userptr_t args, pid_t *retval)
+{
+  struct spawn_args sa;
+  struct proc *child;
+  char *pname;
+  size_t actual;
+  pid_t pid;
+  int result;
+
+  result = argv_copyin(args, &sa.sa_args);
+  if (result) {
+    return result;
+  }
+
+  pname = kmalloc(PATH_MAX);
+  if (pname == NULL) {
+    argv_free(&sa.sa_args);
+    return ENOMEM;
+  }
+  result = copyinstr(progname, pname, PATH_MAX, &actual);
+  if (result == 0) {
+    result = vfs_open(pname, O_RDONLY, 0, &sa.sa_vnode);
+  }
+  kfree(pname);
+  if (result) {
+    argv_free(&sa.sa_args);
+    return result;
+  }
+
+  sa.sa_done = sem_create("spawn", 0);
+  if (sa.sa_done == NULL) {
+    result = ENOMEM;
+    goto fail;
+  }
+
+  child = proc_create_runprogram(sa.sa_args.ab_argc > 0 ?
+                                 sa.sa_args.ab_buf : "child");
+  if (child == NULL) {
+    result = ENOMEM;
+    goto fail;
+  }
+  pid = child->pid;
 
+  result = thread_fork("spawn", child, spawn_enter, &sa, 0);
+  if (result) {
+    proc_discard(child);
+    goto fail;
+  }
+
+  P(sa.sa_done);
+  result = sa.sa_result;
+  if (result) {
+    proc_discard(child);
+    goto fail;
+  }
+
+  sem_destroy(sa.sa_done);
+  vfs_close(sa.sa_vnode);
+  argv_free(&sa.sa_args);
+  *retval = pid;
+  return 0;
+
+ fail:
+  if (sa.sa_done != NULL) {
+    sem_destroy(sa.sa_done);
+  }
+  vfs_close(sa.sa_vnode);
+  argv_free(&sa.sa_args);
+  return result;
+}
+
+#endif // OPT_A2
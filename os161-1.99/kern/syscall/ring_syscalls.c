@@ -0,0 +1,208 @@
+/*
+ * Batched system calls: ring_setup and ring_submit. See <kern/ring.h>
+ * for how the ring is laid out and used.
+ *
+ * The ring is ordinary user memory, reached with copyin and copyout.
+ * Entries are moved in and out a batch at a time, so a submit of n
+ * requests costs one trap and a few copies on top of the calls
+ * themselves. Only the kernel writes r_sqhead and r_cqtail; they are
+ * written back once, at the end of the submit.
+ *
+ * If two threads submit on the same ring at once, they may run the
+ * same requests twice; that is up to the program to avoid.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/ring.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#if OPT_A2
+
+/* Entries copied in (and completions copied out) at a time */
+#define RING_BATCH	8
+
+int
+sys_ring_setup(userptr_t ring, unsigned nentries)
+{
+	struct proc *p = curproc;
+	struct ring hdr;
+	char last;
+	int result;
+
+	if (ring == NULL) {
+		/* Unregister */
+		p->p_ring = NULL;
+		p->p_ringentries = 0;
+		return 0;
+	}
+	if (nentries == 0 || nentries > RING_MAXENTRIES ||
+	    (nentries & (nentries - 1)) != 0 ||
+	    ((vaddr_t)ring & (sizeof(uint32_t) - 1)) != 0) {
+		return EINVAL;
+	}
+
+	/* Make sure it's all there, and start it out empty */
+	result = copyin((const_userptr_t)ring + RING_BYTES(nentries) - 1,
+			&last, 1);
+	if (result) {
+		return result;
+	}
+	bzero(&hdr, sizeof(hdr));
+	hdr.r_nentries = nentries;
+	result = copyout(&hdr, ring, sizeof(hdr));
+	if (result) {
+		return result;
+	}
+
+	p->p_ring = ring;
+	p->p_ringentries = nentries;
+	return 0;
+}
+
+/*
+ * Run one request.
+ */
+static
+void
+ring_run(const struct ring_sqe *sqe, struct ring_cqe *cqe)
+{
+	pid_t pid;
+	int result, retval = 0;
+
+	switch (sqe->sqe_op) {
+	    case RING_OP_NOP:
+		result = 0;
+		break;
+	    case RING_OP_WRITE:
+		result = sys_write(sqe->sqe_fd, (userptr_t)sqe->sqe_addr,
+				   sqe->sqe_len, &retval);
+		break;
+	    case RING_OP_READ:
+		result = sys_read(sqe->sqe_fd, (userptr_t)sqe->sqe_addr,
+				  sqe->sqe_len, &retval);
+		break;
+	    case RING_OP_GETPID:
+		result = sys_getpid(&pid);
+		retval = pid;
+		break;
+	    case RING_OP_TIME:
+		result = sys___time((userptr_t)sqe->sqe_addr,
+				    (userptr_t)sqe->sqe_addr2);
+		break;
+	    default:
+		result = ENOSYS;
+		break;
+	}
+
+	cqe->cqe_res = result ? -result : retval;
+	cqe->cqe_data = sqe->sqe_data;
+}
+
+static
+unsigned
+ring_min(unsigned a, unsigned b)
+{
+	return a < b ? a : b;
+}
+
+int
+sys_ring_submit(unsigned n, int *retval)
+{
+	struct proc *p = curproc;
+	userptr_t ring = p->p_ring;
+	unsigned nentries = p->p_ringentries;
+	unsigned mask = nentries - 1;
+	struct ring hdr;
+	struct ring_sqe sqes[RING_BATCH];
+	struct ring_cqe cqes[RING_BATCH];
+	uint32_t pending, room;
+	unsigned batch, i, done;
+	int result;
+
+	if (ring == NULL) {
+		return EINVAL;
+	}
+	result = copyin(ring, &hdr, sizeof(hdr));
+	if (result) {
+		return result;
+	}
+
+	done = 0;
+	while (done < n) {
+		pending = hdr.r_sqtail - hdr.r_sqhead;
+		room = nentries - (hdr.r_cqtail - hdr.r_cqhead);
+		if (pending > nentries || room > nentries) {
+			/* The process has scribbled on the indexes */
+			result = EINVAL;
+			break;
+		}
+
+		/* Don't run past the end of either array */
+		batch = ring_min(n - done, ring_min(pending, room));
+		batch = ring_min(batch, RING_BATCH);
+		batch = ring_min(batch, nentries - (hdr.r_sqhead & mask));
+		batch = ring_min(batch, nentries - (hdr.r_cqtail & mask));
+		if (batch == 0) {
+			break;
+		}
+
+		result = copyin(ring + RING_SQOFF(nentries) +
+				(hdr.r_sqhead & mask) * sizeof(sqes[0]),
+				sqes, batch * sizeof(sqes[0]));
+		if (result) {
+			break;
+		}
+		for (i=0; i<batch; i++) {
+			ring_run(&sqes[i], &cqes[i]);
+		}
+
+		/*
+		 * The requests have run, whether or not their
+		 * completions can be posted, so they must not be run
+		 * again by the next submit.
+		 */
+		hdr.r_sqhead += batch;
+		done += batch;
+
+		result = copyout(cqes, ring + RING_CQOFF(nentries) +
+				 (hdr.r_cqtail & mask) * sizeof(cqes[0]),
+				 batch * sizeof(cqes[0]));
+		if (result) {
+			/* Their completions are lost */
+			break;
+		}
+		hdr.r_cqtail += batch;
+	}
+
+	/*
+	 * If something went wrong after some requests ran, report
+	 * those; the error will come up again on the next submit.
+	 */
+	if (done == 0) {
+		*retval = 0;
+		return result;
+	}
+
+	result = copyout((const void *)&hdr.r_sqhead,
+			 (userptr_t)&((struct ring *)ring)->r_sqhead,
+			 sizeof(hdr.r_sqhead));
+	if (result) {
+		return result;
+	}
+	result = copyout((const void *)&hdr.r_cqtail,
+			 (userptr_t)&((struct ring *)ring)->r_cqtail,
+			 sizeof(hdr.r_cqtail));
+	if (result) {
+		return result;
+	}
+
+	*retval = done;
+	return 0;
+}
+
+#endif /* OPT_A2 */
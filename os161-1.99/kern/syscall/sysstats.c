@@ -0,0 +1,341 @@
+/*
+ * System call statistics. See sysstats.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/syscall.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <sysstats.h>
+
+struct sysstats {
+	struct sysstat ss_calls[SYSSTATS_NCALLS];
+	unsigned ss_cpu;		/* Number of the CPU these belong to */
+	struct sysstats *ss_next;	/* Registry linkage */
+};
+
+/*
+ * All CPUs' statistics. CPUs are never destroyed, so once the list
+ * head has been read the list can be walked without the lock.
+ */
+static struct spinlock sysstats_lock = SPINLOCK_INITIALIZER;
+static struct sysstats *sysstats_all;
+
+/* Names for printing; calls not listed print as numbers */
+static const char *const sysstats_names[SYSSTATS_NCALLS] = {
+	[SYS_fork]              = "fork",
+	[SYS_vfork]             = "vfork",
+	[SYS_execv]             = "execv",
+	[SYS__exit]             = "_exit",
+	[SYS_waitpid]           = "waitpid",
+	[SYS_getpid]            = "getpid",
+	[SYS_getppid]           = "getppid",
+	[SYS_sbrk]              = "sbrk",
+	[SYS_mmap]              = "mmap",
+	[SYS_munmap]            = "munmap",
+	[SYS_mprotect]          = "mprotect",
+	[SYS_umask]             = "umask",
+	[SYS_issetugid]         = "issetugid",
+	[SYS_getresuid]         = "getresuid",
+	[SYS_setresuid]         = "setresuid",
+	[SYS_getresgid]         = "getresgid",
+	[SYS_setresgid]         = "setresgid",
+	[SYS_getgroups]         = "getgroups",
+	[SYS_setgroups]         = "setgroups",
+	[SYS___getlogin]        = "__getlogin",
+	[SYS___setlogin]        = "__setlogin",
+	[SYS_kill]              = "kill",
+	[SYS_sigaction]         = "sigaction",
+	[SYS_sigpending]        = "sigpending",
+	[SYS_sigprocmask]       = "sigprocmask",
+	[SYS_sigsuspend]        = "sigsuspend",
+	[SYS_sigreturn]         = "sigreturn",
+	[SYS_open]              = "open",
+	[SYS_pipe]              = "pipe",
+	[SYS_dup]               = "dup",
+	[SYS_dup2]              = "dup2",
+	[SYS_close]             = "close",
+	[SYS_read]              = "read",
+	[SYS_pread]             = "pread",
+	[SYS_getdirentry]       = "getdirentry",
+	[SYS_write]             = "write",
+	[SYS_pwrite]            = "pwrite",
+	[SYS_lseek]             = "lseek",
+	[SYS_flock]             = "flock",
+	[SYS_ftruncate]         = "ftruncate",
+	[SYS_fsync]             = "fsync",
+	[SYS_fcntl]             = "fcntl",
+	[SYS_ioctl]             = "ioctl",
+	[SYS_select]            = "select",
+	[SYS_poll]              = "poll",
+	[SYS_link]              = "link",
+	[SYS_remove]            = "remove",
+	[SYS_mkdir]             = "mkdir",
+	[SYS_rmdir]             = "rmdir",
+	[SYS_mkfifo]            = "mkfifo",
+	[SYS_rename]            = "rename",
+	[SYS_access]            = "access",
+	[SYS_chdir]             = "chdir",
+	[SYS_fchdir]            = "fchdir",
+	[SYS___getcwd]          = "__getcwd",
+	[SYS_symlink]           = "symlink",
+	[SYS_readlink]          = "readlink",
+	[SYS_mount]             = "mount",
+	[SYS_unmount]           = "unmount",
+	[SYS_stat]              = "stat",
+	[SYS_fstat]             = "fstat",
+	[SYS_lstat]             = "lstat",
+	[SYS_utimes]            = "utimes",
+	[SYS_futimes]           = "futimes",
+	[SYS_lutimes]           = "lutimes",
+	[SYS_chmod]             = "chmod",
+	[SYS_chown]             = "chown",
+	[SYS_fchmod]            = "fchmod",
+	[SYS_fchown]            = "fchown",
+	[SYS_lchmod]            = "lchmod",
+	[SYS_lchown]            = "lchown",
+	[SYS_socket]            = "socket",
+	[SYS_bind]              = "bind",
+	[SYS_connect]           = "connect",
+	[SYS_listen]            = "listen",
+	[SYS_accept]            = "accept",
+	[SYS_shutdown]          = "shutdown",
+	[SYS_getsockname]       = "getsockname",
+	[SYS_getpeername]       = "getpeername",
+	[SYS_getsockopt]        = "getsockopt",
+	[SYS_setsockopt]        = "setsockopt",
+	[SYS___time]            = "__time",
+	[SYS___settime]         = "__settime",
+	[SYS_nanosleep]         = "nanosleep",
+	[SYS_sync]              = "sync",
+	[SYS_reboot]            = "reboot",
+	[SYS_msync]             = "msync",
+	[SYS_spawn]             = "spawn",
+	[SYS_futex_wait]        = "futex_wait",
+	[SYS_futex_wake]        = "futex_wake",
+	[SYS___thread_create]   = "__thread_create",
+	[SYS_thread_exit]       = "thread_exit",
+	[SYS_thread_join]       = "thread_join",
+	[SYS_ring_setup]        = "ring_setup",
+	[SYS_ring_submit]       = "ring_submit",
+	[SYS_sysstats]          = "sysstats",
+};
+
+void
+sysstats_cpuinit(struct cpu *c)
+{
+	struct sysstats *ss;
+
+	ss = kmalloc(sizeof(*ss));
+	if (ss == NULL) {
+		panic("sysstats_cpuinit: Out of memory\n");
+	}
+	bzero(ss->ss_calls, sizeof(ss->ss_calls));
+	ss->ss_cpu = c->c_number;
+
+	spinlock_acquire(&sysstats_lock);
+	ss->ss_next = sysstats_all;
+	sysstats_all = ss;
+	spinlock_release(&sysstats_lock);
+
+	c->c_sysstats = ss;
+}
+
+static
+struct sysstats *
+sysstats_first(void)
+{
+	struct sysstats *ss;
+
+	spinlock_acquire(&sysstats_lock);
+	ss = sysstats_all;
+	spinlock_release(&sysstats_lock);
+	return ss;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Recording
+//
+// The counters are only written by their own CPU. Interrupts are
+// off while updating them so that a thread switch can't move us to
+// another CPU halfway through, or interleave another call's update.
+
+void
+sysstats_enter(int callno, time_t *secs, uint32_t *nsecs)
+{
+	int spl;
+
+	if (callno >= 0 && callno < SYSSTATS_NCALLS) {
+		spl = splhigh();
+		curcpu->c_sysstats->ss_calls[callno].ss_count++;
+		splx(spl);
+	}
+	gettime(secs, nsecs);
+}
+
+/*
+ * Histogram bucket for a latency: floor(log2(ns)).
+ */
+static
+unsigned
+sysstats_bucket(uint64_t ns)
+{
+	unsigned b;
+
+	for (b = 0; ns > 1 && b < SYSSTATS_NBUCKETS - 1; b++) {
+		ns >>= 1;
+	}
+	return b;
+}
+
+void
+sysstats_exit(int callno, time_t secs, uint32_t nsecs)
+{
+	struct sysstat *st;
+	time_t nowsecs;
+	uint32_t nownsecs;
+	uint64_t ns;
+	int spl;
+
+	if (callno < 0 || callno >= SYSSTATS_NCALLS) {
+		return;
+	}
+
+	gettime(&nowsecs, &nownsecs);
+	getinterval(secs, nsecs, nowsecs, nownsecs, &nowsecs, &nownsecs);
+	ns = (uint64_t)nowsecs * 1000000000 + nownsecs;
+
+	spl = splhigh();
+	st = &curcpu->c_sysstats->ss_calls[callno];
+	st->ss_totalns += ns;
+	st->ss_hist[sysstats_bucket(ns)]++;
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reporting
+
+void
+sysstats_get(unsigned callno, struct sysstat *ret)
+{
+	struct sysstats *ss;
+	const struct sysstat *st;
+	unsigned i;
+
+	KASSERT(callno < SYSSTATS_NCALLS);
+
+	bzero(ret, sizeof(*ret));
+	for (ss = sysstats_first(); ss != NULL; ss = ss->ss_next) {
+		st = &ss->ss_calls[callno];
+		ret->ss_count += st->ss_count;
+		ret->ss_totalns += st->ss_totalns;
+		for (i=0; i<SYSSTATS_NBUCKETS; i++) {
+			ret->ss_hist[i] += st->ss_hist[i];
+		}
+	}
+}
+
+void
+sysstats_reset(void)
+{
+	struct sysstats *ss;
+
+	for (ss = sysstats_first(); ss != NULL; ss = ss->ss_next) {
+		bzero(ss->ss_calls, sizeof(ss->ss_calls));
+	}
+}
+
+/* Width of the longest histogram bar */
+#define SYSSTATS_BARWIDTH 40
+
+/*
+ * Print the count and mean latency of every call that has been made,
+ * with its latency histogram, and the number of calls on each CPU.
+ */
+void
+sysstats_print(void)
+{
+	struct sysstats *ss;
+	struct sysstat st;
+	unsigned callno, i, j, nret, maxhist, total;
+	uint64_t avgns, lowns;
+
+	for (callno=0; callno<SYSSTATS_NCALLS; callno++) {
+		sysstats_get(callno, &st);
+		if (st.ss_count == 0) {
+			continue;
+		}
+
+		nret = maxhist = 0;
+		for (i=0; i<SYSSTATS_NBUCKETS; i++) {
+			nret += st.ss_hist[i];
+			if (st.ss_hist[i] > maxhist) {
+				maxhist = st.ss_hist[i];
+			}
+		}
+		avgns = nret > 0 ? st.ss_totalns / nret : 0;
+
+		if (sysstats_names[callno] != NULL) {
+			kprintf("%-16s", sysstats_names[callno]);
+		}
+		else {
+			kprintf("#%-15u", callno);
+		}
+		kprintf(" %u calls, avg %u.%03u us\n", st.ss_count,
+			(unsigned)(avgns / 1000), (unsigned)(avgns % 1000));
+
+		for (i=0; i<SYSSTATS_NBUCKETS; i++) {
+			if (st.ss_hist[i] == 0) {
+				continue;
+			}
+			lowns = (uint64_t)1 << i;
+			kprintf("    >= %7u.%03u us %8u ",
+				(unsigned)(lowns / 1000),
+				(unsigned)(lowns % 1000), st.ss_hist[i]);
+			for (j=0; j < (uint64_t)st.ss_hist[i] *
+				     SYSSTATS_BARWIDTH / maxhist; j++) {
+				kprintf("*");
+			}
+			kprintf("\n");
+		}
+	}
+
+	for (ss = sysstats_first(); ss != NULL; ss = ss->ss_next) {
+		total = 0;
+		for (callno=0; callno<SYSSTATS_NCALLS; callno++) {
+			total += ss->ss_calls[callno].ss_count;
+		}
+		kprintf("cpu%u: %u calls\n", ss->ss_cpu, total);
+	}
+}
+
+/*
+ * sysstats system call: copy out the totals for call numbers 0 up
+ * to N-1 (or as many as there are) and return how many there are.
+ */
+int
+sys_sysstats(userptr_t buf, unsigned n, int *retval)
+{
+	struct sysstat st;
+	unsigned callno;
+	int result;
+
+	for (callno=0; callno<n && callno<SYSSTATS_NCALLS; callno++) {
+		sysstats_get(callno, &st);
+		result = copyout(&st, buf + callno * sizeof(st), sizeof(st));
+		if (result) {
+			return result;
+		}
+	}
+	*retval = SYSSTATS_NCALLS;
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * User thread system calls: __thread_create, thread_exit, and
+ * thread_join.
+ *
+ * A new thread shares its creator's address space and open files and
+ * gets a stack of its own from the VM system (as_stack_alloc). It
+ * starts from a copy of the creator's trapframe with the PC, stack
+ * pointer and first two arguments replaced, through the same path as
+ * a forked child. Who is running and who has exited is kept in
+ * proc.c.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <mips/trapframe.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#if OPT_A3
+
+/*
+ * Room left above the initial stack pointer: the callee may store
+ * its register arguments in the caller's frame.
+ */
+#define THREAD_ARGSAVE	16
+
+/*
+ * First code run by a new thread.
+ */
+static
+void
+uthread_enter(void *tf, unsigned long ut)
+{
+	proc_uthread_start((struct uthread *)ut);
+	enter_forked_process(tf, 0);
+}
+
+int
+sys___thread_create(struct trapframe *tf, userptr_t entry, userptr_t arg0,
+		    userptr_t arg1, int *retval)
+{
+	struct addrspace *as = curproc_getas();
+	struct trapframe *ntf;
+	struct uthread *ut;
+	vaddr_t stack;
+	int tid, result;
+
+	lock_acquire(as->as_lock);
+	result = as_stack_alloc(as, &stack);
+	lock_release(as->as_lock);
+	if (result) {
+		return result;
+	}
+
+	ntf = trapframe_dup(tf);
+	if (ntf == NULL) {
+		result = ENOMEM;
+	}
+	else {
+		/* enter_forked_process steps over a syscall instruction */
+		ntf->tf_epc = (vaddr_t)entry - 4;
+		ntf->tf_a0 = (vaddr_t)arg0;
+		ntf->tf_a1 = (vaddr_t)arg1;
+		ntf->tf_sp = stack - THREAD_ARGSAVE;
+		ntf->tf_ra = 0;
+
+		result = proc_uthread_add(stack, &ut);
+		if (result == 0) {
+			/* It may be joined and gone before thread_fork returns */
+			tid = ut->ut_tid;
+			result = thread_fork(curthread->t_name, curproc,
+					     uthread_enter, ntf,
+					     (unsigned long)ut);
+			if (result == 0) {
+				*retval = tid;
+				return 0;
+			}
+			proc_uthread_undo(ut);
+		}
+		trapframe_free(ntf);
+	}
+
+	lock_acquire(as->as_lock);
+	as_stack_free(as, stack);
+	lock_release(as->as_lock);
+	return result;
+}
+
+void
+sys_thread_exit(int code)
+{
+	proc_uthread_exit(code);
+	panic("return from proc_uthread_exit\n");
+}
+
+int
+sys_thread_join(int tid, userptr_t code)
+{
+	int ucode, result;
+
+	result = proc_uthread_join(tid, &ucode);
+	if (result) {
+		return result;
+	}
+	if (code != NULL) {
+		result = copyout(&ucode, code, sizeof(ucode));
+	}
+	return result;
+}
+
+#endif /* OPT_A3 */
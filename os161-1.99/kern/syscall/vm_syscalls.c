@@ -0,0 +1,149 @@
+/*
+ * Memory system calls: sbrk, and mmap, munmap, msync.
+ *
+ * The work is done in the VM system (as_sbrk and vm/mmap.c); these
+ * check the arguments, find the file, and hold the address space
+ * lock while the layout changes. munmap and msync write to files,
+ * which can't be done with that lock held, so vm/mmap.c takes it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <synch.h>
+#include <vnode.h>
+#include <filetable.h>
+#include <mmap.h>
+#include <syscall.h>
+
+#if OPT_A3
+
+int
+sys_sbrk(intptr_t amount, int32_t *retval)
+{
+	struct addrspace *as = curproc_getas();
+	vaddr_t oldbreak;
+	int result;
+
+	lock_acquire(as->as_lock);
+	result = as_sbrk(as, amount, &oldbreak);
+	lock_release(as->as_lock);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)oldbreak;
+	return 0;
+}
+
+/*
+ * The address hint is ignored; mappings always go where mmap_map
+ * puts them. MAP_FIXED is not supported.
+ */
+int
+sys_mmap(vaddr_t addr, size_t len, int prot, int flags, int fd,
+	 off_t offset, int32_t *retval)
+{
+	struct addrspace *as;
+	struct openfile *of;
+	bool shared;
+	vaddr_t base;
+	int result;
+
+	(void)addr;
+
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+		return EINVAL;
+	}
+	if (flags == MAP_SHARED) {
+		shared = true;
+	}
+	else if (flags == MAP_PRIVATE) {
+		shared = false;
+	}
+	else {
+		return EINVAL;
+	}
+	if (len > MMAP_TOP) {
+		return ENOMEM;
+	}
+
+	as = curproc_getas();
+	result = filetable_get(curproc->p_filetable, fd, &of);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * The file must be readable to fill in the pages, and writable
+	 * if changes are to be written back to it.
+	 */
+	if (of->of_accmode == O_WRONLY ||
+	    (shared && (prot & PROT_WRITE) && of->of_accmode != O_RDWR)) {
+		openfile_decref(of);
+		return EACCES;
+	}
+
+	result = VOP_MMAP(of->of_vn);
+	if (result) {
+		openfile_decref(of);
+		return ENODEV;
+	}
+
+	lock_acquire(as->as_lock);
+	result = mmap_map(as, of->of_vn, offset,
+			  ROUNDUP(len, PAGE_SIZE) / PAGE_SIZE,
+			  prot, shared, &base);
+	lock_release(as->as_lock);
+	openfile_decref(of);
+	if (result) {
+		return result;
+	}
+
+	*retval = (int32_t)base;
+	return 0;
+}
+
+int
+sys_munmap(vaddr_t addr, size_t len)
+{
+	struct addrspace *as = curproc_getas();
+
+	if (addr % PAGE_SIZE != 0 || len == 0 ||
+	    addr >= USERSPACETOP || len > USERSPACETOP - addr) {
+		return EINVAL;
+	}
+	return mmap_unmap(as, addr, ROUNDUP(len, PAGE_SIZE) / PAGE_SIZE);
+}
+
+/*
+ * Writes are synchronous whatever the flags say, and there is no
+ * other copy of the pages to invalidate.
+ */
+int
+sys_msync(vaddr_t addr, size_t len, int flags)
+{
+	struct addrspace *as = curproc_getas();
+
+	if (addr % PAGE_SIZE != 0 ||
+	    addr >= USERSPACETOP || len > USERSPACETOP - addr) {
+		return EINVAL;
+	}
+	if ((flags & ~(MS_SYNC | MS_ASYNC | MS_INVALIDATE)) != 0 ||
+	    ((flags & MS_SYNC) && (flags & MS_ASYNC))) {
+		return EINVAL;
+	}
+	if (len == 0) {
+		return 0;
+	}
+	return mmap_sync(as, addr, ROUNDUP(len, PAGE_SIZE) / PAGE_SIZE);
+}
+
+#endif /* OPT_A3 */
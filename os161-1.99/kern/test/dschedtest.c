@@ -0,0 +1,144 @@
+/*
+ * dsb - disk scheduler benchmark
+ *
+ * For each disk scheduling policy in turn, runs the fs2 and fs3
+ * workloads together on a mounted filesystem, with a few more
+ * threads reading random sectors from the raw device underneath to
+ * keep the request queue deep, and then prints the request latency
+ * statistics the scheduler collected.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <disksched.h>
+#include <test.h>
+
+/* Number of threads doing random raw reads */
+#define NRAWTHREADS 4
+
+static struct semaphore *dsb_sem = NULL;
+static volatile bool dsb_stop;
+
+static
+void
+dsb_rawthread(void *dev, unsigned long num)
+{
+	char name[32];
+	char buf[512];
+	struct vnode *vn;
+	struct stat st;
+	struct iovec iov;
+	struct uio ku;
+	uint32_t nblocks, block;
+	int err;
+
+	snprintf(name, sizeof(name), "%sraw:", (const char *)dev);
+	err = vfs_open(name, O_RDONLY, 0, &vn);
+	if (err) {
+		kprintf("dsb: thread %lu: %s: %s\n", num, name, strerror(err));
+		V(dsb_sem);
+		return;
+	}
+
+	err = VOP_STAT(vn, &st);
+	if (err || st.st_blksize != sizeof(buf)) {
+		kprintf("dsb: thread %lu: %s: unexpected block size\n",
+			num, name);
+		vfs_close(vn);
+		V(dsb_sem);
+		return;
+	}
+	nblocks = st.st_size / st.st_blksize;
+
+	while (!dsb_stop) {
+		block = random() % nblocks;
+		uio_kinit(&iov, &ku, buf, sizeof(buf),
+			  (off_t)block * sizeof(buf), UIO_READ);
+		err = VOP_READ(vn, &ku);
+		if (err) {
+			kprintf("dsb: thread %lu: read error: %s\n",
+				num, strerror(err));
+			break;
+		}
+	}
+
+	vfs_close(vn);
+	V(dsb_sem);
+}
+
+int
+dschedbench(int nargs, char **args)
+{
+	struct disksched *ds;
+	const char *policy;
+	char oldpolicy[16];
+	char device[32];
+	char *fsargs[2];
+	unsigned n;
+	int i, err;
+
+	if (nargs != 2) {
+		kprintf("Usage: dsb device\n");
+		return EINVAL;
+	}
+
+	/* Allow (but do not require) colon after device name */
+	snprintf(device, sizeof(device), "%s", args[1]);
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	ds = disksched_lookup(device);
+	if (ds == NULL) {
+		kprintf("dsb: %s has no disk scheduler\n", device);
+		return ENODEV;
+	}
+
+	if (dsb_sem == NULL) {
+		dsb_sem = sem_create("dsb", 0);
+		if (dsb_sem == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	strcpy(oldpolicy, disksched_policyname(ds));
+
+	for (n=0; (policy = disksched_policy(n)) != NULL; n++) {
+		kprintf("*** dsb: %s with %s\n", device, policy);
+
+		disksched_setpolicy(ds, policy);
+		disksched_resetstats(ds);
+
+		dsb_stop = false;
+		for (i=0; i<NRAWTHREADS; i++) {
+			err = thread_fork("dsb", NULL, dsb_rawthread,
+					  device, i);
+			if (err) {
+				panic("dsb: thread_fork failed: %s\n",
+				      strerror(err));
+			}
+		}
+
+		fsargs[0] = (char *)"fs6";
+		fsargs[1] = device;
+		readwritestress(2, fsargs);
+
+		dsb_stop = true;
+		for (i=0; i<NRAWTHREADS; i++) {
+			P(dsb_sem);
+		}
+
+		disksched_printstats(ds);
+	}
+
+	disksched_setpolicy(ds, oldpolicy);
+	return 0;
+}
@@ -403,6 +403,54 @@ dowritestress(const char *filesys)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * The read stress and write stress workloads at the same time, so
+ * the disk sees requests from many threads at once.
+ */
+static
+void
+doreadwritestress(const char *filesys)
+{
+	int i, err;
+
+	init_threadsem();
+
+	kprintf("*** Starting fs read/write stress test on %s:\n", filesys);
+
+	if (fstest_write(filesys, "", 1, 0)) {
+		kprintf("*** Test failed\n");
+		return;
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		err = thread_fork("readstress", NULL,
+				  readstress_thread, (char *)filesys, i);
+		if (err) {
+			panic("readwritestress: thread_fork failed: %s\n",
+			      strerror(err));
+		}
+		err = thread_fork("writestress", NULL,
+				  writestress_thread, (char *)filesys, i);
+		if (err) {
+			panic("readwritestress: thread_fork failed: %s\n",
+			      strerror(err));
+		}
+	}
+
+	for (i=0; i<2*NTHREADS; i++) {
+		P(threadsem);
+	}
+
+	if (fstest_remove(filesys, "")) {
+		kprintf("*** Test failed\n");
+		return;
+	}
+
+	kprintf("*** fs read/write stress test done\n");
+}
+
+////////////////////////////////////////////////////////////
+
 static
 void
 writestress2_thread(void *fs, unsigned long num)
@@ -544,7 +592,7 @@ checkfilesystem(int nargs, char **args)
 	char *device;
 
 	if (nargs != 2) {
-		kprintf("Usage: fs[12345] filesystem:\n");
+		kprintf("Usage: fs[123456] filesystem:\n");
 		return EINVAL;
 	}
 
@@ -576,6 +624,7 @@ DEFTEST(readstress);
 DEFTEST(writestress);
 DEFTEST(writestress2);
 DEFTEST(createstress);
+DEFTEST(readwritestress);
 
 ////////////////////////////////////////////////////////////
 
@@ -0,0 +1,115 @@
+/*
+ * stb - striping benchmark
+ *
+ * Writes the same amount of data sequentially to the start of each
+ * raw device named and reports the throughput of each, so a stripe
+ * can be compared against one of its member disks. This overwrites
+ * whatever was on the devices.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <clock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <test.h>
+
+/* Total written to each device */
+#define STB_BYTES	(1024*1024)
+
+/* Size of each write */
+#define STB_CHUNK	(32*1024)
+
+static
+int
+stb_write(const char *dev, char *buf)
+{
+	char name[64];
+	struct vnode *vn;
+	struct stat st;
+	struct iovec iov;
+	struct uio ku;
+	time_t ssecs, esecs;
+	uint32_t snsecs, ensecs;
+	uint64_t us;
+	off_t pos;
+	int result;
+
+	snprintf(name, sizeof(name) - 4, "%s", dev);
+	if (name[strlen(name)-1] == ':') {
+		name[strlen(name)-1] = 0;
+	}
+	strcat(name, "raw:");
+
+	result = vfs_open(name, O_WRONLY, 0, &vn);
+	if (result) {
+		kprintf("stb: %s: %s\n", name, strerror(result));
+		return result;
+	}
+	result = VOP_STAT(vn, &st);
+	if (result == 0 && st.st_size < STB_BYTES) {
+		result = ENOSPC;
+	}
+	if (result) {
+		kprintf("stb: %s: %s\n", name, strerror(result));
+		vfs_close(vn);
+		return result;
+	}
+
+	gettime(&ssecs, &snsecs);
+	for (pos = 0; pos < STB_BYTES; pos += STB_CHUNK) {
+		uio_kinit(&iov, &ku, buf, STB_CHUNK, pos, UIO_WRITE);
+		result = VOP_WRITE(vn, &ku);
+		if (result) {
+			kprintf("stb: %s: write: %s\n", name, strerror(result));
+			vfs_close(vn);
+			return result;
+		}
+	}
+	gettime(&esecs, &ensecs);
+	vfs_close(vn);
+
+	getinterval(ssecs, snsecs, esecs, ensecs, &esecs, &ensecs);
+	us = (uint64_t)esecs * 1000000 + ensecs / 1000;
+	if (us == 0) {
+		us = 1;
+	}
+
+	kprintf("stb: %-8s %u KB in %lu.%09lu s, %u KB/s\n", dev,
+		STB_BYTES / 1024, (unsigned long) esecs,
+		(unsigned long) ensecs,
+		(unsigned)((uint64_t)STB_BYTES * 1000000 / 1024 / us));
+	return 0;
+}
+
+int
+stripebench(int nargs, char **args)
+{
+	char *buf;
+	int i, result;
+
+	if (nargs < 2) {
+		kprintf("Usage: stb device [device...]\n");
+		return EINVAL;
+	}
+
+	buf = kmalloc(STB_CHUNK);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<STB_CHUNK; i++) {
+		buf[i] = (char)i;
+	}
+
+	result = 0;
+	for (i=1; i<nargs && result == 0; i++) {
+		result = stb_write(args[i], buf);
+	}
+
+	kfree(buf);
+	return result;
+}
@@ -48,8 +48,12 @@
 #include <current.h>
 #include <synch.h>
 #include <addrspace.h>
+#include <vm.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <kmemcache.h>
+#include <sysstats.h>
+#include <uio.h>
 
 #include "opt-synchprobs.h"
 
@@ -72,6 +76,16 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Where thread structures come from. */
+static struct kmem_cache *thread_cache;
+
+/*
+ * Number of destroyed threads each CPU keeps, with their stacks, on
+ * c_freethreads so thread_fork can reuse them without going to
+ * kmalloc for a new stack.
+ */
+#define THREAD_FREEMAX 8
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -123,14 +137,31 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	/*
+	 * Prefer a thread off this CPU's free list, which comes with
+	 * a stack. The boot CPU's first thread is created before
+	 * curcpu exists, and must not get a stack anyway.
+	 */
+	thread = NULL;
+	if (CURCPU_EXISTS()) {
+		int spl = splhigh();
+		thread = threadlist_remhead(&curcpu->c_freethreads);
+		splx(spl);
+	}
 	if (thread == NULL) {
-		return NULL;
+		thread = kmem_cache_alloc(thread_cache);
+		if (thread == NULL) {
+			return NULL;
+		}
+		thread->t_stack = NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		if (thread->t_stack != NULL) {
+			kfree(thread->t_stack);
+		}
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -139,7 +170,7 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
+	/* t_stack was set above */
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -179,7 +210,10 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_freethreads);
 	c->c_hardclocks = 0;
+	c->c_sysstats = NULL;
+	c->c_iostats = NULL;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -193,6 +227,8 @@ cpu_create(unsigned hardware_number)
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	sysstats_cpuinit(c);
+	iostats_cpuinit(c);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -212,11 +248,15 @@ cpu_create(unsigned hardware_number)
 		 * make it possible to free the boot stack?)
 		 */
 		/*c->c_curthread->t_stack = ... */
+		KASSERT(c->c_curthread->t_stack == NULL);
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		/* The thread may have come with a stack */
 		if (c->c_curthread->t_stack == NULL) {
-			panic("cpu_create: couldn't allocate stack");
+			c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+			if (c->c_curthread->t_stack == NULL) {
+				panic("cpu_create: couldn't allocate stack");
+			}
 		}
 		thread_checkstack_init(c->c_curthread);
 	}
@@ -249,9 +289,6 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
@@ -259,7 +296,28 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	thread->t_name = NULL;
+
+	/*
+	 * Keep the thread and its stack for reuse if there's room on
+	 * this CPU's free list. Check the stack first; the thread
+	 * that ran on it may have overflowed it. thread_fork re-arms
+	 * the magic numbers.
+	 */
+	if (thread->t_stack != NULL) {
+		int spl;
+
+		thread_checkstack(thread);
+		spl = splhigh();
+		if (curcpu->c_freethreads.tl_count < THREAD_FREEMAX) {
+			threadlist_addhead(&curcpu->c_freethreads, thread);
+			splx(spl);
+			return;
+		}
+		splx(spl);
+		kfree(thread->t_stack);
+	}
+	kmem_cache_free(thread_cache, thread);
 }
 
 /*
@@ -351,6 +409,12 @@ thread_bootstrap(void)
 
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 NULL);
+	if (thread_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -492,11 +556,13 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	/* Allocate a stack, unless the thread was recycled with one */
 	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -635,7 +701,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/* Do any VM housekeeping before going to sleep */
+			if (!vm_idle()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -1162,6 +1231,20 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+void
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i;
+	struct cpu *c;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+		}
+	}
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -0,0 +1,540 @@
+/*
+ * Pipes. See pipe.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <proc.h>
+#include <pipe.h>
+
+struct pipe {
+	struct lock *p_lock;		/* protects everything below */
+	struct cv *p_readcv;		/* data or EOF has arrived */
+	struct cv *p_writecv;		/* space has been made */
+	char *p_buf;			/* PIPE_SIZE bytes */
+	unsigned p_head;		/* next byte to read */
+	unsigned p_count;		/* bytes buffered */
+	unsigned p_rwaiting;		/* readers asleep on p_readcv */
+	unsigned p_wwaiting;		/* writers asleep on p_writecv */
+	bool p_readopen;		/* read end still exists */
+	bool p_writeopen;		/* write end still exists */
+	struct vnode p_readvn;
+	struct vnode p_writevn;
+	struct pipe *p_nextpipe;	/* pipe_all; under pipe_listlock */
+	struct pipe **p_prevpipe;
+};
+
+/* All pipes, so pipe_wakeall can find their sleepers */
+static struct lock *pipe_listlock;
+static struct pipe *pipe_all;
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	lock_acquire(pipe_listlock);
+	*p->p_prevpipe = p->p_nextpipe;
+	if (p->p_nextpipe != NULL) {
+		p->p_nextpipe->p_prevpipe = p->p_prevpipe;
+	}
+	lock_release(pipe_listlock);
+
+	cv_destroy(p->p_writecv);
+	cv_destroy(p->p_readcv);
+	lock_destroy(p->p_lock);
+	kfree(p->p_buf);
+	kfree(p);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Data transfer
+
+/*
+ * Move up to LEN bytes between the ring and UIO, starting at ring
+ * offset POS, in at most two pieces.
+ */
+static
+int
+pipe_move(struct pipe *p, unsigned pos, unsigned len, struct uio *uio)
+{
+	unsigned first;
+	int result;
+
+	pos %= PIPE_SIZE;
+	first = PIPE_SIZE - pos;
+	if (first > len) {
+		first = len;
+	}
+	result = uiomove(p->p_buf + pos, first, uio);
+	if (result == 0 && len > first) {
+		result = uiomove(p->p_buf, len - first, uio);
+	}
+	return result;
+}
+
+static
+void
+pipe_wakewriters(struct pipe *p)
+{
+	if (p->p_wwaiting > 0 && PIPE_SIZE - p->p_count >= PIPE_WAKESPACE) {
+		cv_broadcast(p->p_writecv, p->p_lock);
+	}
+}
+
+static
+void
+pipe_wakereaders(struct pipe *p)
+{
+	if (p->p_rwaiting > 0 && p->p_count > 0) {
+		cv_broadcast(p->p_readcv, p->p_lock);
+	}
+}
+
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned len;
+	size_t resid;
+	int result;
+
+	KASSERT(v == &p->p_readvn);
+
+	lock_acquire(p->p_lock);
+	while (p->p_count == 0 && p->p_writeopen && uio->uio_resid > 0) {
+		if (proc_exiting()) {
+			lock_release(p->p_lock);
+			return EINTR;
+		}
+		p->p_rwaiting++;
+		cv_wait(p->p_readcv, p->p_lock);
+		p->p_rwaiting--;
+	}
+
+	len = p->p_count;
+	if (len > uio->uio_resid) {
+		len = uio->uio_resid;
+	}
+	resid = uio->uio_resid;
+	result = pipe_move(p, p->p_head, len, uio);
+	/* On a fault, keep whatever got through */
+	len = resid - uio->uio_resid;
+	p->p_head = (p->p_head + len) % PIPE_SIZE;
+	p->p_count -= len;
+
+	pipe_wakewriters(p);
+	lock_release(p->p_lock);
+	return result;
+}
+
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	bool atomic;
+	unsigned need, len;
+	size_t start, resid;
+	int result = 0;
+
+	KASSERT(v == &p->p_writevn);
+
+	atomic = uio->uio_resid <= PIPE_BUF;
+	start = uio->uio_resid;
+
+	lock_acquire(p->p_lock);
+	while (uio->uio_resid > 0) {
+		if (!p->p_readopen) {
+			break;
+		}
+
+		need = atomic ? uio->uio_resid : 1;
+		if (PIPE_SIZE - p->p_count < need) {
+			if (proc_exiting()) {
+				result = EINTR;
+				break;
+			}
+			/* Let readers at what's there, then wait */
+			pipe_wakereaders(p);
+			p->p_wwaiting++;
+			cv_wait(p->p_writecv, p->p_lock);
+			p->p_wwaiting--;
+			continue;
+		}
+
+		len = PIPE_SIZE - p->p_count;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		resid = uio->uio_resid;
+		result = pipe_move(p, p->p_head + p->p_count, len, uio);
+		p->p_count += resid - uio->uio_resid;
+		if (result) {
+			break;
+		}
+	}
+
+	pipe_wakereaders(p);
+	lock_release(p->p_lock);
+
+	if (uio->uio_resid == start && result == 0 && start > 0) {
+		/* Nobody to read it */
+		return EPIPE;
+	}
+	/* A short count if the reader went away partway */
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Other vnode operations
+
+static
+int
+pipe_open(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	/* Pipes can't be opened by name */
+	return EINVAL;
+}
+
+static
+int
+pipe_close(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * The last reference to one end has gone. Let the other side know,
+ * and free the pipe when both ends are gone.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool last;
+
+	lock_acquire(p->p_lock);
+	if (v == &p->p_readvn) {
+		p->p_readopen = false;
+		/* Writers get EPIPE */
+		cv_broadcast(p->p_writecv, p->p_lock);
+	}
+	else {
+		KASSERT(v == &p->p_writevn);
+		p->p_writeopen = false;
+		/* Readers get EOF */
+		cv_broadcast(p->p_readcv, p->p_lock);
+	}
+	last = !p->p_readopen && !p->p_writeopen;
+	lock_release(p->p_lock);
+
+	VOP_CLEANUP(v);
+	if (last) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+static
+int
+pipe_nope(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	pipe_gettype(v, &statbuf->st_mode);
+	statbuf->st_mode |= 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_BUF;
+
+	lock_acquire(p->p_lock);
+	statbuf->st_size = p->p_count;
+	lock_release(p->p_lock);
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return ENODEV;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *dir, char *pathname, struct vnode **result)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *dir, char *pathname, struct vnode **result,
+		char *namebuf, size_t buflen)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	(void)namebuf;
+	(void)buflen;
+	return ENOTDIR;
+}
+
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_nope,    /* readlink */
+	pipe_nope,    /* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_nope,    /* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,  /* remove */
+	pipe_nameop,  /* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+////////////////////////////////////////////////////////////
+//
+// Creation
+
+void
+pipe_bootstrap(void)
+{
+	pipe_listlock = lock_create("pipelist");
+	if (pipe_listlock == NULL) {
+		panic("pipe_bootstrap: Out of memory\n");
+	}
+	pipe_all = NULL;
+}
+
+/*
+ * Wake every sleeper on every pipe. Those whose process is exiting
+ * give up with EINTR; the rest find nothing has changed and go back
+ * to sleep. This only happens when a multithreaded process exits.
+ */
+void
+pipe_wakeall(void)
+{
+	struct pipe *p;
+
+	lock_acquire(pipe_listlock);
+	for (p = pipe_all; p != NULL; p = p->p_nextpipe) {
+		lock_acquire(p->p_lock);
+		if (p->p_rwaiting > 0) {
+			cv_broadcast(p->p_readcv, p->p_lock);
+		}
+		if (p->p_wwaiting > 0) {
+			cv_broadcast(p->p_writecv, p->p_lock);
+		}
+		lock_release(p->p_lock);
+	}
+	lock_release(pipe_listlock);
+}
+
+int
+pipe_create(struct vnode **readend, struct vnode **writeend)
+{
+	struct pipe *p;
+
+	p = kmalloc(sizeof(*p));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(PIPE_SIZE);
+	p->p_lock = lock_create("pipe");
+	p->p_readcv = cv_create("piperead");
+	p->p_writecv = cv_create("pipewrite");
+	if (p->p_buf == NULL || p->p_lock == NULL ||
+	    p->p_readcv == NULL || p->p_writecv == NULL) {
+		if (p->p_writecv != NULL) {
+			cv_destroy(p->p_writecv);
+		}
+		if (p->p_readcv != NULL) {
+			cv_destroy(p->p_readcv);
+		}
+		if (p->p_lock != NULL) {
+			lock_destroy(p->p_lock);
+		}
+		if (p->p_buf != NULL) {
+			kfree(p->p_buf);
+		}
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_head = 0;
+	p->p_count = 0;
+	p->p_rwaiting = 0;
+	p->p_wwaiting = 0;
+	p->p_readopen = true;
+	p->p_writeopen = true;
+
+	lock_acquire(pipe_listlock);
+	p->p_nextpipe = pipe_all;
+	p->p_prevpipe = &pipe_all;
+	if (pipe_all != NULL) {
+		pipe_all->p_prevpipe = &p->p_nextpipe;
+	}
+	pipe_all = p;
+	lock_release(pipe_listlock);
+
+	VOP_INIT(&p->p_readvn, &pipe_vnode_ops, NULL, p);
+	VOP_INIT(&p->p_writevn, &pipe_vnode_ops, NULL, p);
+
+	/* As if vfs_open had been called on each */
+	VOP_INCOPEN(&p->p_readvn);
+	VOP_INCOPEN(&p->p_writevn);
+
+	*readend = &p->p_readvn;
+	*writeend = &p->p_writevn;
+	return 0;
+}
@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <pipe.h>
 
 /*
  * Structure for a single named device.
@@ -110,6 +111,7 @@ vfs_bootstrap(void)
 	vfs_biglock_depth = 0;
 
 	devnull_create();
+	pipe_bootstrap();
 }
 
 /*
@@ -499,6 +501,27 @@ findmount(const char *devname, struct knowndev **result)
 	return found ? 0 : ENODEV;
 }
 
+/*
+ * Check that DEVNAME is a mountable device with nothing mounted on
+ * it, for things like formatting that would pull the disk out from
+ * under a mounted filesystem. The answer only holds while the caller
+ * keeps holding vfs_biglock.
+ */
+int
+vfs_checkunmounted(const char *devname)
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+	result = findmount(devname, &kd);
+	if (result == 0 && kd->kd_fs != NULL) {
+		result = EBUSY;
+	}
+	vfs_biglock_release();
+	return result;
+}
+
 /*
  * Mount a filesystem. Once we've found the device, call MOUNTFUNC to
  * set up the filesystem and hand back a struct fs.
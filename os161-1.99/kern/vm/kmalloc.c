@@ -31,6 +31,9 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <vm.h>
+#include <kmemcache.h>
+#include <kmallocprof.h>
+#include "opt-kmallocprof.h"
 
 /*
  * Kernel malloc.
@@ -345,6 +348,8 @@ kheap_printstats(void)
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	kmem_cache_printstats();
 }
 
 ////////////////////////////////////////
@@ -601,6 +606,8 @@ subpage_kfree(void *ptr)
 void *
 kmalloc(size_t sz)
 {
+	void *ptr;
+
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
@@ -612,10 +619,16 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 
-		return (void *)address;
+		ptr = (void *)address;
+	}
+	else {
+		ptr = subpage_kmalloc(sz);
 	}
 
-	return subpage_kmalloc(sz);
+#if OPT_KMALLOCPROF
+	kmprof_alloc(ptr, sz, __builtin_return_address(0));
+#endif
+	return ptr;
 }
 
 void
@@ -626,7 +639,11 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#if OPT_KMALLOCPROF
+	kmprof_free(ptr);
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
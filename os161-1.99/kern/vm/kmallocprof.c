@@ -0,0 +1,324 @@
+/*
+ * kmalloc allocation-site profiling. See kmallocprof.h.
+ *
+ * Live blocks are kept in a static table of records, hashed by block
+ * address, with the links stored as 16-bit indexes to keep it small.
+ * The table is static because it can't come from kmalloc itself.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <kmallocprof.h>
+
+/* Live blocks tracked at once */
+#define KMP_NRECS	2048
+/* Hash buckets; must be a power of 2 */
+#define KMP_NBUCKETS	512
+/* Distinct call sites reported */
+#define KMP_NSITES	256
+/* Sites printed in each top list */
+#define KMP_NTOP	10
+
+#define KMP_NONE	0xffff
+
+struct kmp_rec {
+	vaddr_t r_ptr;
+	vaddr_t r_caller;
+	uint32_t r_size;
+	uint32_t r_seq;			/* allocation sequence number */
+	uint16_t r_next;		/* hash chain, or free list */
+};
+
+struct kmp_site {
+	vaddr_t s_caller;
+	int32_t s_bytes;		/* signed for diffs */
+	int32_t s_count;
+	uint32_t s_oldest;		/* lowest live r_seq */
+};
+
+static struct spinlock kmp_lock = SPINLOCK_INITIALIZER;
+static struct kmp_rec kmp_recs[KMP_NRECS];
+static uint16_t kmp_buckets[KMP_NBUCKETS];
+static uint16_t kmp_freelist;
+static bool kmp_ready;
+static uint32_t kmp_seq;		/* allocations seen */
+static uint32_t kmp_untracked;		/* live blocks with no record */
+
+/*
+ * Per-site totals, used only by the report functions, which are run
+ * from the menu one at a time.
+ */
+static struct kmp_site kmp_cur[KMP_NSITES];
+static unsigned kmp_ncur;
+static struct kmp_site kmp_snap[KMP_NSITES];
+static unsigned kmp_nsnap;
+static bool kmp_havesnap;
+static struct kmp_site kmp_delta[KMP_NSITES * 2];
+
+static
+unsigned
+kmp_hash(vaddr_t ptr)
+{
+	return ((ptr >> 4) ^ (ptr >> 12)) & (KMP_NBUCKETS - 1);
+}
+
+/* Called with kmp_lock held */
+static
+void
+kmp_init(void)
+{
+	unsigned i;
+
+	for (i=0; i<KMP_NBUCKETS; i++) {
+		kmp_buckets[i] = KMP_NONE;
+	}
+	for (i=0; i<KMP_NRECS; i++) {
+		kmp_recs[i].r_next = (i + 1 < KMP_NRECS) ? i + 1 : KMP_NONE;
+	}
+	kmp_freelist = 0;
+	kmp_ready = true;
+}
+
+void
+kmprof_alloc(void *ptr, size_t size, const void *caller)
+{
+	struct kmp_rec *r;
+	unsigned ix, b;
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&kmp_lock);
+	if (!kmp_ready) {
+		kmp_init();
+	}
+	kmp_seq++;
+	ix = kmp_freelist;
+	if (ix == KMP_NONE) {
+		kmp_untracked++;
+		spinlock_release(&kmp_lock);
+		return;
+	}
+	r = &kmp_recs[ix];
+	kmp_freelist = r->r_next;
+
+	r->r_ptr = (vaddr_t)ptr;
+	r->r_caller = (vaddr_t)caller;
+	r->r_size = size;
+	r->r_seq = kmp_seq;
+	b = kmp_hash(r->r_ptr);
+	r->r_next = kmp_buckets[b];
+	kmp_buckets[b] = ix;
+	spinlock_release(&kmp_lock);
+}
+
+void
+kmprof_free(void *ptr)
+{
+	uint16_t *ixp;
+	struct kmp_rec *r;
+
+	spinlock_acquire(&kmp_lock);
+	if (!kmp_ready) {
+		spinlock_release(&kmp_lock);
+		return;
+	}
+	for (ixp = &kmp_buckets[kmp_hash((vaddr_t)ptr)]; *ixp != KMP_NONE;
+	     ixp = &kmp_recs[*ixp].r_next) {
+		r = &kmp_recs[*ixp];
+		if (r->r_ptr == (vaddr_t)ptr) {
+			uint16_t ix = *ixp;
+
+			*ixp = r->r_next;
+			r->r_next = kmp_freelist;
+			kmp_freelist = ix;
+			spinlock_release(&kmp_lock);
+			return;
+		}
+	}
+	/* Not found: it was allocated while the table was full */
+	if (kmp_untracked > 0) {
+		kmp_untracked--;
+	}
+	spinlock_release(&kmp_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reports
+
+static
+struct kmp_site *
+kmp_findsite(struct kmp_site *sites, unsigned *nsites, unsigned max,
+	     vaddr_t caller)
+{
+	unsigned i;
+
+	for (i=0; i<*nsites; i++) {
+		if (sites[i].s_caller == caller) {
+			return &sites[i];
+		}
+	}
+	if (*nsites >= max) {
+		return NULL;
+	}
+	sites[i].s_caller = caller;
+	sites[i].s_bytes = 0;
+	sites[i].s_count = 0;
+	sites[i].s_oldest = 0;
+	(*nsites)++;
+	return &sites[i];
+}
+
+/*
+ * Total up the live records by site into kmp_cur. Hands back the
+ * overall totals.
+ */
+static
+void
+kmp_collect(uint32_t *totbytes, uint32_t *totcount, uint32_t *untracked,
+	    uint32_t *seq)
+{
+	struct kmp_rec *r;
+	struct kmp_site *site;
+	unsigned b, ix;
+
+	*totbytes = *totcount = 0;
+	kmp_ncur = 0;
+
+	spinlock_acquire(&kmp_lock);
+	for (b=0; kmp_ready && b<KMP_NBUCKETS; b++) {
+		for (ix = kmp_buckets[b]; ix != KMP_NONE; ix = r->r_next) {
+			r = &kmp_recs[ix];
+			*totbytes += r->r_size;
+			(*totcount)++;
+			site = kmp_findsite(kmp_cur, &kmp_ncur, KMP_NSITES,
+					    r->r_caller);
+			if (site == NULL) {
+				/* Too many sites; leave it out */
+				continue;
+			}
+			site->s_bytes += r->r_size;
+			site->s_count++;
+			if (site->s_oldest == 0 || r->r_seq < site->s_oldest) {
+				site->s_oldest = r->r_seq;
+			}
+		}
+	}
+	*untracked = kmp_untracked;
+	*seq = kmp_seq;
+	spinlock_release(&kmp_lock);
+}
+
+/* Insertion sort, largest first, by bytes or by count */
+static
+void
+kmp_sort(struct kmp_site *sites, unsigned n, bool bycount)
+{
+	struct kmp_site tmp;
+	unsigned i, j;
+	int32_t key;
+
+	for (i=1; i<n; i++) {
+		tmp = sites[i];
+		key = bycount ? tmp.s_count : tmp.s_bytes;
+		for (j=i; j>0; j--) {
+			if ((bycount ? sites[j-1].s_count : sites[j-1].s_bytes)
+			    >= key) {
+				break;
+			}
+			sites[j] = sites[j-1];
+		}
+		sites[j] = tmp;
+	}
+}
+
+static
+void
+kmp_printsites(const char *title, struct kmp_site *sites, unsigned n)
+{
+	unsigned i;
+
+	kprintf("%s:\n", title);
+	kprintf("    %-10s %9s %7s %8s\n", "site", "bytes", "blocks", "oldest");
+	for (i=0; i<n; i++) {
+		kprintf("    0x%08lx %9d %7d %8u\n",
+			(unsigned long)sites[i].s_caller,
+			sites[i].s_bytes, sites[i].s_count,
+			sites[i].s_oldest);
+	}
+}
+
+void
+kmprof_print(void)
+{
+	uint32_t bytes, count, untracked, seq;
+
+	kmp_collect(&bytes, &count, &untracked, &seq);
+	kprintf("kmalloc: %u live blocks, %u bytes, from %u sites; "
+		"%u allocations so far, %u blocks untracked\n",
+		count, bytes, kmp_ncur, seq, untracked);
+
+	kmp_sort(kmp_cur, kmp_ncur, false);
+	kmp_printsites("Top sites by bytes", kmp_cur,
+		       kmp_ncur < KMP_NTOP ? kmp_ncur : KMP_NTOP);
+	kmp_sort(kmp_cur, kmp_ncur, true);
+	kmp_printsites("Top sites by blocks", kmp_cur,
+		       kmp_ncur < KMP_NTOP ? kmp_ncur : KMP_NTOP);
+}
+
+void
+kmprof_snapshot(void)
+{
+	uint32_t bytes, count, untracked, seq;
+
+	kmp_collect(&bytes, &count, &untracked, &seq);
+	memcpy(kmp_snap, kmp_cur, kmp_ncur * sizeof(kmp_cur[0]));
+	kmp_nsnap = kmp_ncur;
+	kmp_havesnap = true;
+	kprintf("kmalloc: snapshot of %u sites, %u bytes in %u blocks, "
+		"at allocation %u\n", kmp_ncur, bytes, count, seq);
+}
+
+void
+kmprof_diff(void)
+{
+	uint32_t bytes, count, untracked, seq;
+	struct kmp_site *site;
+	unsigned i, ndelta, nout;
+
+	if (!kmp_havesnap) {
+		kprintf("kmalloc: no snapshot\n");
+		return;
+	}
+
+	kmp_collect(&bytes, &count, &untracked, &seq);
+
+	/* Now minus then, for every site in either */
+	ndelta = 0;
+	for (i=0; i<kmp_ncur; i++) {
+		site = kmp_findsite(kmp_delta, &ndelta, KMP_NSITES * 2,
+				    kmp_cur[i].s_caller);
+		site->s_bytes = kmp_cur[i].s_bytes;
+		site->s_count = kmp_cur[i].s_count;
+		site->s_oldest = kmp_cur[i].s_oldest;
+	}
+	for (i=0; i<kmp_nsnap; i++) {
+		site = kmp_findsite(kmp_delta, &ndelta, KMP_NSITES * 2,
+				    kmp_snap[i].s_caller);
+		site->s_bytes -= kmp_snap[i].s_bytes;
+		site->s_count -= kmp_snap[i].s_count;
+	}
+
+	/* Drop the ones that didn't change */
+	nout = 0;
+	for (i=0; i<ndelta; i++) {
+		if (kmp_delta[i].s_bytes != 0 || kmp_delta[i].s_count != 0) {
+			kmp_delta[nout++] = kmp_delta[i];
+		}
+	}
+	kmp_sort(kmp_delta, nout, false);
+	kmp_printsites("Change since snapshot", kmp_delta, nout);
+}
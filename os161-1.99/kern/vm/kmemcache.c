@@ -0,0 +1,469 @@
+/*
+ * Object caches. See kmemcache.h.
+ *
+ * Each slab is one page: a struct kmc_slab header followed by
+ * kc_perslab slots. A slot is the object followed by a link word for
+ * the slab's freelist, kept outside the object so that constructed
+ * state survives being on the freelist.
+ *
+ * The per-CPU magazines are only touched by their own CPU with
+ * interrupts off (or with kc_lock held, which also turns them off),
+ * so they need no lock of their own.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <kmemcache.h>
+
+/* CPUs beyond this many go straight to the slabs */
+#define KMC_MAXCPUS	32
+
+/* Objects per magazine */
+#define KMC_MAGSIZE	8
+
+struct kmc_magazine {
+	void *m_objs[KMC_MAGSIZE];
+	unsigned m_count;
+	unsigned m_hits;		/* allocations served from here */
+	unsigned m_misses;		/* allocations that went to the slabs */
+};
+
+struct kmc_slab {
+	struct kmem_cache *s_cache;
+	struct kmc_slab *s_next;	/* kc_slabs linkage */
+	struct kmc_slab *s_prev;
+	void *s_free;			/* free slots */
+	unsigned s_inuse;		/* slots not on s_free */
+};
+
+struct kmem_cache {
+	char *kc_name;
+	size_t kc_size;			/* object size, rounded up */
+	size_t kc_stride;		/* object plus link word */
+	unsigned kc_perslab;
+	void (*kc_ctor)(void *obj);
+
+	struct spinlock kc_lock;	/* protects the fields below */
+	struct kmc_slab *kc_slabs;	/* slabs with free slots */
+	unsigned kc_nslabs;		/* all slabs, including full ones */
+	unsigned kc_nfree;		/* free slots in all slabs */
+	unsigned kc_nempty;		/* slabs with nothing in use */
+
+	struct kmem_cache *kc_next;	/* kmc_all linkage */
+	struct kmc_magazine kc_mags[KMC_MAXCPUS];
+};
+
+#define SLAB_HDRSIZE	ROUNDUP(sizeof(struct kmc_slab), 8)
+#define SLOT_LINK(kc, obj)	(*(void **)((char *)(obj) + (kc)->kc_size))
+#define OBJ_SLAB(obj)	((struct kmc_slab *)((vaddr_t)(obj) & PAGE_FRAME))
+
+/* All caches, for kmem_cache_printstats */
+static struct spinlock kmc_listlock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmc_all;
+
+////////////////////////////////////////////////////////////
+//
+// Slab layer
+
+/*
+ * Get a fresh slab with every object constructed. Called without
+ * kc_lock, since constructing a page of objects takes a while.
+ */
+static
+struct kmc_slab *
+kmc_slab_create(struct kmem_cache *kc)
+{
+	struct kmc_slab *slab;
+	char *obj;
+	unsigned i;
+
+	slab = (struct kmc_slab *)alloc_kpages(1);
+	if (slab == NULL) {
+		return NULL;
+	}
+	slab->s_cache = kc;
+	slab->s_next = slab->s_prev = NULL;
+	slab->s_free = NULL;
+	slab->s_inuse = 0;
+
+	/* Thread the freelist in address order */
+	for (i = kc->kc_perslab; i-- > 0; ) {
+		obj = (char *)slab + SLAB_HDRSIZE + i * kc->kc_stride;
+		if (kc->kc_ctor != NULL) {
+			kc->kc_ctor(obj);
+		}
+		SLOT_LINK(kc, obj) = slab->s_free;
+		slab->s_free = obj;
+	}
+	return slab;
+}
+
+static
+void
+kmc_slab_link(struct kmem_cache *kc, struct kmc_slab *slab)
+{
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	slab->s_prev = NULL;
+	slab->s_next = kc->kc_slabs;
+	if (kc->kc_slabs != NULL) {
+		kc->kc_slabs->s_prev = slab;
+	}
+	kc->kc_slabs = slab;
+}
+
+static
+void
+kmc_slab_unlink(struct kmem_cache *kc, struct kmc_slab *slab)
+{
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	if (slab->s_prev != NULL) {
+		slab->s_prev->s_next = slab->s_next;
+	}
+	else {
+		kc->kc_slabs = slab->s_next;
+	}
+	if (slab->s_next != NULL) {
+		slab->s_next->s_prev = slab->s_prev;
+	}
+	slab->s_next = slab->s_prev = NULL;
+}
+
+/*
+ * Take a free object from the slabs, or NULL if they're all full.
+ */
+static
+void *
+kmc_slab_get(struct kmem_cache *kc)
+{
+	struct kmc_slab *slab;
+	void *obj;
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	slab = kc->kc_slabs;
+	if (slab == NULL) {
+		return NULL;
+	}
+	obj = slab->s_free;
+	KASSERT(obj != NULL);
+	slab->s_free = SLOT_LINK(kc, obj);
+	if (slab->s_inuse++ == 0) {
+		kc->kc_nempty--;
+	}
+	kc->kc_nfree--;
+	if (slab->s_free == NULL) {
+		/* Full; it comes back on the list when something is freed */
+		kmc_slab_unlink(kc, slab);
+	}
+	return obj;
+}
+
+/*
+ * Put an object back in its slab. If that leaves a second empty
+ * slab, take it out of the cache and return it so the caller can
+ * free the page once the lock is released; otherwise return NULL.
+ * One empty slab is kept around to avoid thrashing at a boundary.
+ */
+static
+struct kmc_slab *
+kmc_slab_put(struct kmem_cache *kc, void *obj)
+{
+	struct kmc_slab *slab = OBJ_SLAB(obj);
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+	KASSERT(slab->s_cache == kc);
+	KASSERT(slab->s_inuse > 0);
+
+	if (slab->s_free == NULL) {
+		kmc_slab_link(kc, slab);
+	}
+	SLOT_LINK(kc, obj) = slab->s_free;
+	slab->s_free = obj;
+	kc->kc_nfree++;
+
+	if (--slab->s_inuse > 0) {
+		return NULL;
+	}
+	if (kc->kc_nempty == 0) {
+		kc->kc_nempty++;
+		return NULL;
+	}
+	kmc_slab_unlink(kc, slab);
+	kc->kc_nslabs--;
+	kc->kc_nfree -= kc->kc_perslab;
+	return slab;
+}
+
+/*
+ * Free pages of slabs handed back by kmc_slab_put, chained through
+ * s_next.
+ */
+static
+void
+kmc_slab_freelist(struct kmc_slab *list)
+{
+	struct kmc_slab *slab;
+
+	while (list != NULL) {
+		slab = list;
+		list = slab->s_next;
+		free_kpages((vaddr_t)slab);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Magazine layer
+
+/*
+ * The current CPU's magazine, or NULL if there isn't one (early in
+ * boot, before curcpu is set, or on an improbably large machine).
+ * Must be called with interrupts off.
+ */
+static
+struct kmc_magazine *
+kmc_curmag(struct kmem_cache *kc)
+{
+	if (!CURCPU_EXISTS() || curcpu == NULL ||
+	    curcpu->c_number >= KMC_MAXCPUS) {
+		return NULL;
+	}
+	return &kc->kc_mags[curcpu->c_number];
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmc_magazine *mag;
+	struct kmc_slab *slab;
+	void *obj;
+	int spl;
+
+	spl = splhigh();
+	mag = kmc_curmag(kc);
+	if (mag != NULL && mag->m_count > 0) {
+		obj = mag->m_objs[--mag->m_count];
+		mag->m_hits++;
+		splx(spl);
+		return obj;
+	}
+	splx(spl);
+
+	spinlock_acquire(&kc->kc_lock);
+	obj = kmc_slab_get(kc);
+	if (obj == NULL) {
+		spinlock_release(&kc->kc_lock);
+		slab = kmc_slab_create(kc);
+		if (slab == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		kmc_slab_link(kc, slab);
+		kc->kc_nslabs++;
+		kc->kc_nfree += kc->kc_perslab;
+		kc->kc_nempty++;
+		obj = kmc_slab_get(kc);
+		KASSERT(obj != NULL);
+	}
+
+	/*
+	 * Refill the magazine halfway while we have the lock. (We may
+	 * be on a different CPU than above; that doesn't matter.)
+	 */
+	mag = kmc_curmag(kc);
+	if (mag != NULL) {
+		mag->m_misses++;
+		while (mag->m_count < KMC_MAGSIZE / 2) {
+			void *extra = kmc_slab_get(kc);
+			if (extra == NULL) {
+				break;
+			}
+			mag->m_objs[mag->m_count++] = extra;
+		}
+	}
+	spinlock_release(&kc->kc_lock);
+
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmc_magazine *mag;
+	struct kmc_slab *slab, *tofree;
+	int spl;
+
+	if (obj == NULL) {
+		return;
+	}
+	KASSERT(OBJ_SLAB(obj)->s_cache == kc);
+
+	spl = splhigh();
+	mag = kmc_curmag(kc);
+	if (mag != NULL && mag->m_count < KMC_MAGSIZE) {
+		mag->m_objs[mag->m_count++] = obj;
+		splx(spl);
+		return;
+	}
+	splx(spl);
+
+	/* Magazine full: return this object and half the magazine. */
+	tofree = NULL;
+	spinlock_acquire(&kc->kc_lock);
+	slab = kmc_slab_put(kc, obj);
+	if (slab != NULL) {
+		slab->s_next = tofree;
+		tofree = slab;
+	}
+	mag = kmc_curmag(kc);
+	while (mag != NULL && mag->m_count > KMC_MAGSIZE / 2) {
+		slab = kmc_slab_put(kc, mag->m_objs[--mag->m_count]);
+		if (slab != NULL) {
+			slab->s_next = tofree;
+			tofree = slab;
+		}
+	}
+	spinlock_release(&kc->kc_lock);
+
+	kmc_slab_freelist(tofree);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Creation and statistics
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, void (*ctor)(void *obj))
+{
+	struct kmem_cache *kc;
+	unsigned i;
+
+	KASSERT(size > 0 && size <= KMC_MAXOBJSIZE);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = kstrdup(name);
+	if (kc->kc_name == NULL) {
+		kfree(kc);
+		return NULL;
+	}
+	kc->kc_size = ROUNDUP(size, sizeof(void *));
+	kc->kc_stride = ROUNDUP(kc->kc_size + sizeof(void *), 8);
+	kc->kc_perslab = (PAGE_SIZE - SLAB_HDRSIZE) / kc->kc_stride;
+	kc->kc_ctor = ctor;
+
+	spinlock_init(&kc->kc_lock);
+	kc->kc_slabs = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_nfree = 0;
+	kc->kc_nempty = 0;
+
+	for (i=0; i<KMC_MAXCPUS; i++) {
+		kc->kc_mags[i].m_count = 0;
+		kc->kc_mags[i].m_hits = 0;
+		kc->kc_mags[i].m_misses = 0;
+	}
+
+	spinlock_acquire(&kmc_listlock);
+	kc->kc_next = kmc_all;
+	kmc_all = kc;
+	spinlock_release(&kmc_listlock);
+
+	return kc;
+}
+
+/*
+ * Everything allocated from the cache must have been freed, and
+ * nobody may be using it any more.
+ */
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **pp;
+	struct kmc_magazine *mag;
+	struct kmc_slab *slab, *tofree;
+	unsigned i;
+
+	spinlock_acquire(&kmc_listlock);
+	for (pp = &kmc_all; *pp != NULL; pp = &(*pp)->kc_next) {
+		if (*pp == kc) {
+			*pp = kc->kc_next;
+			break;
+		}
+	}
+	spinlock_release(&kmc_listlock);
+
+	/* Empty every CPU's magazine back into the slabs */
+	tofree = NULL;
+	spinlock_acquire(&kc->kc_lock);
+	for (i=0; i<KMC_MAXCPUS; i++) {
+		mag = &kc->kc_mags[i];
+		while (mag->m_count > 0) {
+			slab = kmc_slab_put(kc, mag->m_objs[--mag->m_count]);
+			if (slab != NULL) {
+				slab->s_next = tofree;
+				tofree = slab;
+			}
+		}
+	}
+	KASSERT(kc->kc_nfree == kc->kc_nslabs * kc->kc_perslab);
+	/* What's left is the one empty slab kept in reserve, if any */
+	while (kc->kc_slabs != NULL) {
+		slab = kc->kc_slabs;
+		kmc_slab_unlink(kc, slab);
+		slab->s_next = tofree;
+		tofree = slab;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	kmc_slab_freelist(tofree);
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc->kc_name);
+	kfree(kc);
+}
+
+/*
+ * One line per cache: object size, slabs, objects in use, objects
+ * sitting in magazines, and how many allocations the magazines
+ * served.
+ */
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+	unsigned i, nslabs, nfree, inmags, hits, misses, inuse;
+
+	kprintf("Object caches:\n");
+	kprintf("    %-12s %5s %5s %7s %5s %s\n",
+		"name", "size", "slabs", "inuse", "mags", "mag hits");
+
+	spinlock_acquire(&kmc_listlock);
+	for (kc = kmc_all; kc != NULL; kc = kc->kc_next) {
+		inmags = hits = misses = 0;
+
+		spinlock_acquire(&kc->kc_lock);
+		nslabs = kc->kc_nslabs;
+		nfree = kc->kc_nfree;
+		for (i=0; i<KMC_MAXCPUS; i++) {
+			inmags += kc->kc_mags[i].m_count;
+			hits += kc->kc_mags[i].m_hits;
+			misses += kc->kc_mags[i].m_misses;
+		}
+		spinlock_release(&kc->kc_lock);
+
+		inuse = nslabs * kc->kc_perslab - nfree - inmags;
+		kprintf("    %-12s %5u %5u %7u %5u %u/%u\n",
+			kc->kc_name, (unsigned)kc->kc_size, nslabs, inuse,
+			inmags, hits, hits + misses);
+	}
+	spinlock_release(&kmc_listlock);
+}
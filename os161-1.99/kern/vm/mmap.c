@@ -0,0 +1,536 @@
+/*
+ * File mappings. See mmap.h.
+ *
+ * Neither the per-object spinlock nor as_lock is held across file
+ * I/O: pages are read in and written back with both dropped, and a
+ * reference on the object keeps it around meanwhile. A thread in the
+ * VFS (for instance a read() into a mapped buffer, or into a heap
+ * page not yet touched) holds vfs_biglock while it faults and waits
+ * for as_lock, so holding as_lock into the VFS would deadlock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <mmap.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+
+////////////////////////////////////////////////////////////
+//
+// Mapped objects
+
+static
+struct vm_mobj *
+mobj_create(struct vnode *vn, off_t offset, unsigned npages, bool shared)
+{
+	struct vm_mobj *mo;
+	unsigned i;
+
+	mo = kmalloc(sizeof(*mo));
+	if (mo == NULL) {
+		return NULL;
+	}
+	mo->mo_pages = kmalloc(npages * sizeof(paddr_t));
+	if (mo->mo_pages == NULL) {
+		kfree(mo);
+		return NULL;
+	}
+	for (i=0; i<npages; i++) {
+		mo->mo_pages[i] = 0;
+	}
+	spinlock_init(&mo->mo_lock);
+	mo->mo_refcount = 1;
+	VOP_INCREF(vn);
+	mo->mo_vn = vn;
+	mo->mo_offset = offset;
+	mo->mo_shared = shared;
+	mo->mo_npages = npages;
+	return mo;
+}
+
+static
+void
+mobj_incref(struct vm_mobj *mo)
+{
+	spinlock_acquire(&mo->mo_lock);
+	mo->mo_refcount++;
+	spinlock_release(&mo->mo_lock);
+}
+
+static
+void
+mobj_decref(struct vm_mobj *mo)
+{
+	unsigned i;
+	bool last;
+
+	spinlock_acquire(&mo->mo_lock);
+	KASSERT(mo->mo_refcount > 0);
+	mo->mo_refcount--;
+	last = (mo->mo_refcount == 0);
+	spinlock_release(&mo->mo_lock);
+
+	if (!last) {
+		return;
+	}
+
+	for (i=0; i<mo->mo_npages; i++) {
+		if (mo->mo_pages[i] != 0) {
+			free_kpages(PADDR_TO_KVADDR(mo->mo_pages[i] & PAGE_FRAME));
+		}
+	}
+	VOP_DECREF(mo->mo_vn);
+	spinlock_cleanup(&mo->mo_lock);
+	kfree(mo->mo_pages);
+	kfree(mo);
+}
+
+/*
+ * Read in page IDX of MO, unless someone sharing the object gets
+ * there first.
+ */
+static
+int
+mobj_pagein(struct vm_mobj *mo, unsigned idx)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t kva;
+	int result;
+
+	kva = alloc_zeroed_kpages(1);
+	if (kva == 0) {
+		return ENOMEM;
+	}
+	uio_kinit(&iov, &ku, (void *)kva, PAGE_SIZE,
+		  mo->mo_offset + (off_t)idx * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(mo->mo_vn, &ku);
+	if (result) {
+		free_kpages(kva);
+		return result;
+	}
+
+	spinlock_acquire(&mo->mo_lock);
+	if (mo->mo_pages[idx] == 0) {
+		mo->mo_pages[idx] = KVADDR_TO_PADDR(kva);
+		kva = 0;
+	}
+	spinlock_release(&mo->mo_lock);
+
+	if (kva != 0) {
+		free_kpages(kva);
+	}
+	return 0;
+}
+
+/* Pages whose dirty bits mobj_writeback takes at a time */
+#define MO_BATCH	32
+
+/*
+ * Set the dirty bit again on the pages in MASK, counting from page
+ * FIRST, which weren't written after all.
+ */
+static
+void
+mobj_redirty(struct vm_mobj *mo, unsigned first, uint32_t mask)
+{
+	unsigned i;
+
+	spinlock_acquire(&mo->mo_lock);
+	for (i=0; i<MO_BATCH; i++) {
+		if (mask & ((uint32_t)1 << i)) {
+			mo->mo_pages[first + i] |= MO_DIRTY;
+		}
+	}
+	spinlock_release(&mo->mo_lock);
+}
+
+/*
+ * Write back dirty pages FIRST through FIRST+N-1 of a shared object.
+ * Only the part of each page inside the file is written; mappings
+ * don't extend files.
+ *
+ * Pages are only mapped writable while dirty, so the order matters:
+ * clear the dirty bits, then shoot down the TLB entries, then write.
+ * A store that slips in after the bit is cleared faults (once the
+ * shootdown lands) and marks the page dirty again for next time,
+ * rather than going into a page we think is clean. Pages that fail
+ * to be written are left dirty.
+ */
+static
+int
+mobj_writeback(struct vm_mobj *mo, unsigned first, unsigned n)
+{
+	struct stat st;
+	struct iovec iov;
+	struct uio ku;
+	paddr_t pa;
+	off_t pos;
+	size_t len;
+	unsigned batch, end, i;
+	uint32_t mask;
+	int result;
+
+	KASSERT(mo->mo_shared);
+
+	result = VOP_STAT(mo->mo_vn, &st);
+	if (result) {
+		return result;
+	}
+
+	end = first + n;
+	if (end > mo->mo_npages) {
+		end = mo->mo_npages;
+	}
+
+	for (batch=first; batch<end; batch+=MO_BATCH) {
+		mask = 0;
+		spinlock_acquire(&mo->mo_lock);
+		for (i=0; i<MO_BATCH && batch+i<end; i++) {
+			if (mo->mo_pages[batch+i] & MO_DIRTY) {
+				mo->mo_pages[batch+i] &= ~(paddr_t)MO_DIRTY;
+				mask |= (uint32_t)1 << i;
+			}
+		}
+		spinlock_release(&mo->mo_lock);
+
+		if (mask == 0) {
+			continue;
+		}
+		vm_tlbflush();
+
+		for (i=0; i<MO_BATCH; i++) {
+			if ((mask & ((uint32_t)1 << i)) == 0) {
+				continue;
+			}
+			pos = mo->mo_offset + (off_t)(batch+i) * PAGE_SIZE;
+			if (pos >= st.st_size) {
+				continue;
+			}
+			len = PAGE_SIZE;
+			if (st.st_size - pos < (off_t)len) {
+				len = st.st_size - pos;
+			}
+
+			/* Only the dirty bit changes once a page is in */
+			pa = mo->mo_pages[batch+i] & PAGE_FRAME;
+			uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa),
+				  len, pos, UIO_WRITE);
+			result = VOP_WRITE(mo->mo_vn, &ku);
+			if (result) {
+				/* This page and the rest of the batch */
+				mobj_redirty(mo, batch, mask >> i << i);
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Address space operations
+
+static
+struct vm_map *
+mmap_find(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vm_map *m;
+
+	for (m = as->as_maps; m != NULL; m = m->vm_next) {
+		if (vaddr >= m->vm_base &&
+		    vaddr < m->vm_base + m->vm_npages * PAGE_SIZE) {
+			return m;
+		}
+	}
+	return NULL;
+}
+
+int
+mmap_fault(struct addrspace *as, int faulttype, vaddr_t vaddr,
+	   paddr_t *paddr, bool *writable)
+{
+	struct vm_map *m;
+	struct vm_mobj *mo;
+	unsigned idx;
+	bool iswrite;
+	int result;
+
+	m = mmap_find(as, vaddr);
+	if (m == NULL || m->vm_prot == PROT_NONE) {
+		return EFAULT;
+	}
+	iswrite = (faulttype != VM_FAULT_READ);
+	if (iswrite && (m->vm_prot & PROT_WRITE) == 0) {
+		return EFAULT;
+	}
+
+	mo = m->vm_obj;
+	idx = (vaddr - m->vm_base) / PAGE_SIZE;
+
+	spinlock_acquire(&mo->mo_lock);
+	if (mo->mo_pages[idx] == 0) {
+		/*
+		 * Read the page in with no locks held, keeping the
+		 * object alive with a reference. The mapping may be
+		 * gone or changed by the time we have the lock back,
+		 * so the caller starts over.
+		 */
+		mo->mo_refcount++;
+		spinlock_release(&mo->mo_lock);
+		lock_release(as->as_lock);
+
+		result = mobj_pagein(mo, idx);
+		mobj_decref(mo);
+
+		lock_acquire(as->as_lock);
+		return result ? result : EAGAIN;
+	}
+
+	if (!mo->mo_shared) {
+		*writable = (m->vm_prot & PROT_WRITE) != 0;
+	}
+	else {
+		if (iswrite) {
+			mo->mo_pages[idx] |= MO_DIRTY;
+		}
+		*writable = (mo->mo_pages[idx] & MO_DIRTY) != 0;
+	}
+	*paddr = mo->mo_pages[idx] & PAGE_FRAME;
+	spinlock_release(&mo->mo_lock);
+
+	return 0;
+}
+
+int
+mmap_map(struct addrspace *as, struct vnode *vn, off_t offset,
+	 unsigned npages, int prot, bool shared, vaddr_t *ret)
+{
+	struct vm_map *m, **pp;
+	vaddr_t top, size, bottom;
+
+	size = npages * PAGE_SIZE;
+	/* Leave the heap as it is; as_sbrk stops short of the mappings */
+	bottom = ROUNDUP(as->as_heaptop, PAGE_SIZE);
+
+	/*
+	 * The list is kept in descending address order; take the
+	 * highest gap below MMAP_TOP that fits.
+	 */
+	top = MMAP_TOP;
+	for (pp = &as->as_maps; *pp != NULL; pp = &(*pp)->vm_next) {
+		if ((*pp)->vm_base + (*pp)->vm_npages * PAGE_SIZE + size
+		    <= top) {
+			break;
+		}
+		top = (*pp)->vm_base;
+	}
+	if (size > top || top - size < bottom) {
+		return ENOMEM;
+	}
+
+	m = kmalloc(sizeof(*m));
+	if (m == NULL) {
+		return ENOMEM;
+	}
+	m->vm_obj = mobj_create(vn, offset, npages, shared);
+	if (m->vm_obj == NULL) {
+		kfree(m);
+		return ENOMEM;
+	}
+	m->vm_base = top - size;
+	m->vm_npages = npages;
+	m->vm_prot = prot;
+	m->vm_next = *pp;
+	*pp = m;
+
+	*ret = m->vm_base;
+	return 0;
+}
+
+int
+mmap_unmap(struct addrspace *as, vaddr_t base, unsigned npages)
+{
+	struct vm_map *m, **pp, *gone;
+	vaddr_t end = base + npages * PAGE_SIZE;
+	vaddr_t mend;
+	int result, err;
+
+	lock_acquire(as->as_lock);
+
+	/* Check first so that failure leaves everything mapped. */
+	for (m = as->as_maps; m != NULL; m = m->vm_next) {
+		mend = m->vm_base + m->vm_npages * PAGE_SIZE;
+		if (m->vm_base < end && mend > base &&
+		    (m->vm_base < base || mend > end)) {
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+	}
+
+	/* Take the mappings out of the address space... */
+	gone = NULL;
+	pp = &as->as_maps;
+	while (*pp != NULL) {
+		m = *pp;
+		if (m->vm_base < base || m->vm_base >= end) {
+			pp = &m->vm_next;
+			continue;
+		}
+		*pp = m->vm_next;
+		m->vm_next = gone;
+		gone = m;
+	}
+	lock_release(as->as_lock);
+
+	/* ...and then write them back and free them without the lock. */
+	result = 0;
+	while (gone != NULL) {
+		m = gone;
+		gone = m->vm_next;
+		if (m->vm_obj->mo_shared) {
+			err = mobj_writeback(m->vm_obj, 0, m->vm_npages);
+			if (err && result == 0) {
+				result = err;
+			}
+		}
+		mobj_decref(m->vm_obj);
+		kfree(m);
+	}
+
+	/* Get rid of any TLB entries for the pages just freed. */
+	vm_tlbflush();
+	return result;
+}
+
+/*
+ * The mappings may change whenever as_lock is let go for a write, so
+ * each time round, look for the highest mapping left below TOP.
+ */
+int
+mmap_sync(struct addrspace *as, vaddr_t base, unsigned npages)
+{
+	struct vm_map *m;
+	struct vm_mobj *mo;
+	vaddr_t top = base + npages * PAGE_SIZE;
+	vaddr_t mend, from, to;
+	unsigned first;
+	bool found = false;
+	int result;
+
+	lock_acquire(as->as_lock);
+	for (;;) {
+		for (m = as->as_maps; m != NULL; m = m->vm_next) {
+			mend = m->vm_base + m->vm_npages * PAGE_SIZE;
+			if (m->vm_base < top && mend > base) {
+				break;
+			}
+		}
+		if (m == NULL) {
+			break;
+		}
+		found = true;
+		from = base > m->vm_base ? base : m->vm_base;
+		to = top < mend ? top : mend;
+		top = m->vm_base;
+		if (!m->vm_obj->mo_shared) {
+			continue;
+		}
+
+		mo = m->vm_obj;
+		first = (from - m->vm_base) / PAGE_SIZE;
+		mobj_incref(mo);
+		lock_release(as->as_lock);
+
+		result = mobj_writeback(mo, first, (to - from) / PAGE_SIZE);
+		mobj_decref(mo);
+		if (result) {
+			return result;
+		}
+		lock_acquire(as->as_lock);
+	}
+	lock_release(as->as_lock);
+	return found ? 0 : ENOMEM;
+}
+
+int
+mmap_copy(struct addrspace *old, struct addrspace *new)
+{
+	struct vm_map *m, *nm, **tail;
+	struct vm_mobj *mo, *nmo;
+	vaddr_t kva;
+	unsigned i;
+
+	tail = &new->as_maps;
+	for (m = old->as_maps; m != NULL; m = m->vm_next) {
+		nm = kmalloc(sizeof(*nm));
+		if (nm == NULL) {
+			return ENOMEM;
+		}
+		*nm = *m;
+		nm->vm_next = NULL;
+
+		mo = m->vm_obj;
+		if (mo->mo_shared) {
+			mobj_incref(mo);
+		}
+		else {
+			nmo = mobj_create(mo->mo_vn, mo->mo_offset,
+					  mo->mo_npages, false);
+			if (nmo == NULL) {
+				kfree(nm);
+				return ENOMEM;
+			}
+			/* Only we use a private object; no lock needed */
+			for (i=0; i<mo->mo_npages; i++) {
+				if (mo->mo_pages[i] == 0) {
+					continue;
+				}
+				kva = alloc_kpages(1);
+				if (kva == 0) {
+					mobj_decref(nmo);
+					kfree(nm);
+					return ENOMEM;
+				}
+				memcpy((void *)kva,
+				       (void *)PADDR_TO_KVADDR(mo->mo_pages[i]),
+				       PAGE_SIZE);
+				nmo->mo_pages[i] = KVADDR_TO_PADDR(kva);
+			}
+			nm->vm_obj = nmo;
+		}
+
+		/* Link in as we go so as_destroy can clean up on failure */
+		*tail = nm;
+		tail = &nm->vm_next;
+	}
+	return 0;
+}
+
+void
+mmap_destroy(struct addrspace *as)
+{
+	struct vm_map *m;
+
+	while (as->as_maps != NULL) {
+		m = as->as_maps;
+		as->as_maps = m->vm_next;
+		if (m->vm_obj->mo_shared) {
+			/* Nobody to report errors to at this point */
+			(void)mobj_writeback(m->vm_obj, 0, m->vm_npages);
+		}
+		mobj_decref(m->vm_obj);
+		kfree(m);
+	}
+}
+
+#endif /* OPT_A3 */
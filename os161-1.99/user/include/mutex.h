@@ -0,0 +1,24 @@
+#ifndef _MUTEX_H_
+#define _MUTEX_H_
+
+/*
+ * Sleeping mutual exclusion lock for user programs, built on futexes.
+ * Locking and unlocking a lock nobody else wants is a single atomic
+ * operation and does not enter the kernel.
+ *
+ * m_state is 0 (unlocked), 1 (locked), or 2 (locked, and someone may
+ * be asleep waiting for it).
+ */
+
+struct mutex {
+	volatile int m_state;
+};
+
+#define MUTEX_INITIALIZER { 0 }
+
+void mutex_init(struct mutex *m);
+void mutex_lock(struct mutex *m);
+int mutex_trylock(struct mutex *m);	/* 1 if acquired, else 0 */
+void mutex_unlock(struct mutex *m);
+
+#endif /* _MUTEX_H_ */
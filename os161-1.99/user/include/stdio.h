@@ -37,10 +37,73 @@
 #include <kern/types.h>
 #include <types/size_t.h>
 #include <sys/null.h>
+#include <mutex.h>
 
 /* Constant returned by a bunch of stdio functions on error */
 #define EOF (-1)
 
+/*
+ * Output streams.
+ *
+ * Output to stdout is buffered: line by line when it goes to the
+ * console or a pipe (anything that can't seek), a buffer at a time
+ * otherwise. stderr is not buffered. Buffers are flushed by fflush,
+ * by exit, and before fork, execv, and spawn, and stdout is flushed
+ * before getchar reads. There is no fopen; stdin, stdout, and stderr
+ * are the only streams.
+ *
+ * Each stream has a lock, so threads may share them: the output of
+ * one call (a whole printf, say) is never mixed with another's.
+ * flockfile and funlockfile hold a stream across several calls.
+ */
+typedef struct __file {
+	struct mutex f_lock;
+	int f_fd;		/* file handle */
+	int f_mode;		/* _IO*BF, or 0 until first used */
+	int f_error;		/* a write has failed */
+	char *f_buf;		/* buffer */
+	size_t f_bufsize;
+	size_t f_len;		/* bytes waiting in f_buf */
+} FILE;
+
+extern FILE *stdin;
+extern FILE *stdout;
+extern FILE *stderr;
+
+/* Buffering modes for setvbuf */
+#define _IOFBF 1	/* full buffering */
+#define _IOLBF 2	/* line buffering */
+#define _IONBF 3	/* no buffering */
+
+/* Size of the standard buffers */
+#define BUFSIZ 1024
+
+/* Write all buffered output (for all streams if F is NULL). */
+int fflush(FILE *f);
+
+/* Choose buffering; must be called before the first output. */
+int setvbuf(FILE *f, char *buf, int mode, size_t size);
+
+size_t fwrite(const void *ptr, size_t size, size_t nitems, FILE *f);
+int fputc(int ch, FILE *f);
+int fputs(const char *s, FILE *f);
+int fprintf(FILE *f, const char *fmt, ...);
+int vfprintf(FILE *f, const char *fmt, __va_list ap);
+int ferror(FILE *f);
+void flockfile(FILE *f);
+void funlockfile(FILE *f);
+
+/*
+ * For libc internal use only:
+ *    __stdio_write     - the guts of fwrite, with F already locked;
+ *                        returns 0 or EOF.
+ *    __stdio_lockall   - lock and flush every stream, for fork.
+ *    __stdio_unlockall - and unlock them again, in parent and child.
+ */
+int __stdio_write(FILE *f, const char *data, size_t len);
+void __stdio_lockall(void);
+void __stdio_unlockall(void);
+
 /*
  * The actual guts of printf
  * (for libc internal use only)
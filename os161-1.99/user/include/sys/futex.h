@@ -0,0 +1,18 @@
+#ifndef _SYS_FUTEX_H_
+#define _SYS_FUTEX_H_
+
+/*
+ * Futexes: sleep and wake on a word of user memory.
+ *
+ * futex_wait sleeps as long as *ADDR still equals VAL when the kernel
+ * looks at it, failing with EAGAIN if it does not. futex_wake wakes
+ * up to N threads sleeping on ADDR and returns how many it woke.
+ * ADDR must be aligned to an int.
+ *
+ * These are building blocks for locks (see <mutex.h>), not locks.
+ */
+
+int futex_wait(volatile int *addr, int val);
+int futex_wake(volatile int *addr, int n);
+
+#endif /* _SYS_FUTEX_H_ */
@@ -0,0 +1,26 @@
+#ifndef _SYS_RING_H_
+#define _SYS_RING_H_
+
+/*
+ * Batched system calls through a submission/completion ring; see
+ * <kern/ring.h> for the protocol.
+ *
+ * ring_setup registers RING (RING_BYTES(NENTRIES) bytes, aligned to
+ * 4, NENTRIES a power of 2) and empties it; a NULL ring unregisters.
+ * ring_submit runs up to N queued requests and returns how many it
+ * ran.
+ */
+
+#include <sys/types.h>
+#include <kern/ring.h>
+
+int ring_setup(struct ring *ring, unsigned nentries);
+int ring_submit(unsigned n);
+
+/* The two arrays of a registered ring */
+#define RING_SQES(r) \
+	((struct ring_sqe *)((char *)(r) + RING_SQOFF((r)->r_nentries)))
+#define RING_CQES(r) \
+	((struct ring_cqe *)((char *)(r) + RING_CQOFF((r)->r_nentries)))
+
+#endif /* _SYS_RING_H_ */
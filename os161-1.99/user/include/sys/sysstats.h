@@ -0,0 +1,18 @@
+#ifndef _SYS_SYSSTATS_H_
+#define _SYS_SYSSTATS_H_
+
+/*
+ * System call statistics, totalled over all CPUs.
+ *
+ * sysstats copies the statistics (see <kern/sysstats.h>) for call
+ * numbers 0 up to N-1 into BUF and returns the number of call
+ * numbers the kernel keeps statistics for, so sysstats(NULL, 0)
+ * finds out how big BUF needs to be.
+ */
+
+#include <sys/types.h>
+#include <kern/sysstats.h>
+
+int sysstats(struct sysstat *buf, unsigned n);
+
+#endif /* _SYS_SYSSTATS_H_ */
@@ -0,0 +1,31 @@
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+/*
+ * User threads.
+ *
+ * thread_create starts FUNC(ARG) in a new thread of the calling
+ * process and returns its thread id. The thread ends when FUNC
+ * returns or calls thread_exit; thread_join waits for it and hands
+ * back its code. Each thread that was created should be joined once.
+ *
+ * The initial thread may call thread_exit too; the process ends
+ * (with status 0) when its last thread does. _exit, from any thread,
+ * ends the whole process.
+ *
+ * stdio streams have locks of their own and may be shared (see
+ * <stdio.h>). The rest of libc's global state, errno and the malloc
+ * heap, is not safe to use from two threads at once without a lock
+ * around it; see <mutex.h>.
+ */
+
+#include <unistd.h>	/* for __DEAD */
+
+int thread_create(int (*func)(void *), void *arg);
+__DEAD void thread_exit(int code);
+int thread_join(int tid, int *code);
+
+/* System call behind thread_create: start ENTRY(ARG0, ARG1) */
+int __thread_create(void (*entry)(void *, void *), void *arg0, void *arg1);
+
+#endif /* _THREAD_H_ */
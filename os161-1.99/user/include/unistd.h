@@ -146,6 +146,7 @@ int link(const char *oldfile, const char *newfile);
 int chdir(const char *path);
 
 /* Optional. */
+pid_t spawn(const char *prog, char *const *args);	/* fork + execv */
 void *sbrk(int change);
 int getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
@@ -164,4 +165,12 @@ int __getcwd(char *buf, size_t buflen);
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
 
+/*
+ * fork, execv, and spawn are wrappers too (they flush stdio first);
+ * these are the system calls themselves.
+ */
+pid_t __fork(void);
+int __execv(const char *prog, char *const *args);
+pid_t __spawn(const char *prog, char *const *args);
+
 #endif /* _UNISTD_H_ */
@@ -42,12 +42,9 @@ static
 void
 __printf_send(void *mydata, const char *data, size_t len)
 {
-	unsigned i;
-	(void)mydata;  /* not needed */
+	FILE *f = mydata;
 
-	for (i=0; i<len; i++) {
-		putchar(data[i]);
-	}
+	__stdio_write(f, data, len);
 }
 
 /* printf: hand off to vprintf */
@@ -62,9 +59,33 @@ printf(const char *fmt, ...)
 	return chars;
 }
 
-/* vprintf: call __vprintf to do the work. */
+/* vprintf: hand off to vfprintf */
 int
 vprintf(const char *fmt, va_list ap)
 {
-	return __vprintf(__printf_send, NULL, fmt, ap);
+	return vfprintf(stdout, fmt, ap);
+}
+
+/* fprintf: hand off to vfprintf */
+int
+fprintf(FILE *f, const char *fmt, ...)
+{
+	int chars;
+	va_list ap;
+	va_start(ap, fmt);
+	chars = vfprintf(f, fmt, ap);
+	va_end(ap);
+	return chars;
+}
+
+/* vfprintf: call __vprintf to do the work, holding the stream. */
+int
+vfprintf(FILE *f, const char *fmt, va_list ap)
+{
+	int chars;
+
+	flockfile(f);
+	chars = __vprintf(__printf_send, f, fmt, ap);
+	funlockfile(f);
+	return chars;
 }
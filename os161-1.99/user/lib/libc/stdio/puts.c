@@ -28,6 +28,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 /*
  * C standard I/O function - print a string and a newline.
@@ -36,7 +37,11 @@
 int
 puts(const char *s)
 {
-	__puts(s);
-	putchar('\n');
-	return 0;
+	int ret;
+
+	flockfile(stdout);
+	ret = __stdio_write(stdout, s, strlen(s)) ||
+		__stdio_write(stdout, "\n", 1);
+	funlockfile(stdout);
+	return ret ? EOF : 0;
 }
@@ -0,0 +1,249 @@
+/*
+ * Output buffering for the standard streams. See <stdio.h>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+static char stdout_buf[BUFSIZ];
+
+static FILE streams[3] = {
+	{ MUTEX_INITIALIZER, STDIN_FILENO,  _IONBF, 0, NULL, 0, 0 },
+	{ MUTEX_INITIALIZER, STDOUT_FILENO, 0,      0,
+	  stdout_buf, sizeof(stdout_buf), 0 },
+	{ MUTEX_INITIALIZER, STDERR_FILENO, _IONBF, 0, NULL, 0, 0 },
+};
+
+FILE *stdin = &streams[0];
+FILE *stdout = &streams[1];
+FILE *stderr = &streams[2];
+
+#define NSTREAMS (sizeof(streams) / sizeof(streams[0]))
+
+/*
+ * Pick the buffering for a stream on its first use: a line at a time
+ * if it goes somewhere that can't seek (the console, a pipe), a
+ * buffer at a time otherwise.
+ */
+static
+void
+__stdio_setmode(FILE *f)
+{
+	int olderrno = errno;
+
+	if (lseek(f->f_fd, 0, SEEK_CUR) < 0 && errno == ESPIPE) {
+		f->f_mode = _IOLBF;
+	}
+	else {
+		f->f_mode = _IOFBF;
+	}
+	errno = olderrno;
+}
+
+/*
+ * Write all of DATA, retrying after short writes.
+ */
+static
+int
+__stdio_writeall(FILE *f, const char *data, size_t len)
+{
+	int r;
+
+	while (len > 0) {
+		r = write(f->f_fd, data, len);
+		if (r <= 0) {
+			f->f_error = 1;
+			return EOF;
+		}
+		data += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/*
+ * Write out the buffer of F, which is locked.
+ */
+static
+int
+__stdio_flush(FILE *f)
+{
+	int ret;
+
+	if (f->f_len == 0) {
+		return 0;
+	}
+	ret = __stdio_writeall(f, f->f_buf, f->f_len);
+	f->f_len = 0;
+	return ret;
+}
+
+int
+fflush(FILE *f)
+{
+	unsigned i;
+	int ret;
+
+	if (f == NULL) {
+		ret = 0;
+		for (i=0; i<NSTREAMS; i++) {
+			if (fflush(&streams[i])) {
+				ret = EOF;
+			}
+		}
+		return ret;
+	}
+
+	mutex_lock(&f->f_lock);
+	ret = __stdio_flush(f);
+	mutex_unlock(&f->f_lock);
+	return ret;
+}
+
+void
+flockfile(FILE *f)
+{
+	mutex_lock(&f->f_lock);
+}
+
+void
+funlockfile(FILE *f)
+{
+	mutex_unlock(&f->f_lock);
+}
+
+/*
+ * A thread that forks while another holds a stream would leave the
+ * child with that stream locked for good, and with whatever half of
+ * the other thread's output was in the buffer. So fork holds them
+ * all, with their buffers empty, across the system call.
+ */
+void
+__stdio_lockall(void)
+{
+	unsigned i;
+
+	for (i=0; i<NSTREAMS; i++) {
+		mutex_lock(&streams[i].f_lock);
+		__stdio_flush(&streams[i]);
+	}
+}
+
+void
+__stdio_unlockall(void)
+{
+	unsigned i;
+
+	for (i=NSTREAMS; i-- > 0; ) {
+		mutex_unlock(&streams[i].f_lock);
+	}
+}
+
+int
+setvbuf(FILE *f, char *buf, int mode, size_t size)
+{
+	int ret = EOF;
+
+	mutex_lock(&f->f_lock);
+	if (f->f_len > 0 ||
+	    (mode != _IOFBF && mode != _IOLBF && mode != _IONBF)) {
+		goto done;
+	}
+	if (mode != _IONBF && buf != NULL) {
+		if (size == 0) {
+			goto done;
+		}
+		f->f_buf = buf;
+		f->f_bufsize = size;
+	}
+	if (mode != _IONBF && f->f_buf == NULL) {
+		/* Only stdout has a buffer of its own */
+		goto done;
+	}
+	f->f_mode = mode;
+	ret = 0;
+ done:
+	mutex_unlock(&f->f_lock);
+	return ret;
+}
+
+int
+__stdio_write(FILE *f, const char *data, size_t len)
+{
+	size_t i;
+
+	if (f->f_mode == 0) {
+		__stdio_setmode(f);
+	}
+
+	if (f->f_mode == _IONBF) {
+		return __stdio_writeall(f, data, len);
+	}
+
+	if (f->f_len + len > f->f_bufsize) {
+		if (__stdio_flush(f)) {
+			return EOF;
+		}
+		/* Don't bother copying things bigger than the buffer */
+		if (len >= f->f_bufsize) {
+			return __stdio_writeall(f, data, len);
+		}
+	}
+
+	memcpy(f->f_buf + f->f_len, data, len);
+	f->f_len += len;
+
+	if (f->f_mode == _IOLBF) {
+		for (i=0; i<len; i++) {
+			if (data[i] == '\n') {
+				return __stdio_flush(f);
+			}
+		}
+	}
+	return 0;
+}
+
+size_t
+fwrite(const void *ptr, size_t size, size_t nitems, FILE *f)
+{
+	int ret;
+
+	if (size == 0 || nitems == 0) {
+		return 0;
+	}
+	mutex_lock(&f->f_lock);
+	ret = __stdio_write(f, ptr, size * nitems);
+	mutex_unlock(&f->f_lock);
+	return ret ? 0 : nitems;
+}
+
+int
+fputc(int ch, FILE *f)
+{
+	char c = ch;
+	int ret;
+
+	mutex_lock(&f->f_lock);
+	ret = __stdio_write(f, &c, 1);
+	mutex_unlock(&f->f_lock);
+	return ret ? EOF : (unsigned char)c;
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+	int ret;
+
+	mutex_lock(&f->f_lock);
+	ret = __stdio_write(f, s, strlen(s));
+	mutex_unlock(&f->f_lock);
+	return ret ? EOF : 0;
+}
+
+int
+ferror(FILE *f)
+{
+	return f->f_error;
+}
@@ -30,10 +30,32 @@
 /*
  * User-level malloc and free implementation.
  *
- * This is a basic first-fit allocator. It's intended to be simple and
- * easy to follow. It performs abysmally if the heap becomes larger than
- * physical memory. To get (much) better out-of-core performance, port
- * the kernel's malloc. :-)
+ * The heap is a chain of blocks, each with a header giving the
+ * offsets to its neighbours, so a block can find the blocks on
+ * either side of it in constant time. A zero-size "fence" block,
+ * always in use, sits at the top of the heap so every block has a
+ * block above it.
+ *
+ * Free memory is kept in two ways:
+ *
+ *   - Small blocks (up to MSMALLMAX bytes of data) that are freed go
+ *     on a list for their exact size and stay marked in use, so they
+ *     can be handed out again in constant time. They are not merged
+ *     with their neighbours until a large request can't otherwise be
+ *     satisfied, at which point all of them are (__malloc_consolidate).
+ *
+ *   - Other free blocks are merged with free neighbours as soon as
+ *     they are freed, and kept on one of MNBINS lists by size; list b
+ *     holds blocks of MBLOCKSIZE<<b up to MBLOCKSIZE<<(b+1) bytes.
+ *     A request searches its own list first-fit and then takes the
+ *     first block on any larger list.
+ *
+ * The heap grows MGROW bytes at a time, and when the free block at
+ * the top reaches MTRIM bytes, all but MGROW of it is given back to
+ * the system with a negative sbrk.
+ *
+ * Like the rest of libc, this is not safe to call from more than one
+ * thread at a time.
  */
 
 #include <stdlib.h>
@@ -59,8 +81,8 @@
  *
  * mh_nextblock is the upwards offset to the next header.
  *
- * mh_pad is unused.
- * mh_inuse is 1 if the block is in use, 0 if it is free.
+ * mh_cached is 1 if the block is free but on a small-block list.
+ * mh_inuse is 1 if the block is in use (or cached), 0 if it is free.
  * mh_magic* should always be a fixed value.
  *
  * MBLOCKSIZE should equal sizeof(struct mheader) and be a power of 2.
@@ -78,7 +100,7 @@ struct mheader {
 	 * Block size is 8 bytes.
 	 */
 	unsigned mh_prevblock:29;
-	unsigned mh_pad:1;
+	unsigned mh_cached:1;
 	unsigned mh_magic1:2;
 
 	unsigned mh_nextblock:29;
@@ -94,7 +116,7 @@ struct mheader {
 	 * Block size is 16 bytes.
 	 */
 	unsigned mh_prevblock:62;
-	unsigned mh_pad:1;
+	unsigned mh_cached:1;
 	unsigned mh_magic1:3;
 
 	unsigned mh_nextblock:62;
@@ -106,6 +128,16 @@ struct mheader {
 #endif
 };
 
+/*
+ * The data area of a free (or cached) block holds its list links.
+ * This is two pointers, which is MBLOCKSIZE bytes, so every block
+ * must have at least MBLOCKSIZE bytes of data.
+ */
+struct mfree {
+	struct mheader *mf_next;
+	struct mheader *mf_prev;	/* not used on small-block lists */
+};
+
 /*
  * Operator macros on struct mheader.
  *
@@ -114,6 +146,7 @@ struct mheader {
  * 
  * M_DATA:		return data pointer of a header
  * M_SIZE:		return data size of a header
+ * M_FREE:		return the list links of a free block
  *
  * M_OK:		true if the magic values are correct
  * 
@@ -128,17 +161,55 @@ struct mheader {
 
 #define M_DATA(mh)	((void *)((mh)+1))
 #define M_SIZE(mh)	(M_NEXTOFF(mh)-MBLOCKSIZE)
+#define M_FREE(mh)	((struct mfree *)M_DATA(mh))
 
 #define M_OK(mh)	((mh)->mh_magic1==MMAGIC && (mh)->mh_magic2==MMAGIC)
 
 #define M_MKFIELD(off)	((off)>>MBLOCKSHIFT)
 
+/*
+ * Tuning.
+ *
+ * MSMALLMAX:	largest data size kept on the small-block lists
+ * MNSMALL:	number of small-block lists (one per size)
+ * MNBINS:	number of size-range lists for other free blocks
+ * MGROW:	least amount to grow the heap by
+ * MTRIM:	size of free block at the top that triggers giving
+ *		memory back
+ * MMAXSIZE:	largest request we'll try
+ */
+#define MSMALLMAX	512
+#define MNSMALL		(MSMALLMAX / MBLOCKSIZE + 1)
+#define MNBINS		30
+#define MGROW		16384
+#define MTRIM		65536
+#define MMAXSIZE	(0x7fffffff - MGROW)
+
 ////////////////////////////////////////////////////////////
 
 /*
- * Static variables - the bottom and top addresses of the heap.
+ * Static variables - the bottom and top addresses of the heap, and
+ * the free lists.
  */
 static uintptr_t __heapbase, __heaptop;
+static struct mheader *__smalllists[MNSMALL];
+static struct mheader *__bins[MNBINS];
+
+/*
+ * Fill in a header.
+ */
+static
+void
+__malloc_mkheader(struct mheader *mh, size_t prevoff, size_t nextoff,
+		  int inuse)
+{
+	mh->mh_prevblock = M_MKFIELD(prevoff);
+	mh->mh_cached = 0;
+	mh->mh_magic1 = MMAGIC;
+	mh->mh_nextblock = M_MKFIELD(nextoff);
+	mh->mh_inuse = inuse;
+	mh->mh_magic2 = MMAGIC;
+}
 
 /*
  * Setup function.
@@ -161,6 +232,9 @@ __malloc_init(void)
 	if (1<<MBLOCKSHIFT != MBLOCKSIZE) {
 		errx(1, "malloc: Internal error - MBLOCKSHIFT wrong");
 	}
+	if (sizeof(struct mfree) > MBLOCKSIZE) {
+		errx(1, "malloc: Internal error - MBLOCKSIZE too small");
+	}
 
 	/* init should only be called once. */
 	if (__heapbase!=0 || __heaptop!=0) {
@@ -200,6 +274,17 @@ __malloc_init(void)
 		__heapbase += adjust;
 		__heaptop = __heapbase;
 	}
+
+	/* Put the fence at the bottom of the (empty) heap. */
+	x = sbrk(MBLOCKSIZE);
+	if (x==(void *)-1) {
+		err(1, "malloc: sbrk failed making heap fence");
+	}
+	if ((uintptr_t)x != __heapbase) {
+		err(1, "malloc: heap base moved during init");
+	}
+	__heaptop += MBLOCKSIZE;
+	__malloc_mkheader(x, 0, MBLOCKSIZE, 1);
 }
 
 ////////////////////////////////////////////////////////////
@@ -241,6 +326,7 @@ __malloc_dump(void)
 		      (unsigned long) i + MBLOCKSIZE,
 		      (unsigned long) M_SIZE(mh),
 		      (unsigned long) (i+M_NEXTOFF(mh)),
+		      mh->mh_cached ? "CACHED" :
 		      mh->mh_inuse ? "INUSE" : "FREE");
 	}
 	if (i!=__heaptop) {
@@ -250,9 +336,107 @@ __malloc_dump(void)
 	warnx("heap: ************************************************");
 }
 
+/*
+ * Clear a range of memory with 0xdeadbeef.
+ * ptr must be suitably aligned.
+ */
+static
+void
+__malloc_deadbeef(void *ptr, size_t size)
+{
+	uint32_t *x = ptr;
+	size_t i, n = size/sizeof(uint32_t);
+	for (i=0; i<n; i++) {
+		x[i] = 0xdeadbeef;
+	}
+}
+
 #endif /* MALLOCDEBUG */
 
 ////////////////////////////////////////////////////////////
+//
+// Free lists
+
+/*
+ * Which size-range list a free block of SIZE data bytes goes on.
+ */
+static
+unsigned
+__malloc_bin(size_t size)
+{
+	unsigned b = 0;
+
+	size >>= MBLOCKSHIFT;
+	while (size > 1 && b < MNBINS-1) {
+		size >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static
+void
+__malloc_bininsert(struct mheader *mh)
+{
+	struct mheader **head = &__bins[__malloc_bin(M_SIZE(mh))];
+
+	M_FREE(mh)->mf_next = *head;
+	M_FREE(mh)->mf_prev = NULL;
+	if (*head != NULL) {
+		M_FREE(*head)->mf_prev = mh;
+	}
+	*head = mh;
+}
+
+static
+void
+__malloc_binremove(struct mheader *mh)
+{
+	struct mfree *mf = M_FREE(mh);
+
+	if (mf->mf_prev != NULL) {
+		M_FREE(mf->mf_prev)->mf_next = mf->mf_next;
+	}
+	else {
+		__bins[__malloc_bin(M_SIZE(mh))] = mf->mf_next;
+	}
+	if (mf->mf_next != NULL) {
+		M_FREE(mf->mf_next)->mf_prev = mf->mf_prev;
+	}
+}
+
+/*
+ * Find a free block with at least SIZE bytes of data and take it off
+ * its list.
+ */
+static
+struct mheader *
+__malloc_findfree(size_t size)
+{
+	struct mheader *mh;
+	unsigned b;
+
+	b = __malloc_bin(size);
+	for (mh = __bins[b]; mh != NULL; mh = M_FREE(mh)->mf_next) {
+		if (M_SIZE(mh) >= size) {
+			__malloc_binremove(mh);
+			return mh;
+		}
+	}
+	/* Anything on a later list is big enough */
+	for (b++; b < MNBINS; b++) {
+		mh = __bins[b];
+		if (mh != NULL) {
+			__malloc_binremove(mh);
+			return mh;
+		}
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Block operations
 
 /*
  * Get more memory (at the top of the heap) using sbrk, and 
@@ -280,12 +464,130 @@ __malloc_sbrk(size_t size)
 }
 
 /*
- * Make a new (free) block from the block passed in, leaving size
- * bytes for data in the current block. size must be a multiple of
- * MBLOCKSIZE.
+ * Merge two adjacent free blocks (mh below mhnext).
+ */
+static
+void
+__malloc_merge(struct mheader *mh, struct mheader *mhnext)
+{
+	struct mheader *mhnextnext;
+
+	if (mh->mh_nextblock != mhnext->mh_prevblock) {
+		errx(1, "free: Heap corrupt (%p and %p inconsistent)",
+		     mh, mhnext);
+	}
+
+	/* The fence is always in use, so there is a block above */
+	mhnextnext = M_NEXT(mhnext);
+	mh->mh_nextblock = M_MKFIELD(M_NEXTOFF(mh) + M_NEXTOFF(mhnext));
+	mhnextnext->mh_prevblock = mh->mh_nextblock;
+
+#ifdef MALLOCDEBUG
+	/* Deadbeef out the memory used by the now-obsolete header */
+	__malloc_deadbeef(mhnext, sizeof(struct mheader));
+#endif
+}
+
+/*
+ * Merge a newly freed block (not on any list) with whichever of its
+ * neighbours are free, and return the resulting block.
+ */
+static
+struct mheader *
+__malloc_coalesce(struct mheader *mh)
+{
+	struct mheader *mhnext, *mhprev;
+
+	mhnext = M_NEXT(mh);
+	if (!mhnext->mh_inuse) {
+		__malloc_binremove(mhnext);
+		__malloc_merge(mh, mhnext);
+	}
+
+	if (mh != (struct mheader *)__heapbase) {
+		mhprev = M_PREV(mh);
+		if (!mhprev->mh_inuse) {
+			__malloc_binremove(mhprev);
+			__malloc_merge(mhprev, mh);
+			mh = mhprev;
+		}
+	}
+	return mh;
+}
+
+/*
+ * Put a coalesced free block on its list, first giving most of it
+ * back to the system if it is a big block at the top of the heap.
+ */
+static
+void
+__malloc_release(struct mheader *mh)
+{
+	struct mheader *fence;
+	size_t amount;
+
+	fence = M_NEXT(mh);
+	if ((uintptr_t)fence + MBLOCKSIZE == __heaptop &&
+	    M_NEXTOFF(mh) >= MTRIM) {
+		amount = M_NEXTOFF(mh) - MGROW;
+		if (sbrk(-(int)amount) != (void *)-1) {
+			__heaptop -= amount;
+			mh->mh_nextblock = M_MKFIELD(MGROW);
+			fence = M_NEXT(mh);
+			__malloc_mkheader(fence, MGROW, MBLOCKSIZE, 1);
+		}
+	}
+	__malloc_bininsert(mh);
+}
+
+/*
+ * Grow the heap by at least SIZE bytes (including a header) and
+ * return the free block at the top, which is not on any list.
+ */
+static
+struct mheader *
+__malloc_grow(size_t size)
+{
+	struct mheader *mh, *fence;
+	size_t amount;
+
+	/* A free block at the top will be merged in; don't get it twice */
+	fence = (struct mheader *)(__heaptop - MBLOCKSIZE);
+	if (fence != (struct mheader *)__heapbase) {
+		mh = M_PREV(fence);
+		if (!mh->mh_inuse && M_NEXTOFF(mh) < size) {
+			size -= M_NEXTOFF(mh);
+		}
+	}
+
+	amount = size < MGROW ? MGROW : size;
+	if (__malloc_sbrk(amount) == NULL) {
+		if (amount == size || __malloc_sbrk(size) == NULL) {
+			return NULL;
+		}
+		amount = size;
+	}
+
+	/* The old fence becomes the header of the new block */
+	mh = (struct mheader *)(__heaptop - amount - MBLOCKSIZE);
+	mh->mh_nextblock = M_MKFIELD(amount);
+	mh->mh_inuse = 0;
+
+	fence = M_NEXT(mh);
+	__malloc_mkheader(fence, amount, MBLOCKSIZE, 1);
+
+	return __malloc_coalesce(mh);
+}
+
+/*
+ * Shrink the block passed in to SIZE bytes of data, making the rest
+ * into a new free block. size must be a multiple of MBLOCKSIZE.
  *
  * Only split if the excess space is at least twice the blocksize -
  * one blocksize to hold a header and one for data.
+ *
+ * The block passed in was coalesced, so the block above it is in
+ * use and the new block needs no merging.
  */
 static
 void
@@ -314,18 +616,38 @@ __malloc_split(struct mheader *mh, size_t size)
 		errx(1, "malloc: Internal error (split screwed up?)");
 	}
 
-	mhnew->mh_prevblock = M_MKFIELD(size + MBLOCKSIZE);
-	mhnew->mh_pad = 0;
-	mhnew->mh_magic1 = MMAGIC;
-	mhnew->mh_nextblock = M_MKFIELD(oldsize - size);
-	mhnew->mh_inuse = 0;
-	mhnew->mh_magic2 = MMAGIC;
+	__malloc_mkheader(mhnew, size + MBLOCKSIZE, oldsize - size, 0);
+	mhnext->mh_prevblock = mhnew->mh_nextblock;
+
+	__malloc_bininsert(mhnew);
+}
 
-	if (mhnext != (struct mheader *) __heaptop) {
-		mhnext->mh_prevblock = mhnew->mh_nextblock;
+/*
+ * Free every block on the small-block lists properly, merging them
+ * with their neighbours. Returns nonzero if there were any.
+ */
+static
+int
+__malloc_consolidate(void)
+{
+	struct mheader *mh;
+	unsigned i;
+	int any = 0;
+
+	for (i=0; i<MNSMALL; i++) {
+		while ((mh = __smalllists[i]) != NULL) {
+			__smalllists[i] = M_FREE(mh)->mf_next;
+			mh->mh_cached = 0;
+			mh->mh_inuse = 0;
+			__malloc_release(__malloc_coalesce(mh));
+			any = 1;
+		}
 	}
+	return any;
 }
 
+////////////////////////////////////////////////////////////
+
 /*
  * malloc itself.
  */
@@ -333,8 +655,6 @@ void *
 malloc(size_t size)
 {
 	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
 
 	if (__heapbase==0) {
 		__malloc_init();
@@ -344,6 +664,9 @@ malloc(size_t size)
 		errx(1, "malloc: heapbase 0x%lx; heaptop 0x%lx", 
 		     (unsigned long) __heapbase, (unsigned long) __heaptop);
 	}
+	if (size > MMAXSIZE) {
+		return NULL;
+	}
 
 #ifdef MALLOCDEBUG
 	warnx("malloc: about to allocate %lu (0x%lx) bytes", 
@@ -351,74 +674,44 @@ malloc(size_t size)
 	__malloc_dump();
 #endif
 
-	/* Round size up to an integral number of blocks. */
-	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
-
 	/*
-	 * First-fit search algorithm for available blocks.
-	 * Check to make sure the next/previous sizes all agree.
+	 * Round size up to an integral number of blocks, and at least
+	 * one so there's room for the list links when it's freed.
 	 */
-	rightprevblock = 0;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
-		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i, 
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
-		}
-		rightprevblock = mh->mh_nextblock;
-
-		/* Can't allocate a block that's in use. */
-		if (mh->mh_inuse) {
-			continue;
-		}
+	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
+	if (size == 0) {
+		size = MBLOCKSIZE;
+	}
 
-		/* Can't allocate a block that isn't big enough. */
-		if (M_SIZE(mh) < size) {
-			continue;
+	/* Small sizes: reuse a block of exactly this size if we can. */
+	if (size <= MSMALLMAX) {
+		mh = __smalllists[size >> MBLOCKSHIFT];
+		if (mh != NULL) {
+			__smalllists[size >> MBLOCKSHIFT] =
+				M_FREE(mh)->mf_next;
+			mh->mh_cached = 0;
+			return M_DATA(mh);
 		}
-
-		/* Try splitting block. */
-		__malloc_split(mh, size);
-
-		/*
-		 * Now, allocate.
-		 */
-		mh->mh_inuse = 1;
-
-#ifdef MALLOCDEBUG
-		warnx("malloc: allocating at %p", M_DATA(mh));
-		__malloc_dump();
-#endif
-		return M_DATA(mh);
-	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
 	}
 
 	/*
-	 * Didn't find anything. Expand the heap.
+	 * Otherwise look for a free block. For big requests, try again
+	 * after merging the small blocks that are being held. Failing
+	 * that, expand the heap.
 	 */
-
-	mh = __malloc_sbrk(size + MBLOCKSIZE);
+	mh = __malloc_findfree(size);
+	if (mh == NULL && size > MSMALLMAX && __malloc_consolidate()) {
+		mh = __malloc_findfree(size);
+	}
 	if (mh == NULL) {
-		return NULL;
+		mh = __malloc_grow(size + MBLOCKSIZE);
+		if (mh == NULL) {
+			return NULL;
+		}
 	}
 
-	mh->mh_prevblock = rightprevblock;
-	mh->mh_magic1 = MMAGIC;
-	mh->mh_magic2 = MMAGIC;
-	mh->mh_pad = 0;
+	__malloc_split(mh, size);
 	mh->mh_inuse = 1;
-	mh->mh_nextblock = M_MKFIELD(size + MBLOCKSIZE);
 
 #ifdef MALLOCDEBUG
 	warnx("malloc: allocating at %p", M_DATA(mh));
@@ -429,59 +722,14 @@ malloc(size_t size)
 
 ////////////////////////////////////////////////////////////
 
-/*
- * Clear a range of memory with 0xdeadbeef.
- * ptr must be suitably aligned.
- */
-static
-void
-__malloc_deadbeef(void *ptr, size_t size)
-{
-	uint32_t *x = ptr;
-	size_t i, n = size/sizeof(uint32_t);
-	for (i=0; i<n; i++) {
-		x[i] = 0xdeadbeef;
-	}
-}
-
-/*
- * Attempt to merge two adjacent blocks (mh below mhnext).
- */
-static
-void
-__malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
-{
-	struct mheader *mhnextnext;
-
-	if (mh->mh_nextblock != mhnext->mh_prevblock) {
-		errx(1, "free: Heap corrupt (%p and %p inconsistent)",
-		     mh, mhnext);
-	}
-	if (mh->mh_inuse || mhnext->mh_inuse) {
-		/* can't merge */
-		return;
-	}
-
-	mhnextnext = M_NEXT(mhnext);
-
-	mh->mh_nextblock = M_MKFIELD(MBLOCKSIZE + M_SIZE(mh) +
-				     MBLOCKSIZE + M_SIZE(mhnext));
-
-	if (mhnextnext != (struct mheader *)__heaptop) {
-		mhnextnext->mh_prevblock = mh->mh_nextblock;
-	}
-
-	/* Deadbeef out the memory used by the now-obsolete header */
-	__malloc_deadbeef(mhnext, sizeof(struct mheader));
-}
-
 /*
  * The actual free() implementation.
  */
 void
 free(void *x)
 {
-	struct mheader *mh, *mhnext, *mhprev;
+	struct mheader *mh;
+	size_t size;
 
 	if (x==NULL) {
 		/* safest practice */
@@ -510,26 +758,26 @@ free(void *x)
 		errx(1, "free: Invalid pointer %p freed (corrupt header)", x);
 	}
 
-	if (!mh->mh_inuse) {
+	if (!mh->mh_inuse || mh->mh_cached) {
 		errx(1, "free: Invalid pointer %p freed (already free)", x);
 	}
 
-	/* mark it free */
-	mh->mh_inuse = 0;
+	size = M_SIZE(mh);
 
+#ifdef MALLOCDEBUG
 	/* wipe it */
-	__malloc_deadbeef(M_DATA(mh), M_SIZE(mh));
+	__malloc_deadbeef(M_DATA(mh), size);
+#endif
 
-	/* Try merging with the block above (but not if we're at the top) */
-	mhnext = M_NEXT(mh);
-	if (mhnext != (struct mheader *)__heaptop) {
-		__malloc_trymerge(mh, mhnext);
+	if (size <= MSMALLMAX) {
+		/* Hold on to it for the next request of this size */
+		mh->mh_cached = 1;
+		M_FREE(mh)->mf_next = __smalllists[size >> MBLOCKSHIFT];
+		__smalllists[size >> MBLOCKSHIFT] = mh;
 	}
-
-	/* Try merging with the block below (but not if we're at the bottom) */
-	if (mh != (struct mheader *)__heapbase) {
-		mhprev = M_PREV(mh);
-		__malloc_trymerge(mhprev, mh);
+	else {
+		mh->mh_inuse = 0;
+		__malloc_release(__malloc_coalesce(mh));
 	}
 
 #ifdef MALLOCDEBUG
@@ -16,6 +16,11 @@ awk '
     # And, do not read lines that do not match the approximate right pattern.
     look && /^#define SYS_/ && NF==3 {
 	sub("^SYS_", "", $2);
+	# Calls wrapped by C code in libc get a __ prefix; the wrapper
+	# (in unix/fork.c) has the plain name.
+	if ($2 == "fork" || $2 == "execv" || $2 == "spawn") {
+		$2 = "__" $2;
+	}
 	# print the name of the call and the number.
 	print $2, $3;
     }
@@ -98,6 +98,9 @@ __printerr(int use_errno, const char *fmt, va_list ap)
 		prog = "(program name unknown)";
 	}
 
+	/* get anything already printed out of the way */
+	fflush(stdout);
+
 	/* print the program name */
 	__senderrstr(prog);
 	__senderrstr(": ");
@@ -0,0 +1,35 @@
+/*
+ * Wrappers for the system calls that start a new program image or
+ * copy this one. Buffered output is flushed first, so that it isn't
+ * printed twice after fork, lost by execv, or overtaken by a spawned
+ * child's output.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+pid_t
+fork(void)
+{
+	pid_t pid;
+
+	/* Also keeps other threads out of the streams meanwhile */
+	__stdio_lockall();
+	pid = __fork();
+	__stdio_unlockall();
+	return pid;
+}
+
+int
+execv(const char *prog, char *const *args)
+{
+	fflush(NULL);
+	return __execv(prog, args);
+}
+
+pid_t
+spawn(const char *prog, char *const *args)
+{
+	fflush(NULL);
+	return __spawn(prog, args);
+}
@@ -0,0 +1,122 @@
+/*
+ * Futex-based mutex. See <mutex.h>.
+ *
+ * This is the usual three-state futex lock: the lock word is 0 when
+ * free, 1 when held, and 2 when held and contended. A locker that
+ * finds the lock held marks it contended before sleeping, and only an
+ * unlock that finds it contended pays for a futex_wake.
+ */
+
+#include <mutex.h>
+#include <sys/futex.h>
+
+/* Times to retry before going to sleep */
+#define MUTEX_SPINS	100
+
+/*
+ * Atomic compare-and-swap: if *P is OLD, store NEW. Returns the
+ * value found in *P either way.
+ */
+static
+int
+mutex_cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill our own delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   if (x != old) give up */
+		" move %1, %4;"		/*   y = new (delay slot) */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   retry if the store failed */
+		" nop;"
+		"2: sync;"		/* order later loads after this */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return x;
+}
+
+/*
+ * Atomic exchange: store NEW in *P and return the previous value.
+ */
+static
+int
+mutex_xchg(volatile int *p, int new)
+{
+	int x, y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill our own delay slots */
+		"sync;"			/* order earlier stores before this */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"move %1, %3;"		/*   y = new */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   retry if the store failed */
+		" nop;"
+		"sync;"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (new)
+		: "memory");
+	return x;
+}
+
+void
+mutex_init(struct mutex *m)
+{
+	m->m_state = 0;
+}
+
+int
+mutex_trylock(struct mutex *m)
+{
+	return mutex_cas(&m->m_state, 0, 1) == 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+	int c, i;
+
+	c = mutex_cas(&m->m_state, 0, 1);
+	if (c == 0) {
+		return;
+	}
+
+	/* Held. Whoever has it may let go shortly; look again a few times */
+	for (i=0; i<MUTEX_SPINS && c == 1; i++) {
+		c = mutex_cas(&m->m_state, 0, 1);
+		if (c == 0) {
+			return;
+		}
+	}
+
+	/*
+	 * Mark it contended and sleep until we are the one who takes
+	 * it from 0. Because we can't tell whether others are still
+	 * asleep, we always take it as 2; that costs at most one
+	 * unnecessary wakeup when we unlock.
+	 */
+	if (c != 2) {
+		c = mutex_xchg(&m->m_state, 2);
+	}
+	while (c != 0) {
+		futex_wait(&m->m_state, 2);
+		c = mutex_xchg(&m->m_state, 2);
+	}
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+	if (mutex_xchg(&m->m_state, 0) == 2) {
+		futex_wake(&m->m_state, 1);
+	}
+}
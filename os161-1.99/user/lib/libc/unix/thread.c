@@ -0,0 +1,22 @@
+/*
+ * User threads. See <thread.h>.
+ */
+
+#include <thread.h>
+
+/*
+ * Where new threads start, so that returning from the thread's
+ * function ends the thread rather than running off into nowhere.
+ */
+static
+void
+thread_start(void *func, void *arg)
+{
+	thread_exit(((int (*)(void *))func)(arg));
+}
+
+int
+thread_create(int (*func)(void *), void *arg)
+{
+	return __thread_create(thread_start, (void *)func, arg);
+}
@@ -0,0 +1,17 @@
+/*
+ * Timing for the benchmarks in testbin.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include "benchtime.h"
+
+unsigned long
+elapsed_us(time_t s0, unsigned long ns0)
+{
+	time_t s1;
+	unsigned long ns1;
+
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000000UL + ns1 / 1000 - ns0 / 1000;
+}
@@ -0,0 +1,16 @@
+/*
+ * Timing for the benchmarks in testbin. Link with ../benchtime.c.
+ */
+
+#ifndef BENCHTIME_H
+#define BENCHTIME_H
+
+#include <sys/types.h>
+
+/*
+ * Microseconds since S0 seconds and NS0 nanoseconds, as returned by
+ * an earlier call to __time.
+ */
+unsigned long elapsed_us(time_t s0, unsigned long ns0);
+
+#endif /* BENCHTIME_H */
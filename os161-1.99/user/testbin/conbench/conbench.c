@@ -0,0 +1,69 @@
+/*
+ * conbench.c
+ *
+ *	Console output throughput benchmark.
+ *
+ * Usage: conbench [kilobytes [linelength]]
+ *
+ * Writes KILOBYTES (default 1024) of text to the standard output in
+ * lines of LINELENGTH characters (default 64, counting the newline),
+ * one write per line, and then prints the time taken and the
+ * throughput. Run it with the output on the console.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include "../benchtime.h"
+
+#define MAXLINE	1024
+
+static char line[MAXLINE];
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long total, done, us;
+	int linelen = 64, i, n;
+	time_t s0;
+	unsigned long ns0;
+
+	total = 1024;
+	if (argc > 1) {
+		total = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		linelen = atoi(argv[2]);
+	}
+	if (total == 0 || linelen < 2 || linelen > MAXLINE) {
+		errx(1, "Usage: conbench [kilobytes [linelength]]");
+	}
+	total *= 1024;
+
+	for (i=0; i<linelen-1; i++) {
+		line[i] = 'a' + i % 26;
+	}
+	line[linelen-1] = '\n';
+
+	__time(&s0, &ns0);
+	for (done = 0; done < total; done += n) {
+		n = total - done < (unsigned long)linelen ?
+			(int)(total - done) : linelen;
+		if (write(STDOUT_FILENO, line, n) != n) {
+			err(1, "write");
+		}
+	}
+	us = elapsed_us(s0, ns0);
+
+	printf("\nconbench: %lu bytes in %lu.%06lu s", total,
+	       us / 1000000, us % 1000000);
+	if (us > 0) {
+		printf(", %lu bytes/s", (unsigned long)
+		       ((unsigned long long)total * 1000000 / us));
+	}
+	printf("\n");
+	return 0;
+}
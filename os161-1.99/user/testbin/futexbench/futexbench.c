@@ -0,0 +1,184 @@
+/*
+ * futexbench.c
+ *
+ *	Futex and user mutex benchmark.
+ *
+ * Usage: futexbench [iterations [threads]]
+ *
+ * Times, over ITERATIONS (default 100000) repetitions each:
+ *    - locking and unlocking an uncontended mutex, which should
+ *      never enter the kernel;
+ *    - futex_wake on a word nobody is waiting on;
+ *    - futex_wait on a word whose value has already changed, which
+ *      must return EAGAIN at once.
+ * The last two are the cost of the kernel half of a contended lock
+ * handoff, minus the context switch.
+ *
+ * Then THREADS threads (default 4) each take and release one mutex
+ * ITERATIONS times around a short critical section, and the total
+ * time and the final count are reported.
+ */
+
+#include <sys/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <mutex.h>
+#include <thread.h>
+#include "../benchtime.h"
+
+#define MAXTHREADS	32
+
+static struct mutex mtx = MUTEX_INITIALIZER;
+static volatile int word;
+static volatile int counter;
+
+static
+void
+report(const char *what, int iters, unsigned long us)
+{
+	printf("%s: %d in %lu us, %lu ns each\n",
+	       what, iters, us, us * 1000UL / iters);
+}
+
+static
+void
+uncontended(int iters)
+{
+	time_t s0;
+	unsigned long ns0;
+	int i;
+
+	__time(&s0, &ns0);
+	for (i=0; i<iters; i++) {
+		mutex_lock(&mtx);
+		mutex_unlock(&mtx);
+	}
+	report("mutex lock/unlock", iters, elapsed_us(s0, ns0));
+
+	if (mtx.m_state != 0) {
+		errx(1, "mutex left in state %d", mtx.m_state);
+	}
+	if (!mutex_trylock(&mtx) || mutex_trylock(&mtx)) {
+		errx(1, "mutex_trylock broken");
+	}
+	mutex_unlock(&mtx);
+}
+
+static
+void
+idlewake(int iters)
+{
+	time_t s0;
+	unsigned long ns0;
+	int i, r;
+
+	__time(&s0, &ns0);
+	for (i=0; i<iters; i++) {
+		r = futex_wake(&word, 1);
+		if (r != 0) {
+			if (r < 0) {
+				err(1, "futex_wake");
+			}
+			errx(1, "futex_wake woke %d threads that aren't there",
+			     r);
+		}
+	}
+	report("futex_wake, no waiters", iters, elapsed_us(s0, ns0));
+}
+
+static
+void
+stalewait(int iters)
+{
+	time_t s0;
+	unsigned long ns0;
+	int i;
+
+	word = 1;
+	__time(&s0, &ns0);
+	for (i=0; i<iters; i++) {
+		if (futex_wait(&word, 0) == 0 || errno != EAGAIN) {
+			errx(1, "futex_wait on a stale value didn't fail "
+			     "with EAGAIN");
+		}
+	}
+	report("futex_wait, value changed", iters, elapsed_us(s0, ns0));
+
+	if (futex_wait((volatile int *)((char *)&word + 1), 1) == 0 ||
+	    errno != EINVAL) {
+		errx(1, "futex_wait on an unaligned address didn't fail "
+		     "with EINVAL");
+	}
+}
+
+static
+int
+contender(void *arg)
+{
+	int iters = (int)arg;
+	int i;
+
+	for (i=0; i<iters; i++) {
+		mutex_lock(&mtx);
+		counter++;
+		mutex_unlock(&mtx);
+	}
+	return 0;
+}
+
+static
+void
+contended(int iters, int nthreads)
+{
+	int tids[MAXTHREADS];
+	time_t s0;
+	unsigned long ns0, us;
+	int i, code;
+
+	counter = 0;
+	__time(&s0, &ns0);
+	for (i=0; i<nthreads; i++) {
+		tids[i] = thread_create(contender, (void *)iters);
+		if (tids[i] < 0) {
+			err(1, "thread_create");
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		if (thread_join(tids[i], &code) < 0) {
+			err(1, "thread_join");
+		}
+	}
+	us = elapsed_us(s0, ns0);
+
+	if (counter != iters * nthreads) {
+		errx(1, "contended: count is %d, expected %d",
+		     counter, iters * nthreads);
+	}
+	printf("mutex, %d threads: ", nthreads);
+	report("lock/unlock", iters * nthreads, us);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int iters = 100000, nthreads = 4;
+
+	if (argc > 1) {
+		iters = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		nthreads = atoi(argv[2]);
+	}
+	if (iters <= 0 || nthreads <= 0 || nthreads > MAXTHREADS) {
+		errx(1, "Usage: futexbench [iterations [threads]]");
+	}
+
+	uncontended(iters);
+	idlewake(iters);
+	stalewait(iters);
+	contended(iters, nthreads);
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * mallocbench.c
+ *
+ *	Time malloc and free under a few allocation size mixes.
+ *
+ * Usage: mallocbench [ops]
+ *
+ * For each mix, keeps up to NSLOTS blocks live and does OPS (default
+ * 100000) random operations on them: an empty slot gets a fresh
+ * block, a full one is freed. The first word of every block is
+ * written so the pages are really touched. Reports operations per
+ * second, how many sbrk calls the mix made (see sysstats), and how
+ * much bigger the heap still is once everything has been freed.
+ */
+
+#include <sys/types.h>
+#include <sys/sysstats.h>
+#include <kern/syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include "../benchtime.h"
+
+#define NSLOTS 512
+
+struct mix {
+	const char *name;
+	size_t (*size)(void);
+};
+
+static void *slots[NSLOTS];
+static struct sysstat stats[SYSSTATS_NCALLS];
+
+static
+size_t
+size_fixed(void)
+{
+	return 16;
+}
+
+static
+size_t
+size_small(void)
+{
+	return 8 + random() % 505;
+}
+
+static
+size_t
+size_mixed(void)
+{
+	if (random() % 8 != 0) {
+		return 8 + random() % 121;
+	}
+	return 512 + random() % 7681;
+}
+
+static
+size_t
+size_large(void)
+{
+	return 1024 + random() % 64513;
+}
+
+static const struct mix mixes[] = {
+	{ "fixed 16",		size_fixed },
+	{ "small 8-512",	size_small },
+	{ "mixed",		size_mixed },
+	{ "large 1K-64K",	size_large },
+};
+
+#define NMIXES (sizeof(mixes)/sizeof(mixes[0]))
+
+static
+unsigned
+countsbrks(void)
+{
+	if (sysstats(stats, SYSSTATS_NCALLS) < 0) {
+		err(1, "sysstats");
+	}
+	return stats[SYS_sbrk].ss_count;
+}
+
+static
+void
+runmix(const struct mix *m, int ops)
+{
+	char *base, *top;
+	unsigned sbrks;
+	unsigned long us, rate;
+	time_t s0;
+	unsigned long ns0;
+	int i, slot;
+
+	srandom(0);
+	base = sbrk(0);
+	sbrks = countsbrks();
+	__time(&s0, &ns0);
+	for (i=0; i<ops; i++) {
+		slot = random() % NSLOTS;
+		if (slots[slot] != NULL) {
+			free(slots[slot]);
+			slots[slot] = NULL;
+			continue;
+		}
+		slots[slot] = malloc(m->size());
+		if (slots[slot] == NULL) {
+			err(1, "%s: malloc", m->name);
+		}
+		*(int *)slots[slot] = i;
+	}
+	for (slot=0; slot<NSLOTS; slot++) {
+		free(slots[slot]);
+		slots[slot] = NULL;
+	}
+	us = elapsed_us(s0, ns0);
+	sbrks = countsbrks() - sbrks;
+	top = sbrk(0);
+
+	rate = us > 0 ? (unsigned long)((unsigned long long)ops * 1000000
+					/ us) : 0;
+	printf("%-13s %7lu ops/s  %4u sbrks  heap +%ldK\n",
+	       m->name, rate, sbrks, (long)(top - base) / 1024);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int ops = 100000;
+	unsigned i;
+
+	if (argc > 1) {
+		ops = atoi(argv[1]);
+	}
+	if (ops <= 0) {
+		errx(1, "Usage: mallocbench [ops]");
+	}
+
+	for (i=0; i<NMIXES; i++) {
+		runmix(&mixes[i], ops);
+	}
+	return 0;
+}
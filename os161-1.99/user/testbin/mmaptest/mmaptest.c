@@ -0,0 +1,169 @@
+/*
+ * mmaptest.c
+ *
+ *	Tests mmap, munmap and msync on a user specified file.
+ *
+ * Writes a file several pages long, maps it private and checks that
+ * the contents match and that changes don't reach the file, then
+ * maps it shared, changes it, and checks that msync and munmap write
+ * the changes back. Also checks that a shared mapping is shared with
+ * a child after fork.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define PAGESIZE	4096
+#define NPAGES		5
+#define FILESIZE	(NPAGES * PAGESIZE - 100)	/* partial last page */
+
+static char buf[FILESIZE];
+
+static
+char
+pattern(unsigned i)
+{
+	return 'a' + (i * 7 + i / PAGESIZE) % 26;
+}
+
+static
+void
+readfile(const char *file)
+{
+	int fd, rv;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open for read", file);
+	}
+	rv = read(fd, buf, FILESIZE);
+	if (rv != FILESIZE) {
+		err(1, "%s: read", file);
+	}
+	close(fd);
+}
+
+static
+char *
+mapfile(const char *file, int flags, int openflags)
+{
+	char *p;
+	int fd;
+
+	fd = open(file, openflags);
+	if (fd < 0) {
+		err(1, "%s: open", file);
+	}
+	p = mmap(NULL, FILESIZE, PROT_READ|PROT_WRITE, flags, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "%s: mmap", file);
+	}
+	/* The mapping keeps the file open */
+	close(fd);
+	return p;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *p;
+	unsigned i;
+	int fd, status;
+	pid_t pid;
+
+	if (argc != 2) {
+		errx(1, "Usage: mmaptest <filename>");
+	}
+
+	for (i=0; i<FILESIZE; i++) {
+		buf[i] = pattern(i);
+	}
+	fd = open(argv[1], O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open for write", argv[1]);
+	}
+	if (write(fd, buf, FILESIZE) != FILESIZE) {
+		err(1, "%s: write", argv[1]);
+	}
+	close(fd);
+
+	/* Private: reads see the file, writes stay in memory */
+	p = mapfile(argv[1], MAP_PRIVATE, O_RDONLY);
+	for (i=0; i<FILESIZE; i++) {
+		if (p[i] != pattern(i)) {
+			errx(1, "private: wrong data at offset %u", i);
+		}
+	}
+	for (i=FILESIZE; i<NPAGES * PAGESIZE; i++) {
+		if (p[i] != 0) {
+			errx(1, "private: tail of last page not zero");
+		}
+	}
+	memset(p, 'X', FILESIZE);
+	if (munmap(p, FILESIZE)) {
+		err(1, "private: munmap");
+	}
+	readfile(argv[1]);
+	for (i=0; i<FILESIZE; i++) {
+		if (buf[i] != pattern(i)) {
+			errx(1, "private: write reached the file");
+		}
+	}
+	printf("private mapping ok\n");
+
+	/* Shared: msync writes back */
+	p = mapfile(argv[1], MAP_SHARED, O_RDWR);
+	for (i=0; i<FILESIZE; i+=2) {
+		p[i] = 'S';
+	}
+	if (msync(p, FILESIZE, MS_SYNC)) {
+		err(1, "shared: msync");
+	}
+	readfile(argv[1]);
+	for (i=0; i<FILESIZE; i++) {
+		if (buf[i] != (i % 2 ? pattern(i) : 'S')) {
+			errx(1, "shared: msync lost data at offset %u", i);
+		}
+	}
+
+	/* Shared across fork; the child's writes reach us and the file */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		for (i=1; i<FILESIZE; i+=2) {
+			p[i] = 'C';
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	for (i=1; i<FILESIZE; i+=2) {
+		if (p[i] != 'C') {
+			errx(1, "shared: child's write not seen at %u", i);
+		}
+	}
+	if (munmap(p, FILESIZE)) {
+		err(1, "shared: munmap");
+	}
+	readfile(argv[1]);
+	for (i=0; i<FILESIZE; i++) {
+		if (buf[i] != (i % 2 ? 'C' : 'S')) {
+			errx(1, "shared: munmap lost data at offset %u", i);
+		}
+	}
+	printf("shared mapping ok\n");
+
+	if (remove(argv[1]) < 0) {
+		err(1, "%s: remove", argv[1]);
+	}
+	printf("Passed mmaptest.\n");
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * pipebench.c
+ *
+ *	Pipe latency and throughput benchmark.
+ *
+ * Usage: pipebench [rounds [megabytes]]
+ *
+ * Ping-pong: a parent and child pass one byte back and forth through
+ * a pair of pipes ROUNDS times (default 1000) and the mean round-trip
+ * time is printed.
+ *
+ * Bulk: the child writes MEGABYTES (default 4) through one pipe in
+ * 4K chunks, the parent reads it all and checks it, and the transfer
+ * rate is printed.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include "../benchtime.h"
+
+#define CHUNK	4096
+
+static char buf[CHUNK];
+
+static
+void
+waitchild(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (WIFSIGNALED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+static
+void
+pingpong(int rounds)
+{
+	int ping[2], pong[2];
+	time_t s0;
+	unsigned long ns0, us;
+	pid_t pid;
+	char c;
+	int i;
+
+	if (pipe(ping) < 0 || pipe(pong) < 0) {
+		err(1, "pipe");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(ping[1]);
+		close(pong[0]);
+		for (i=0; i<rounds; i++) {
+			if (read(ping[0], &c, 1) != 1) {
+				_exit(1);
+			}
+			if (write(pong[1], &c, 1) != 1) {
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+	close(ping[0]);
+	close(pong[1]);
+
+	__time(&s0, &ns0);
+	for (i=0; i<rounds; i++) {
+		c = i;
+		if (write(ping[1], &c, 1) != 1) {
+			err(1, "ping");
+		}
+		if (read(pong[0], &c, 1) != 1) {
+			err(1, "pong");
+		}
+		if (c != (char)i) {
+			errx(1, "round %d: got the wrong byte back", i);
+		}
+	}
+	us = elapsed_us(s0, ns0);
+
+	close(ping[1]);
+	close(pong[0]);
+	waitchild(pid);
+
+	printf("ping-pong: %d round trips in %lu us, %lu us each\n",
+	       rounds, us, us / rounds);
+}
+
+static
+void
+bulk(int megabytes)
+{
+	int fds[2];
+	time_t s0;
+	unsigned long ns0, us, total, got;
+	pid_t pid;
+	int i, r;
+
+	total = (unsigned long)megabytes * 1024 * 1024;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		for (got = 0; got < total; got += CHUNK) {
+			for (i=0; i<CHUNK; i++) {
+				buf[i] = (got + i) % 251;
+			}
+			if (write(fds[1], buf, CHUNK) != CHUNK) {
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	__time(&s0, &ns0);
+	got = 0;
+	while ((r = read(fds[0], buf, CHUNK)) > 0) {
+		for (i=0; i<r; i++) {
+			if (buf[i] != (char)((got + i) % 251)) {
+				errx(1, "bulk: bad data at byte %lu", got + i);
+			}
+		}
+		got += r;
+	}
+	if (r < 0) {
+		err(1, "bulk: read");
+	}
+	us = elapsed_us(s0, ns0);
+
+	close(fds[0]);
+	waitchild(pid);
+
+	if (got != total) {
+		errx(1, "bulk: got %lu bytes, expected %lu", got, total);
+	}
+	printf("bulk: %lu bytes in %lu us, %lu KB/s\n",
+	       total, us, us > 0 ? (total / 1024) * 1000000UL / us : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int rounds = 1000, megabytes = 4;
+
+	if (argc > 1) {
+		rounds = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		megabytes = atoi(argv[2]);
+	}
+	if (rounds <= 0 || megabytes <= 0) {
+		errx(1, "Usage: pipebench [rounds [megabytes]]");
+	}
+
+	pingpong(rounds);
+	bulk(megabytes);
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * printfbench.c
+ *
+ *	Count the write system calls printf makes.
+ *
+ * Usage: printfbench [lines]
+ *
+ * Prints LINES (default 1000) formatted lines to the standard output,
+ * then reports on stderr how many bytes that was, how many write
+ * calls the system made meanwhile (see sysstats), and how long it
+ * took. With stdio buffering there should be about one write per
+ * line on the console, and far fewer going to a file; unbuffered it
+ * would be one per character.
+ */
+
+#include <sys/types.h>
+#include <sys/sysstats.h>
+#include <kern/syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include "../benchtime.h"
+
+static struct sysstat stats[SYSSTATS_NCALLS];
+
+static
+unsigned
+countwrites(void)
+{
+	if (sysstats(stats, SYSSTATS_NCALLS) < 0) {
+		err(1, "sysstats");
+	}
+	return stats[SYS_write].ss_count;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned writes, bytes;
+	unsigned long us;
+	time_t s0;
+	unsigned long ns0;
+	int lines = 1000, i, r;
+
+	if (argc > 1) {
+		lines = atoi(argv[1]);
+	}
+	if (lines <= 0) {
+		errx(1, "Usage: printfbench [lines]");
+	}
+
+	bytes = 0;
+	writes = countwrites();
+	__time(&s0, &ns0);
+	for (i=0; i<lines; i++) {
+		r = printf("line %5d of %5d: %08x %c%c%c %s\n", i, lines,
+			   i * 2654435761U, 'a' + i % 26, 'A' + i % 26,
+			   '0' + i % 10, "the quick brown fox");
+		if (r < 0) {
+			err(1, "printf");
+		}
+		bytes += r;
+	}
+	if (fflush(stdout)) {
+		err(1, "stdout");
+	}
+	us = elapsed_us(s0, ns0);
+	writes = countwrites() - writes;
+
+	fprintf(stderr, "printfbench: %d lines, %u bytes, %u writes "
+		"(%u bytes per write), %lu.%06lu s\n", lines, bytes, writes,
+		writes > 0 ? bytes / writes : 0, us / 1000000, us % 1000000);
+	return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * ringbench.c
+ *
+ *	Compare system calls made one trap at a time with the same
+ *	calls batched through a submission ring.
+ *
+ * Usage: ringbench [calls [batch]]
+ *
+ * For each of getpid, __time, and a one-byte write to null:, makes
+ * CALLS (default 20000) calls directly, then CALLS calls through the
+ * ring, BATCH (default 32) per ring_submit, checking every result,
+ * and prints the cost per call both ways.
+ */
+
+#include <sys/types.h>
+#include <sys/ring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include "../benchtime.h"
+
+#define NENTRIES	256
+
+static uint32_t ringmem[(RING_BYTES(NENTRIES) + 3) / 4];
+static struct ring *ring = (struct ring *)ringmem;
+
+static int nullfd;
+static time_t tsecs;
+static unsigned long tnsecs;
+static char byte = 'x';
+
+/*
+ * Make one call of kind OP directly.
+ */
+static
+int
+direct(int op)
+{
+	switch (op) {
+	    case RING_OP_GETPID:
+		return getpid();
+	    case RING_OP_TIME:
+		return __time(&tsecs, &tnsecs) < 0 ? -1 : 0;
+	    case RING_OP_WRITE:
+		return write(nullfd, &byte, 1);
+	}
+	return -1;
+}
+
+/*
+ * Fill in a submission entry for a call of kind OP.
+ */
+static
+void
+prepare(struct ring_sqe *sqe, int op, unsigned data)
+{
+	sqe->sqe_op = op;
+	sqe->sqe_fd = nullfd;
+	sqe->sqe_addr = 0;
+	sqe->sqe_len = 0;
+	sqe->sqe_addr2 = 0;
+	sqe->sqe_data = data;
+
+	switch (op) {
+	    case RING_OP_TIME:
+		sqe->sqe_addr = (uint32_t)&tsecs;
+		sqe->sqe_addr2 = (uint32_t)&tnsecs;
+		break;
+	    case RING_OP_WRITE:
+		sqe->sqe_addr = (uint32_t)&byte;
+		sqe->sqe_len = 1;
+		break;
+	}
+}
+
+static
+void
+bench(const char *name, int op, int calls, int batch)
+{
+	struct ring_sqe *sqes = RING_SQES(ring);
+	struct ring_cqe *cqes = RING_CQES(ring);
+	struct ring_cqe *cqe;
+	time_t s0;
+	unsigned long ns0, us1, us2;
+	int i, n, r, expect;
+
+	expect = op == RING_OP_GETPID ? getpid() :
+		op == RING_OP_WRITE ? 1 : 0;
+
+	__time(&s0, &ns0);
+	for (i=0; i<calls; i++) {
+		if (direct(op) != expect) {
+			err(1, "%s", name);
+		}
+	}
+	us1 = elapsed_us(s0, ns0);
+
+	__time(&s0, &ns0);
+	for (i=0; i<calls; i += n) {
+		n = calls - i < batch ? calls - i : batch;
+		for (r=0; r<n; r++) {
+			prepare(&sqes[ring->r_sqtail % NENTRIES], op, i + r);
+			ring->r_sqtail++;
+		}
+		r = ring_submit(n);
+		if (r < 0) {
+			err(1, "ring_submit");
+		}
+		if (r != n) {
+			errx(1, "ring_submit ran %d of %d", r, n);
+		}
+		for (r=0; r<n; r++) {
+			cqe = &cqes[ring->r_cqhead % NENTRIES];
+			if (cqe->cqe_res != expect ||
+			    cqe->cqe_data != (unsigned)(i + r)) {
+				errx(1, "%s: bad completion %u: %d",
+				     name, cqe->cqe_data, cqe->cqe_res);
+			}
+			ring->r_cqhead++;
+		}
+	}
+	us2 = elapsed_us(s0, ns0);
+
+	printf("%-8s direct %5lu ns/call, ring (batch %d) %5lu ns/call\n",
+	       name, us1 * 1000UL / calls, batch, us2 * 1000UL / calls);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int calls = 20000, batch = 32;
+
+	if (argc > 1) {
+		calls = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		batch = atoi(argv[2]);
+	}
+	if (calls <= 0 || batch <= 0 || batch > NENTRIES) {
+		errx(1, "Usage: ringbench [calls [batch]]");
+	}
+
+	nullfd = open("null:", O_WRONLY);
+	if (nullfd < 0) {
+		err(1, "null:");
+	}
+	if (ring_setup(ring, NENTRIES) < 0) {
+		err(1, "ring_setup");
+	}
+
+	bench("getpid", RING_OP_GETPID, calls, batch);
+	bench("__time", RING_OP_TIME, calls, batch);
+	bench("write", RING_OP_WRITE, calls, batch);
+
+	ring_setup(NULL, 0);
+	close(nullfd);
+	return 0;
+}
@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# gensysnames.sh
+# Usage: ./gensysnames.sh < syscall.h
+#
+# Parses the kernel's syscall.h into the body of the table of call
+# names sysstat prints, the same way libc's gensyscalls.sh makes the
+# system call stubs.
+#
+
+# tabs to spaces, just in case
+tr '\t' ' ' |\
+awk '
+    # Do not read the parts of the file that are not between the markers.
+    /^\/\*CALLBEGIN\*\// { look=1; }
+    /^\/\*CALLEND\*\// { look=0; }
+
+    # And, do not read lines that do not match the approximate right pattern.
+    look && /^#define SYS_/ && NF==3 {
+	sub("^SYS_", "", $2);
+	# print the number of the call and its name.
+	printf "\t[%s] = \"%s\",\n", $3, $2;
+    }
+'
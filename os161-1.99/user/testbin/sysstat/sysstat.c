@@ -0,0 +1,96 @@
+/*
+ * sysstat.c
+ *
+ *	Print system call counts and mean latencies.
+ *
+ * Usage: sysstat [prog [args...]]
+ *
+ * With no arguments, prints the kernel's totals for every call that
+ * has been made since boot (or since the last "sysstats reset" from
+ * the kernel menu). Given a program, runs it and prints only the
+ * calls made while it ran; these are system-wide, and include the
+ * spawn and waitpid sysstat itself makes.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/sysstats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+/*
+ * Names of the calls, indexed by number; generated from the system
+ * call list into sysnames.c by gensysnames.sh.
+ */
+extern const char *const sysnames[SYSSTATS_NCALLS];
+
+static struct sysstat before[SYSSTATS_NCALLS];
+static struct sysstat after[SYSSTATS_NCALLS];
+
+static
+void
+getstats(struct sysstat *buf)
+{
+	if (sysstats(buf, SYSSTATS_NCALLS) < 0) {
+		err(1, "sysstats");
+	}
+}
+
+static
+void
+runprog(char **args)
+{
+	int status;
+	pid_t pid;
+
+	pid = spawn(args[0], args);
+	if (pid < 0) {
+		err(1, "%s", args[0]);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (WIFSIGNALED(status) || WEXITSTATUS(status) != 0) {
+		warnx("%s failed", args[0]);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned callno, count, nret, i;
+	unsigned long long ns, avgns;
+
+	if (argc > 1) {
+		getstats(before);
+		runprog(&argv[1]);
+	}
+	getstats(after);
+
+	for (callno=0; callno<SYSSTATS_NCALLS; callno++) {
+		count = after[callno].ss_count - before[callno].ss_count;
+		if (count == 0) {
+			continue;
+		}
+		nret = 0;
+		for (i=0; i<SYSSTATS_NBUCKETS; i++) {
+			nret += after[callno].ss_hist[i] -
+				before[callno].ss_hist[i];
+		}
+		ns = after[callno].ss_totalns - before[callno].ss_totalns;
+		avgns = nret > 0 ? ns / nret : 0;
+
+		if (sysnames[callno] != NULL) {
+			printf("%-16s", sysnames[callno]);
+		}
+		else {
+			printf("#%-15u", callno);
+		}
+		printf(" %8u calls, avg %lu.%03lu us\n", count,
+		       (unsigned long)(avgns / 1000),
+		       (unsigned long)(avgns % 1000));
+	}
+	return 0;
+}
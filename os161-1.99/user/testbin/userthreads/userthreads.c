@@ -28,83 +28,106 @@
  */
 
 /*
- * Test multiple user level threads inside a process. The program
- * forks 3 threads off 2 to functions, each of which displays a string
- * every once in a while.
+ * Test multiple user level threads inside a process.
  *
- * This won't do much of anything unless you implement user-level
- * threads.
- *
- * It also makes various assumptions about the thread API. In
- * particular, it believes (1) that you create a thread by calling
- * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
- * return from the function they started in. If any or all of these
- * assumptions are not met by your user-level threads, you will need
- * to patch this test accordingly.
- *
- * This is also a rather basic test and you'll probably want to write
- * some more of your own.
+ * Starts NTHREADS threads running one of two functions. Each adds
+ * to a shared counter a fixed number of times, taking a mutex
+ * around every increment, and prints a word every so often. The
+ * main thread joins them all and checks both the exit codes and
+ * the counter: with the mutex, no increments may be lost even when
+ * the threads are running on different CPUs.
  */
 
-
 #include <unistd.h>
 #include <stdio.h>
+#include <err.h>
+#include <thread.h>
+#include <mutex.h>
 
 #define NTHREADS  3
-#define MAX       1<<25
+#define MAX       (1<<16)
 
-/* counter for the loop in the threads : 
-   This variable is shared and incremented by each 
-   thread during his computation */
-volatile int count = 0;
+/* counter for the loop in the threads: shared by all of them */
+static volatile int count = 0;
+static struct mutex countlock = MUTEX_INITIALIZER;
+static struct mutex printlock = MUTEX_INITIALIZER;
 
-/* the 2 threads : */
-void ThreadRunner(void);
-void BladeRunner(void);
+/* the 2 kinds of thread: */
+static int ThreadRunner(void *);
+static int BladeRunner(void *);
 
-int
-main(int argc, char *argv[])
+static
+void
+say(const char *word)
 {
-    int i;
-
-    (void)argc;
-    (void)argv;
+	mutex_lock(&printlock);
+	printf("%s", word);
+	mutex_unlock(&printlock);
+}
 
-    for (i=0; i<NTHREADS; i++) {
-	if (i)
-	    threadfork(ThreadRunner);
-        else
-	    threadfork(BladeRunner);
-    }
+static
+int
+run(int id, int every, const char *word)
+{
+	int i, c;
 
-    printf("Parent has left.\n");
-    return 0;
+	for (i=0; i<MAX; i++) {
+		mutex_lock(&countlock);
+		c = count++;
+		mutex_unlock(&countlock);
+		if (c % every == 0) {
+			say(word);
+		}
+	}
+	return id;
 }
 
-/* multiple threads will simply print out the global variable.
-   Even though there is no synchronization, we should get some 
-   random results.
-*/
+static
+int
+BladeRunner(void *arg)
+{
+	return run((int)arg, 5000, "Blade ");
+}
 
-void
-BladeRunner()
+static
+int
+ThreadRunner(void *arg)
 {
-    while (count < MAX) {
-	if (count % 500 == 0)
-	    printf("Blade ");
-	count++;
-    }
+	return run((int)arg, 5013, " Runner\n");
 }
 
-void
-ThreadRunner()
+int
+main(int argc, char *argv[])
 {
-    while (count < MAX) {
-	if (count % 513 == 0)
-	    printf(" Runner\n");
-	count++;
-    }
+	int tids[NTHREADS];
+	int i, code;
+
+	(void)argc;
+	(void)argv;
+
+	for (i=0; i<NTHREADS; i++) {
+		tids[i] = thread_create(i ? ThreadRunner : BladeRunner,
+					(void *)i);
+		if (tids[i] < 0) {
+			err(1, "thread_create");
+		}
+	}
+
+	for (i=0; i<NTHREADS; i++) {
+		if (thread_join(tids[i], &code) < 0) {
+			err(1, "thread_join %d", tids[i]);
+		}
+		if (code != i) {
+			errx(1, "thread %d exited with %d, expected %d",
+			     tids[i], code, i);
+		}
+	}
+
+	printf("\n");
+	if (count != NTHREADS * MAX) {
+		errx(1, "count is %d, expected %d", count, NTHREADS * MAX);
+	}
+	printf("userthreads: %d threads, count %d: passed\n", NTHREADS,
+	       count);
+	return 0;
 }
-    